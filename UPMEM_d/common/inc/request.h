@@ -15,15 +15,53 @@ typedef uint32_t ADDRTYPE;  // sizeof(uint32_t) == sizeof(ELEMTYPE *)
 #define MRAM_SIZE (62 << 20)
 #define MRAM_ALIGN_BYTES 8
 #define ADDRTYPE_NULL 0  // NULL pointer for ADDRTYPE
+typedef uint64_t GADDRTYPE;  // Global index of points and tree nodes on the host. DPUs only see their own leaves/subtrees, so they keep the compact ADDRTYPE
+#define GADDRTYPE_NULL 0  // NULL pointer for GADDRTYPE
+typedef uint32_t POINTIDTYPE;  // Original id of a point, tracked through the permutation of the tree building phase. The leaf result holds one per point in the permuted order
 // Used for tree
+#define TBP_COMMAND_ACCUMULATE 0  // Sum the dimension `dim` of the points of each segment on the DPU
+#define TBP_COMMAND_SPLIT 1  // Partition the points of each segment on the DPU by its `mean` in its dimension `dim`
+#define TBP_COMMAND_BUILD 2  // Build the subtree of all points on the DPU
+#define TBP_COMMAND_GATHER 3  // Copy the runs of points in `moves` into the stage, one after the other
+#define TBP_COMMAND_SCATTER 4  // Copy the runs of points of the stage to their places in `moves`
+#define TBP_MAX_SEGMENTS 32  // A DPU holds parts of this many large subtrees at most
+#define TBP_MAX_MOVES 64  // Runs of points moved through the stage of a DPU per launch
+#define TBP_POINT_MEM_SIZE (54 << 20)
+#define TBP_POINT_ID_MEM_SIZE (6 << 20)
+#define TBP_STAGE_MEM_SIZE (3 << 19)  // Points that change DPUs between levels of the top tree are staged here, so that the host moves them for whole ranks at once
+#define TBP_STAGE_ID_MEM_SIZE (1 << 19)
 typedef uint32_t MEAN_VALUE_TYPE;
+typedef uint64_t SUM_VALUE_TYPE;  // Sums of a dimension over large nodes overflow MEAN_VALUE_TYPE
+typedef struct {  // The part of a large subtree on a DPU. It stays in MRAM from one level of the top tree to the next
+    ADDRTYPE pointBegin;
+    ADDRTYPE pointAmt;
+    uint32_t dim;
+    MEAN_VALUE_TYPE mean;
+} tbpSegment_t;
+typedef struct {  // A run of points moved between its place on a DPU and the stage
+    ADDRTYPE pointBegin;
+    ADDRTYPE pointAmt;
+} tbpMove_t;
 typedef struct treeNodeType {
     ADDRTYPE left;
     ADDRTYPE right;
     MEAN_VALUE_TYPE mean;  // For leaf nodes, this domain is used as the left most addr on all points
-    unsigned short dim;  // For leaf nodes, this domain is used as the point size of this leaf
+    uint32_t dim;  // For leaf nodes, this domain is used as the point size of this leaf
 } treeNode_t;
+typedef struct globalTreeNodeType {  // The node of the whole tree on the host (and in the tree result)
+    GADDRTYPE left;
+    GADDRTYPE right;
+    GADDRTYPE mean;  // For leaf nodes, this domain is used as the left most addr on all points. Otherwise, it holds the MEAN_VALUE_TYPE split value
+    uint32_t dim;  // For leaf nodes, this domain is used as the point size of this leaf
+} globalTreeNode_t;
 // Used for graph
+#define GBP_MAX_LEAVES 64  // A DPU builds the graphs of this many leaves at most per launch
+#define GBP_POINT_MEM_SIZE (48 << 20)
+#define GBP_NEIGHBOR_MEM_SIZE (14 << 20)
+typedef struct {  // A leaf packed into the MRAM of a DPU for one launch of GBP. Its neighbors start at `pointBegin * neighborAmt`
+    ADDRTYPE pointBegin;
+    ADDRTYPE pointAmt;
+} gbpLeaf_t;
 // Used for priority queue
 typedef unsigned long long pqueue_pri_t;
 typedef struct {
@@ -31,5 +69,10 @@ typedef struct {
 	ADDRTYPE val;
 	// uint32_t pos;
 } pqueue_elem_t_mram;
+typedef struct {  // The neighbor in the knn result. It has the same size as `pqueue_elem_t_mram`, so the leaf-local ids from DPUs can be widened in place
+    pqueue_pri_t pri;
+    GADDRTYPE val;
+} globalNeighbor_t;
+#define NEIGHBOR_NULL ((GADDRTYPE)-1)  // Id of the entries past the list of a point, in the raw knn result of leaves of no more than K points. Their distance is the largest one
 
 #endif // REQUEST_H
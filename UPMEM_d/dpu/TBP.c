@@ -1,38 +1,151 @@
 /*
 Author: KMC20
 Date: 2023/12/6
-Function: Entry to the tree building phase of GCiM on DPUs.
+Function: Entry to the tree building phase of GCiM on DPUs. The program stays resident for the whole phase: the host selects what each launch runs with `command`, and points stay in MRAM between launches.
 */
 
 #include "tree.h"
 
-#define POINT_MEM_SIZE (62 << 20)
+BARRIER_INIT(barrier_TBP, NR_TASKLETS);
+MUTEX_INIT(mutex_sumRes);
+
 #define TREE_MEM_SIZE  (50 << 10)
+#define MOVE_BLOCK_BYTES 1024  // Points and ids are copied through WRAM buffers of this size
+#define MOVE_BLOCK_IDS (MOVE_BLOCK_BYTES / sizeof(POINTIDTYPE) - 2)  // The aligned window around them takes up to 2 more ids
 
 // Inputs
+__host uint32_t command;  // One of TBP_COMMAND_*
 __host ADDRTYPE pointAmt;
+__host uint32_t segmentAmt;
+__host tbpSegment_t segments[TBP_MAX_SEGMENTS];  // For TBP_COMMAND_ACCUMULATE and TBP_COMMAND_SPLIT
+__host uint32_t moveAmt;
+__host tbpMove_t moves[TBP_MAX_MOVES];  // For TBP_COMMAND_GATHER and TBP_COMMAND_SCATTER. Runs are staged one after the other
 __host uint32_t dimAmt;
 __host uint32_t leafCapacity;
 // Inouts
-__mram_noinit ELEMTYPE points[POINT_MEM_SIZE / sizeof(ELEMTYPE)];  // Annotate this line if using DPU_MRAM_HEAP_POINTER to point to points
+__mram_noinit ELEMTYPE points[TBP_POINT_MEM_SIZE / sizeof(ELEMTYPE)];  // Annotate this line if using DPU_MRAM_HEAP_POINTER to point to points
+__mram_noinit POINTIDTYPE pointIds[TBP_POINT_ID_MEM_SIZE / sizeof(POINTIDTYPE)];  // Original ids of points, swapped together with them
+__mram_noinit ELEMTYPE stagedPoints[TBP_STAGE_MEM_SIZE / sizeof(ELEMTYPE)];
+__mram_noinit POINTIDTYPE stagedPointIds[TBP_STAGE_ID_MEM_SIZE / sizeof(POINTIDTYPE)];
 // Outputs
+__host SUM_VALUE_TYPE sumRes[TBP_MAX_SEGMENTS];
+__host ADDRTYPE splitRes[TBP_MAX_SEGMENTS];  // Size of the left part of each segment
 __host treeNode_t tree[TREE_MEM_SIZE / sizeof(treeNode_t)];
 __host ADDRTYPE treeSizeRes;
-#ifdef PERF_EVAL_SIM
+#if defined(PERF_EVAL) || defined(PERF_EVAL_SIM)
 __host perfcounter_t exec_time;
 MUTEX_INIT(mutex_exec_time);
 #endif
 
+static void accumulate() {
+    if (me() == 0) {
+        for (uint32_t segmentId = 0; segmentId < segmentAmt; ++segmentId)
+            sumRes[segmentId] = 0;
+    }
+    barrier_wait(&barrier_TBP);
+    for (uint32_t segmentId = 0; segmentId < segmentAmt; ++segmentId) {
+        tbpSegment_t *segment = &segments[segmentId];
+        if (segment->pointAmt < 1)
+            continue;
+        SUM_VALUE_TYPE sumResMe = accumulatorIndependent(points, segment->pointBegin, segment->pointBegin + segment->pointAmt, segment->dim, dimAmt);
+        mutex_lock(mutex_sumRes);
+        sumRes[segmentId] += sumResMe;
+        mutex_unlock(mutex_sumRes);
+    }
+}
+
+static void split() {
+    if (me() == 0) {
+        uint32_t pointSize = sizeof(ELEMTYPE) * dimAmt;
+        fsb_allocator_t tmplAllocator = fsb_alloc(pointSize, 1);
+        __dma_aligned ELEMTYPE *tmpl = fsb_get(tmplAllocator);
+        fsb_allocator_t tmprAllocator = fsb_alloc(pointSize, 1);
+        __dma_aligned ELEMTYPE *tmpr = fsb_get(tmprAllocator);
+        for (uint32_t segmentId = 0; segmentId < segmentAmt; ++segmentId) {
+            tbpSegment_t *segment = &segments[segmentId];
+            if (segment->pointAmt < 1)
+                splitRes[segmentId] = 0;
+            else
+                splitRes[segmentId] = meanSpliterIndependent(points, pointIds, tmpl, tmpr, pointSize, segment->pointBegin, segment->pointBegin + segment->pointAmt, segment->mean, segment->dim, dimAmt) - segment->pointBegin;
+        }
+        fsb_free(tmprAllocator, tmpr);
+        fsb_free(tmplAllocator, tmpl);
+    }
+}
+
+static void copyPoints(__mram_ptr ELEMTYPE *dst, __mram_ptr ELEMTYPE *src, const uint32_t bytes, __dma_aligned uint8_t *buffer) {  // Runs of whole points are aligned on 8 bytes
+    for (uint32_t copied = 0; copied < bytes; copied += MOVE_BLOCK_BYTES) {
+        uint32_t blockBytes = bytes - copied < MOVE_BLOCK_BYTES ? bytes - copied : MOVE_BLOCK_BYTES;
+        mram_read((__mram_ptr uint8_t *)src + copied, buffer, blockBytes);
+        mram_write(buffer, (__mram_ptr uint8_t *)dst + copied, blockBytes);
+    }
+}
+
+static void copyPointIds(__mram_ptr POINTIDTYPE *dstIds, const ADDRTYPE dstBegin, __mram_ptr POINTIDTYPE *srcIds, const ADDRTYPE srcBegin, const ADDRTYPE idAmt, __dma_aligned POINTIDTYPE *srcBuffer, __dma_aligned POINTIDTYPE *dstBuffer) {  // Ids are narrower than the 8-byte MRAM accesses, so they are copied through the aligned windows around them, and the other ids of a window are written back unchanged
+    for (ADDRTYPE copied = 0; copied < idAmt; copied += MOVE_BLOCK_IDS) {
+        ADDRTYPE blockAmt = idAmt - copied < MOVE_BLOCK_IDS ? idAmt - copied : MOVE_BLOCK_IDS;
+        ADDRTYPE srcWindow = (srcBegin + copied) & ~(ADDRTYPE)1, dstWindow = (dstBegin + copied) & ~(ADDRTYPE)1;
+        ADDRTYPE srcWindowAmt = ((srcBegin + copied + blockAmt + 1) & ~(ADDRTYPE)1) - srcWindow, dstWindowAmt = ((dstBegin + copied + blockAmt + 1) & ~(ADDRTYPE)1) - dstWindow;
+        mram_read(srcIds + srcWindow, srcBuffer, sizeof(POINTIDTYPE) * srcWindowAmt);
+        mram_read(dstIds + dstWindow, dstBuffer, sizeof(POINTIDTYPE) * dstWindowAmt);
+        for (ADDRTYPE id = 0; id < blockAmt; ++id)
+            dstBuffer[dstBegin + copied - dstWindow + id] = srcBuffer[srcBegin + copied - srcWindow + id];
+        mram_write(dstBuffer, dstIds + dstWindow, sizeof(POINTIDTYPE) * dstWindowAmt);
+    }
+}
+
+static void move(const bool gather) {  // Runs of points and their ids go between their places and the stage, where the host moves them for whole ranks at once
+    if (me() == 0) {
+        uint32_t pointSize = sizeof(ELEMTYPE) * dimAmt;
+        fsb_allocator_t srcAllocator = fsb_alloc(MOVE_BLOCK_BYTES, 1);
+        __dma_aligned uint8_t *srcBuffer = fsb_get(srcAllocator);
+        fsb_allocator_t dstAllocator = fsb_alloc(MOVE_BLOCK_BYTES, 1);
+        __dma_aligned uint8_t *dstBuffer = fsb_get(dstAllocator);
+        ADDRTYPE staged = 0;
+        for (uint32_t moveId = 0; moveId < moveAmt; ++moveId) {
+            tbpMove_t *run = &moves[moveId];
+            if (gather) {
+                copyPoints(stagedPoints + staged * dimAmt, points + run->pointBegin * dimAmt, pointSize * run->pointAmt, srcBuffer);
+                copyPointIds(stagedPointIds, staged, pointIds, run->pointBegin, run->pointAmt, (POINTIDTYPE *)srcBuffer, (POINTIDTYPE *)dstBuffer);
+            } else {
+                copyPoints(points + run->pointBegin * dimAmt, stagedPoints + staged * dimAmt, pointSize * run->pointAmt, srcBuffer);
+                copyPointIds(pointIds, run->pointBegin, stagedPointIds, staged, run->pointAmt, (POINTIDTYPE *)srcBuffer, (POINTIDTYPE *)dstBuffer);
+            }
+            staged += run->pointAmt;
+        }
+        fsb_free(dstAllocator, dstBuffer);
+        fsb_free(srcAllocator, srcBuffer);
+    }
+}
+
 int main() {
-#ifdef PERF_EVAL_SIM
+#if defined(PERF_EVAL) || defined(PERF_EVAL_SIM)
     if (me() == 0) {
         exec_time = 0;
         perfcounter_config(COUNT_CYCLES, true);  // `The main difference between counting cycles and instructions is that cycles include the execution time of instructions AND the memory transfers.`
         // perfcounter_config(COUNT_INSTRUCTIONS, true);
     }
 #endif
-    treeConstrDPU(tree, &treeSizeRes, points, 0, pointAmt, dimAmt, leafCapacity);
-#ifdef PERF_EVAL_SIM
+    switch (command) {  // All tasklets take the same branch, so the barriers inside each one match
+        case TBP_COMMAND_ACCUMULATE:
+            accumulate();
+            break;
+        case TBP_COMMAND_SPLIT:
+            split();
+            break;
+        case TBP_COMMAND_BUILD:
+            treeConstrDPU(tree, &treeSizeRes, points, pointIds, 0, pointAmt, dimAmt, leafCapacity);
+            break;
+        case TBP_COMMAND_GATHER:
+            move(true);
+            break;
+        case TBP_COMMAND_SCATTER:
+            move(false);
+            break;
+        default:
+            break;
+    }
+#if defined(PERF_EVAL) || defined(PERF_EVAL_SIM)
     perfcounter_t exec_time_me = perfcounter_get();
     mutex_lock(mutex_exec_time);
     if (exec_time_me > exec_time) {
@@ -42,4 +155,3 @@ int main() {
 #endif
     return 0;
 }
-
@@ -22,6 +22,6 @@ Function: Operations for the graph building phase of GCiM.
 
 #define increAddr(addr) addr + sizeof(pqueue_elem_t_mram)  // Increase the address by sizeof(ELEMTYPE *)
 
-void graphBuilding(const __mram_ptr ELEMTYPE *const points, const ADDRTYPE pointAmt, const unsigned short dimAmt, const uint32_t neighborAmt, const ADDRTYPE pointNeighborStartAddr, __mram_ptr pqueue_elem_t_mram *neighbors);
+void graphBuilding(const __mram_ptr ELEMTYPE *const points, const gbpLeaf_t *const leaves, const uint32_t leafAmt, const unsigned short dimAmt, const uint32_t neighborAmt, __mram_ptr pqueue_elem_t_mram *neighbors);
 
 #endif
\ No newline at end of file
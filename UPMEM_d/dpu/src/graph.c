@@ -77,87 +77,65 @@ void save_pq_into_mram(pqueue_t *pq, const ADDRTYPE pointNeighborStartAddr, __mr
     }
 }
 
-void graphBuilding(const __mram_ptr ELEMTYPE *const points, const ADDRTYPE pointAmt, const unsigned short dimAmt, const uint32_t neighborAmt, const ADDRTYPE pointNeighborStartAddr, __mram_ptr pqueue_elem_t_mram *neighbors) {
+static uint8_t *readPoint(ELEMTYPE *pointBuf, uint8_t *pointCache, seqreader_t *pointSR, const uint32_t pointSize) {  // Copy the point under the cache into WRAM, and return the cache of the next point
+    for (uint32_t readBytes = 0; readBytes < pointSize;) {
+        uint32_t curReadBytes = pointSize - readBytes;
+        if (curReadBytes > SEQREAD_CACHE_SIZE)
+            curReadBytes = SEQREAD_CACHE_SIZE;
+        memcpy((uint8_t *)pointBuf + readBytes, pointCache, curReadBytes);
+        pointCache = seqread_get(pointCache, curReadBytes, pointSR);
+        readBytes += curReadBytes;
+    }
+    return pointCache;
+}
+
+void graphBuilding(const __mram_ptr ELEMTYPE *const points, const gbpLeaf_t *const leaves, const uint32_t leafAmt, const unsigned short dimAmt, const uint32_t neighborAmt, __mram_ptr pqueue_elem_t_mram *neighbors) {  // Points of all leaves are dealt to tasklets in turn, so tasklets are kept busy by leaves smaller than NR_TASKLETS. Each point is compared with the points of its own leaf only
+    if (leafAmt < 1)
+        return;
     fsb_allocator_t pq_allocator;
     pqueue_t *pq;
     fsb_allocator_t pqElemsAllocator = fsb_alloc(neighborAmt * sizeof(pqueue_elem_t), 1);
     pqueue_elem_t *pqElems = (pqueue_elem_t *)fsb_get(pqElemsAllocator);
     pq = pqueue_init(neighborAmt, cmp_pri, get_pri, set_pri, get_pos, set_pos, &pq_allocator);
     uint32_t pointSize = sizeof(ELEMTYPE) * dimAmt;
-    const __mram_ptr ELEMTYPE *const pointBorder = points + pointAmt;
-    const __mram_ptr ELEMTYPE *const pointReadBorder = points + pointAmt * pointSize;
     fsb_allocator_t curPointBufAllocator = fsb_alloc(pointSize, 1);
     __dma_aligned ELEMTYPE *curPointBuf = fsb_get(curPointBufAllocator);
     seqreader_t curPointSR;
-    uint8_t *curPointCache = seqread_init(seqread_alloc(), (__mram_ptr ELEMTYPE *)points + me() * dimAmt, &curPointSR);
+    uint8_t *curPointCache = seqread_init(seqread_alloc(), (__mram_ptr ELEMTYPE *)points, &curPointSR);
     fsb_allocator_t leafPointBufAllocator = fsb_alloc(pointSize, 1);
     __dma_aligned ELEMTYPE *leafPointBuf = fsb_get(leafPointBufAllocator);
     seqreader_t leafPointSR;
     uint8_t *leafPointCache = seqread_init(seqread_alloc(), (__mram_ptr ELEMTYPE *)points, &leafPointSR);
-    __mram_ptr pqueue_elem_t_mram *neighborsWrite = neighbors + me() * neighborAmt;
-    uint32_t neighborsWriteStride = neighborAmt * NR_TASKLETS;
-    for (__mram_ptr ELEMTYPE *curPointPt = (__mram_ptr ELEMTYPE *)points + me(); curPointPt < pointBorder; curPointPt += NR_TASKLETS) {
-        for (uint32_t readBytes = 0; readBytes < pointSize; readBytes += SEQREAD_CACHE_SIZE) {
-            if (pointSize > SEQREAD_CACHE_SIZE) {
-                uint32_t curReadBytes = pointSize - readBytes;
-                if (curReadBytes > SEQREAD_CACHE_SIZE)
-                    curReadBytes = SEQREAD_CACHE_SIZE;
-                memcpy(curPointBuf + readBytes, curPointCache, curReadBytes);
-                __mram_ptr uint8_t *seqreadPrePt = (__mram_ptr uint8_t *)seqread_tell(curPointCache, &curPointSR);
-                seqread_get(curPointCache, curReadBytes, &curPointSR);  // Note: the official document says this function `consists in incrementing the pointer`, but it seems that it does not here.
-                                                                        //       So adjust the pointer with tell/seek manually.
-                                                                        //       It does not mind if it `consists in incrementing the pointer` really since the told pointer is the previous one
-                seqread_seek(seqreadPrePt + curReadBytes, &curPointSR);
-            } else {
-                memcpy(curPointBuf + readBytes, curPointCache, pointSize);
-                __mram_ptr uint8_t *seqreadPrePt = (__mram_ptr uint8_t *)seqread_tell(curPointCache, &curPointSR);
-                seqread_get(curPointCache, pointSize, &curPointSR);
-                seqread_seek(seqreadPrePt + pointSize, &curPointSR);
-            }
-        }
+    ADDRTYPE pointAmt = leaves[leafAmt - 1].pointBegin + leaves[leafAmt - 1].pointAmt;
+    uint32_t leafId = 0;
+    for (ADDRTYPE curPointId = me(); curPointId < pointAmt; curPointId += NR_TASKLETS) {
+        while (curPointId >= leaves[leafId].pointBegin + leaves[leafId].pointAmt)
+            ++leafId;
+        const gbpLeaf_t *leaf = &leaves[leafId];
+        curPointCache = seqread_seek((__mram_ptr ELEMTYPE *)points + curPointId * dimAmt, &curPointSR);
+        readPoint(curPointBuf, curPointCache, &curPointSR, pointSize);
+        leafPointCache = seqread_seek((__mram_ptr ELEMTYPE *)points + leaf->pointBegin * dimAmt, &leafPointSR);
         uint32_t pqElemSize = 0;
-        for (__mram_ptr ELEMTYPE *leafPointPt = (__mram_ptr ELEMTYPE *)points; leafPointPt < pointBorder; ++leafPointPt) {
-            if (curPointPt != leafPointPt) {
-                for (uint32_t readBytes = 0; readBytes < pointSize; readBytes += SEQREAD_CACHE_SIZE) {
-                    if (pointSize > SEQREAD_CACHE_SIZE) {
-                        uint32_t leafReadBytes = pointSize - readBytes;
-                        if (leafReadBytes > SEQREAD_CACHE_SIZE)
-                            leafReadBytes = SEQREAD_CACHE_SIZE;
-                        memcpy(leafPointBuf + readBytes, leafPointCache, leafReadBytes);
-                        __mram_ptr uint8_t *seqreadPrePt = (__mram_ptr uint8_t *)seqread_tell(leafPointCache, &leafPointSR);
-                        seqread_get(leafPointCache, leafReadBytes, &leafPointSR);
-                        seqread_seek(seqreadPrePt + leafReadBytes, &leafPointSR);
-                    } else {
-                        memcpy(leafPointBuf + readBytes, leafPointCache, pointSize);
-                        __mram_ptr uint8_t *seqreadPrePt = (__mram_ptr uint8_t *)seqread_tell(leafPointCache, &leafPointSR);
-                        seqread_get(leafPointCache, pointSize, &leafPointSR);
-                        seqread_seek(seqreadPrePt + pointSize, &leafPointSR);
-                    }
-                }
-                pqueue_pri_t dist = distCalVec(curPointBuf, leafPointBuf, dimAmt);
-                if (pqElemSize < neighborAmt) {
-                    pqElems[pqElemSize].pri = dist, pqElems[pqElemSize].val = leafPointPt - points;
-                    pqueue_insert(pq, pqElems + pqElemSize);
-                    ++pqElemSize;
-                } else {
-                    pqueue_elem_t *pqTop = pqueue_peek(pq);
-                    if (pqTop->pri > dist) {
-                        pqTop->val = leafPointPt - points;
-                        pqTop->pri = dist;
-                        pqueue_pop(pq);
-                        pqueue_insert(pq, pqTop);
-                    }
-                }
+        for (ADDRTYPE leafPointId = 0; leafPointId < leaf->pointAmt; ++leafPointId) {  // Neighbors are given by their ids in the leaf
+            leafPointCache = readPoint(leafPointBuf, leafPointCache, &leafPointSR, pointSize);
+            if (leaf->pointBegin + leafPointId == curPointId)
+                continue;
+            pqueue_pri_t dist = distCalVec(curPointBuf, leafPointBuf, dimAmt);
+            if (pqElemSize < neighborAmt) {
+                pqElems[pqElemSize].pri = dist, pqElems[pqElemSize].val = leafPointId;
+                pqueue_insert(pq, pqElems + pqElemSize);
+                ++pqElemSize;
             } else {
-                seqread_seek((__mram_ptr uint8_t *)seqread_tell(leafPointCache, &leafPointSR) + pointSize, &leafPointSR);
+                pqueue_elem_t *pqTop = pqueue_peek(pq);
+                if (pqTop->pri > dist) {
+                    pqTop->val = leafPointId;
+                    pqTop->pri = dist;
+                    pqueue_pop(pq);
+                    pqueue_insert(pq, pqTop);
+                }
             }
         }
-        seqread_seek((__mram_ptr uint8_t *)points, &leafPointSR);
-        save_pq_into_mram(pq, pointNeighborStartAddr, neighborsWrite);  // Pop all elements in pq here! Leave redundant space for incremental updating
-        neighborsWrite += neighborsWriteStride;
-        __mram_ptr uint8_t *curPointNextReadPt = (__mram_ptr uint8_t *)seqread_tell(curPointCache, &curPointSR) + (NR_TASKLETS - 1) * pointSize;
-        if (curPointNextReadPt < (__mram_ptr uint8_t *)pointReadBorder)
-            seqread_seek(curPointNextReadPt, &curPointSR);
+        save_pq_into_mram(pq, 0, neighbors + (size_t)curPointId * neighborAmt);  // Pop all elements in pq here! Leave redundant space for incremental updating
     }
     fsb_free(leafPointBufAllocator, leafPointBuf);
     fsb_free(curPointBufAllocator, curPointBuf);
@@ -14,146 +14,23 @@ static uint64_t maskBase = (1 << (sizeof(ELEMTYPE) << 3)) - 1;
 static uint32_t rightShiftBase = sizeof(uint64_t) / sizeof(ELEMTYPE);  // Assume that sizeof(ELEMTYPE) is always no larger than sizeof(uint64_t) here!
 // #endif
 
-MEAN_VALUE_TYPE accumulator(const ADDRTYPE left, const ADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {  // Use DPU_MRAM_HEAP_POINTER to point to points; Reduce multi-thread results on top
-// #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
-    uint64_t mask = maskBase << (dim % rightShiftBase << 3);  // Assume that the size of each point is always a multiple of 8, and the start address of points is always aliged on 8 bytes! This is alright for SIFT/GIST/DEEP datasets used for tests
-    uint32_t rightShift = dim % rightShiftBase << 3;
-    uint64_t maskAddr = ~(uint64_t)(MRAM_ALIGN_BYTES - 1);
-// #endif
-    uint32_t stride = NR_TASKLETS * dimAmt;
-    ADDRTYPE multiLeft = left + me();
-    MEAN_VALUE_TYPE sum = 0;
-    for (__mram_ptr ELEMTYPE *pointPt = (__mram_ptr ELEMTYPE *)DPU_MRAM_HEAP_POINTER + dimAmt * multiLeft + dim, *pointPtEnd = (__mram_ptr ELEMTYPE *)DPU_MRAM_HEAP_POINTER + dimAmt * right; pointPt < pointPtEnd; pointPt += stride) {
-// #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
-        __dma_aligned uint64_t elem;
-        mram_read((__mram_ptr ELEMTYPE *)((uint64_t)pointPt & maskAddr), &elem, sizeof(elem));  // Aligned read: multi-thread safe
-        sum += (elem & mask) >> rightShift;  // Little-endian
-// #else
-//         __dma_aligned ELEMTYPE elem;
-//         mram_read(pointPt, &elem, sizeof(elem));
-//         sum += elem;
-// #endif
-    }
-    return sum;
-}
-
-ADDRTYPE meanSpliter(const ADDRTYPE left, const ADDRTYPE right, const MEAN_VALUE_TYPE mean, const uint32_t dim, const uint32_t dimAmt) {  // Return the index of the last element that is smaller than or equal to the mean value
-// #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
-    uint64_t mask = maskBase << (dim % rightShiftBase << 3);  // Assume that the size of each point is always a multiple of 8, and the start address of points is always aliged on 8 bytes! This is alright for SIFT/GIST/DEEP datasets used for tests
-    uint32_t rightShift = dim % rightShiftBase << 3;
-    uint64_t maskAddr = ~(uint64_t)(MRAM_ALIGN_BYTES - 1);
-    __dma_aligned uint64_t readbuf;
-    ELEMTYPE lbuf, rbuf;
-// #else
-//     __dma_aligned ELEMTYPE lbuf, rbuf;
-// #endif
-    ADDRTYPE pivot = left;
-    __mram_ptr ELEMTYPE *lBorder = (__mram_ptr ELEMTYPE *)DPU_MRAM_HEAP_POINTER + dimAmt * left + dim, *rBorder = (__mram_ptr ELEMTYPE *)DPU_MRAM_HEAP_POINTER + dimAmt * right;  // Add `dim` to `lBorder` so that the case that `rPt` gets smaller than points[left] would never occur so that no underflow happens
-    __mram_ptr ELEMTYPE *lPt = lBorder, *rPt = rBorder - dimAmt + dim;
-    uint32_t pointSize = sizeof(ELEMTYPE) * dimAmt;  // Assume that the size of each point (i.e. pointSize) is always a multiple of 8, and the start address of points is always aliged on 8 bytes!
-    fsb_allocator_t tmplAllocator = fsb_alloc(pointSize, 1);
-    __dma_aligned ELEMTYPE *tmpl = fsb_get(tmplAllocator);
-    fsb_allocator_t tmprAllocator = fsb_alloc(pointSize, 1);
-    __dma_aligned ELEMTYPE *tmpr = fsb_get(tmprAllocator);
-    uint32_t meanEqCnt = 0;
-    while (true) {
-        while (lPt < rBorder) {
-// #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
-            mram_read((__mram_ptr ELEMTYPE *)((uint64_t)lPt & maskAddr), &readbuf, sizeof(readbuf));
-            lbuf = (readbuf & mask) >> rightShift;  // Little-endian
-// #else
-//             mram_read(lPt, &lbuf, sizeof(lbuf));
-// #endif
-            if (lbuf <= mean)
-                lPt += dimAmt, ++pivot, meanEqCnt += lbuf == mean;
-            else
-                break;
-        }
-        while (rPt > lBorder) {
-// #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
-            mram_read((__mram_ptr ELEMTYPE *)((uint64_t)rPt & maskAddr), &readbuf, sizeof(readbuf));
-            rbuf = (readbuf & mask) >> rightShift;  // Little-endian
-// #else
-//             mram_read(rPt, &rbuf, sizeof(rbuf));
-// #endif
-            if (rbuf > mean)
-                rPt -= dimAmt;
-            else
-                break;
-        }
-        if (lPt < rPt) {
-            mram_read(lPt - dim, tmpl, pointSize);
-            mram_read(rPt - dim, tmpr, pointSize);
-            mram_write(tmpl, rPt - dim, pointSize);
-            mram_write(tmpr, lPt - dim, pointSize);
-            lPt += dimAmt, ++pivot, meanEqCnt += *(tmpr + dim) == mean, rPt -= dimAmt;
-        } else {
-            break;
-        }
-    }
-    if (meanEqCnt * dimAmt > (uint32_t)(rBorder - rPt))  {  // Solve the extreme imbalance problem
-        meanEqCnt >>= 1;  // The amount of points that will be added into the right part
-        lPt = lBorder;
-        if (rPt <= lBorder)
-            rPt += dimAmt;
-        while (rPt < rBorder) {
-// #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
-            mram_read((__mram_ptr ELEMTYPE *)((uint64_t)rPt & maskAddr), &readbuf, sizeof(readbuf));
-            rbuf = (readbuf & mask) >> rightShift;  // Little-endian
-// #else
-//             mram_read(rPt, &rbuf, sizeof(rbuf));
-// #endif
-            if (rbuf > mean)
-                break;
-            else
-                rPt += dimAmt;
-        }
-        if (rPt > rBorder - dimAmt + dim)
-            rPt = rBorder - dimAmt + dim;
-        pivot -= meanEqCnt;
-        while (meanEqCnt > 0) {
-            while (lPt < rBorder) {
-// #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
-                mram_read((__mram_ptr ELEMTYPE *)((uint64_t)lPt & maskAddr), &readbuf, sizeof(readbuf));
-                lbuf = (readbuf & mask) >> rightShift;  // Little-endian
-// #else
-//             mram_read(lPt, &lbuf, sizeof(lbuf));
-// #endif
-                if (lbuf < mean)
-                    lPt += dimAmt;
-                else
-                    break;  // Expect that lbuf == mean
-            }
-            while (rPt > lBorder) {
-// #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
-                mram_read((__mram_ptr ELEMTYPE *)((uint64_t)rPt & maskAddr), &readbuf, sizeof(readbuf));
-                rbuf = (readbuf & mask) >> rightShift;  // Little-endian
-// #else
-//             mram_read(rPt, &rbuf, sizeof(rbuf));
-// #endif
-                if (rbuf > mean)
-                    rPt -= dimAmt;
-                else
-                    break;  // Expect that rbuf <= mean
-            }
-            if (lPt < rPt) {
-                mram_read(lPt - dim, tmpl, pointSize);
-                mram_read(rPt - dim, tmpr, pointSize);
-                mram_write(tmpl, rPt - dim, pointSize);
-                mram_write(tmpr, lPt - dim, pointSize);
-                rPt -= dimAmt;
-                --meanEqCnt;
-            } else {
-                break;
-            }
-        }
+static void swapPointIds(__mram_ptr POINTIDTYPE *pointIds, const ADDRTYPE lId, const ADDRTYPE rId) {  // Ids are narrower than the 8-byte MRAM accesses, so swap them inside the aligned words that hold them
+    __mram_ptr POINTIDTYPE *lWord = pointIds + (lId & ~(ADDRTYPE)1), *rWord = pointIds + (rId & ~(ADDRTYPE)1);
+    __dma_aligned POINTIDTYPE lbuf[2], rbuf[2];
+    POINTIDTYPE tmp;
+    mram_read(lWord, lbuf, sizeof(lbuf));
+    if (lWord == rWord) {
+        tmp = lbuf[lId & 1], lbuf[lId & 1] = lbuf[rId & 1], lbuf[rId & 1] = tmp;
+        mram_write(lbuf, lWord, sizeof(lbuf));
+        return;
     }
-    fsb_free(tmprAllocator, tmpr);
-    fsb_free(tmplAllocator, tmpl);
-    return pivot;
+    mram_read(rWord, rbuf, sizeof(rbuf));
+    tmp = lbuf[lId & 1], lbuf[lId & 1] = rbuf[rId & 1], rbuf[rId & 1] = tmp;
+    mram_write(lbuf, lWord, sizeof(lbuf));
+    mram_write(rbuf, rWord, sizeof(rbuf));
 }
 
-MEAN_VALUE_TYPE accumulatorIndependent(const __mram_ptr ELEMTYPE *const points, const ADDRTYPE left, const ADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {  // Reduce multi-thread results on top
+SUM_VALUE_TYPE accumulatorIndependent(const __mram_ptr ELEMTYPE *const points, const ADDRTYPE left, const ADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {  // Reduce multi-thread results on top
 // #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
     uint64_t mask = maskBase << (dim % rightShiftBase << 3);  // Assume that the size of each point is always a multiple of 8, and the start address of points is always aliged on 8 bytes! This is alright for SIFT/GIST/DEEP datasets used for tests
     uint32_t rightShift = dim % rightShiftBase << 3;
@@ -161,7 +38,7 @@ MEAN_VALUE_TYPE accumulatorIndependent(const __mram_ptr ELEMTYPE *const points,
 // #endif
     uint32_t stride = NR_TASKLETS * dimAmt;
     ADDRTYPE multiLeft = left + me();
-    MEAN_VALUE_TYPE sum = 0;
+    SUM_VALUE_TYPE sum = 0;
     for (__mram_ptr ELEMTYPE *pointPt = (__mram_ptr ELEMTYPE *)points + dimAmt * multiLeft + dim, *pointPtEnd = (__mram_ptr ELEMTYPE *)points + dimAmt * right; pointPt < pointPtEnd; pointPt += stride) {
 // #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
         __dma_aligned uint64_t elem;
@@ -176,7 +53,7 @@ MEAN_VALUE_TYPE accumulatorIndependent(const __mram_ptr ELEMTYPE *const points,
     return sum;
 }
 
-ADDRTYPE meanSpliterIndependent(__mram_ptr ELEMTYPE *points, __dma_aligned ELEMTYPE *const tmpl, __dma_aligned ELEMTYPE *const tmpr, const uint32_t pointSize, const ADDRTYPE left, const ADDRTYPE right, const MEAN_VALUE_TYPE mean, const uint32_t dim, const uint32_t dimAmt) {  // Return the index of the last element that is smaller than or equal to the mean value
+ADDRTYPE meanSpliterIndependent(__mram_ptr ELEMTYPE *points, __mram_ptr POINTIDTYPE *pointIds, __dma_aligned ELEMTYPE *const tmpl, __dma_aligned ELEMTYPE *const tmpr, const uint32_t pointSize, const ADDRTYPE left, const ADDRTYPE right, const MEAN_VALUE_TYPE mean, const uint32_t dim, const uint32_t dimAmt) {  // Return the index of the last element that is smaller than or equal to the mean value
 // #if (sizeof(ELEMTYPE) < sizeof(uint64_t))
     uint64_t mask = maskBase << (dim % rightShiftBase << 3);  // Assume that the size of each point is always a multiple of 8, and the start address of points is always aliged on 8 bytes! This is alright for SIFT/GIST/DEEP datasets used for tests
     uint32_t rightShift = dim % rightShiftBase << 3;
@@ -220,6 +97,7 @@ ADDRTYPE meanSpliterIndependent(__mram_ptr ELEMTYPE *points, __dma_aligned ELEMT
             mram_read(rPt - dim, tmpr, pointSize);
             mram_write(tmpl, rPt - dim, pointSize);
             mram_write(tmpr, lPt - dim, pointSize);
+            swapPointIds(pointIds, (lPt - points) / dimAmt, (rPt - points) / dimAmt);
             lPt += dimAmt, ++pivot, meanEqCnt += *(tmpr + dim) == mean, rPt -= dimAmt;
         } else {
             break;
@@ -275,6 +153,7 @@ ADDRTYPE meanSpliterIndependent(__mram_ptr ELEMTYPE *points, __dma_aligned ELEMT
                 mram_read(rPt - dim, tmpr, pointSize);
                 mram_write(tmpl, rPt - dim, pointSize);
                 mram_write(tmpr, lPt - dim, pointSize);
+                swapPointIds(pointIds, (lPt - points) / dimAmt, (rPt - points) / dimAmt);
                 rPt -= dimAmt;
                 --meanEqCnt;
             } else {
@@ -297,9 +176,9 @@ ADDRTYPE treeConstrDPU_ltop;
 ADDRTYPE treeConstrDPU_rtop;
 unsigned short treeConstrDPU_dim;
 uint32_t treeConstrDPU_stackSize;
-MEAN_VALUE_TYPE treeConstrDPU_sum;
+SUM_VALUE_TYPE treeConstrDPU_sum;
 uint32_t treeConstrDPU_meet_leaf;
-void treeConstrDPU(treeNode_t *tree, ADDRTYPE *treeSizeRes, __mram_ptr ELEMTYPE *points, const ADDRTYPE treeBaseAddr, const ADDRTYPE pointAmt, const unsigned short dimAmt, const unsigned short leafCapacity) {  // Static linked-list
+void treeConstrDPU(treeNode_t *tree, ADDRTYPE *treeSizeRes, __mram_ptr ELEMTYPE *points, __mram_ptr POINTIDTYPE *pointIds, const ADDRTYPE treeBaseAddr, const ADDRTYPE pointAmt, const unsigned short dimAmt, const unsigned short leafCapacity) {  // Static linked-list
     if (pointAmt < 1) {
         *treeSizeRes = 0;
         return;
@@ -346,14 +225,14 @@ void treeConstrDPU(treeNode_t *tree, ADDRTYPE *treeSizeRes, __mram_ptr ELEMTYPE
         barrier_wait(&barrier_tree);
         if (treeConstrDPU_meet_leaf > 0)
             continue;
-        MEAN_VALUE_TYPE sum = accumulatorIndependent(points, treeConstrDPU_ltop, treeConstrDPU_rtop, treeConstrDPU_dim, dimAmt);
+        SUM_VALUE_TYPE sum = accumulatorIndependent(points, treeConstrDPU_ltop, treeConstrDPU_rtop, treeConstrDPU_dim, dimAmt);
         mutex_lock(mutex_sums);
         treeConstrDPU_sum += sum;
         mutex_unlock(mutex_sums);
         barrier_wait(&barrier_tree);
         if (me() == 0) {
             MEAN_VALUE_TYPE mean = treeConstrDPU_sum / (treeConstrDPU_rtop - treeConstrDPU_ltop);
-            ADDRTYPE pivot = meanSpliterIndependent(points, tmpl, tmpr, pointSize, treeConstrDPU_ltop, treeConstrDPU_rtop, mean, treeConstrDPU_dim, dimAmt);
+            ADDRTYPE pivot = meanSpliterIndependent(points, pointIds, tmpl, tmpr, pointSize, treeConstrDPU_ltop, treeConstrDPU_rtop, mean, treeConstrDPU_dim, dimAmt);
             ttop->mean = mean;
             ttop->dim = treeConstrDPU_dim;
             if (treeConstrDPU_rtop - pivot > leafCapacity) {
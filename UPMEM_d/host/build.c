@@ -8,15 +8,29 @@ Function: Management including data transfer with DPU and for the building phase
 #include <math.h>  // ceil
 #include <time.h>
 #include <string.h>  // memmove
+#include <stddef.h>  // offsetof
 #include <getopt.h>  // getopt
 #include <stdlib.h>  // EXIT_SUCCESS, EXIT_FAILURE; srand
 #include <stdio.h>  // FILE
 #include <unistd.h>  // access
 #include <errno.h>  // errno
+#include <stdbool.h>  // bool
+#include <fcntl.h>  // open
+#include <pthread.h>  // pthread_mutex_t
+#include <sys/stat.h>  // stat
 #include <dpu.h>
 #include <sys/time.h>  // gettimeofday
 #include <dpu_error.h>  // dpu_error_t (and DPU_OK, etc)
 #include "request.h"
+#include "dataIO.h"
+#include "resultWriter.h"
+#include "knnCodec.h"
+#include "checkpoint.h"
+#include "bundle.h"
+#include "rankDispatcher.h"
+#include "gbpScheduler.h"
+#include "hostGraph.h"
+#include "tree.h"
 #ifdef ENERGY_EVAL
 #include "measureEnergy.h"
 #endif
@@ -31,71 +45,236 @@ typedef uint64_t perfcounter_t;
 
 #define LARGE_TREE_THRESHOLD (32 << 20)  // This value should be in [leaf capacity, Mram size]
 #define min(a, b) a < b ? a : b
+#define TBP_DPU_BANDWIDTH (256 << 20)  // Unit: byte/s. Points scanned by one DPU in a pass over its segments, for the cost model of `-T auto`
+#define TBP_XFER_BANDWIDTH (8ULL << 30)  // Unit: byte/s. Points uploaded from the host to all DPUs at once
+#define TBP_LEVEL_LATENCY 2e-3  // Unit: s. Launches, callbacks and moves of parts of one level of the top tree on DPUs
+#define TBP_HOST_LEVEL_PASSES 4  // Passes over the points of a level split on the host: summation, classification, scatter and copy back
+#define TBP_PROBE_BYTES (64 << 20)  // Copied once by all threads to measure the bandwidth of the host before its first level
+#define TBP_PROBE_CHUNK_BYTES (1 << 20)
 
-DPU_INCBIN(dpu_binary_TBP_accumulator, DPU_BINARY_TBP_ACCUMULATOR)
-DPU_INCBIN(dpu_binary_TBP_meanSpliter, DPU_BINARY_TBP_MEANSPLITER)
 DPU_INCBIN(dpu_binary_TBP, DPU_BINARY_TBP)
 DPU_INCBIN(dpu_binary_GBP, DPU_BINARY_GBP)
 
+typedef enum {  // Where the top tree of the tree building phase is split
+    TBP_ENGINE_DPU,  // Level by level on DPUs, then subtrees on DPUs
+    TBP_ENGINE_HOST,  // The whole tree on the host by `treeConstrDPU`
+    TBP_ENGINE_AUTO  // The first levels on the host while the cost model expects them to be faster there, then on DPUs
+} tbpEngine_t;
 
-ADDRTYPE getPointsAmount(const char *const pointsFileName, const uint32_t dimAmt) {
-    FILE *fp = fopen(pointsFileName, "rb");
-    if (fp == NULL) {
-        printf("Failed to open the input point file: %s! Exit now!\n", pointsFileName);
-        exit(-1);
-    }
-    fseek(fp, 0, SEEK_END);
-    ADDRTYPE pointsAmt = ftell(fp) / (sizeof(ELEMTYPE) * dimAmt);
-    fclose(fp);
-    return pointsAmt;
+typedef enum {  // Where the graph building phase runs
+    GBP_ENGINE_DPU,
+    GBP_ENGINE_HOST,  // All cores of the host CPU. No DPU is allocated
+    GBP_ENGINE_HYBRID  // DPUs and the host CPU at once, each one taking leaves as fast as it builds them
+} gbpEngine_t;
+
+typedef struct {
+    globalTreeNode_t *tree;
+    GADDRTYPE *treeIdSize;
+    ELEMTYPE *points;
+    POINTIDTYPE *pointIds;
+    GADDRTYPE pointAmt;
+    uint32_t dimAmt;
+    uint32_t leafCapacity;
+    GADDRTYPE *leafIds;
+    GADDRTYPE *leafIdSize;
+    leafQueue_t *leafQueue;
+#ifdef PERF_EVAL
+    uint64_t execTime;  // Unit: us
+#endif
+} buildTreeContext;
+static void *buildTree(void *args) {  // The tree building phase in the background. Leaves go to the queue as soon as they are final
+    buildTreeContext *ctx = (buildTreeContext *)args;
+#ifdef PERF_EVAL
+    struct timeval timecheck;
+    gettimeofday(&timecheck, NULL);
+    long start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
+    treeConstrDPU(ctx->tree, ctx->treeIdSize, ctx->points, ctx->pointIds, 0, ctx->pointAmt, ctx->dimAmt, ctx->leafCapacity, ctx->leafIds, ctx->leafIdSize, ctx->leafQueue);
+#ifdef PERF_EVAL
+    gettimeofday(&timecheck, NULL);
+    ctx->execTime = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec - start;
+#endif
+    return NULL;
 }
 
-void loadPointsFromFile(const char *const pointsFileName, ELEMTYPE *points) {
-    FILE *fp = fopen(pointsFileName, "rb");
-    if (fp == NULL) {
-        printf("Failed to open the input point file: %s! Exit now!\n", pointsFileName);
-        exit(-1);
+typedef struct {  // Files of the out-of-core mode. Points are read from `loadFd` and written back in place into `spillFd`, an unlinked file beside the leaf result, so the points are never resident on the host
+    int loadFd;
+    int spillFd;
+    uint8_t **rankBuffers;  // Transfers are staged in a buffer per rank, since the callbacks of ranks run in parallel
+    size_t *rankBufferBytes;
+} outOfCore_t;
+static uint8_t *getRankBuffer(outOfCore_t *outOfCore, const uint32_t rank_id, const size_t size) {
+    if (outOfCore->rankBufferBytes[rank_id] < size) {
+        free(outOfCore->rankBuffers[rank_id]);
+        outOfCore->rankBuffers[rank_id] = malloc(size);
+        outOfCore->rankBufferBytes[rank_id] = size;
     }
-    fseek(fp, 0, SEEK_END);
-    long long int pointsElemSize = ftell(fp) / sizeof(ELEMTYPE);
-    fseek(fp, 0, SEEK_SET);
-    if (fread(points, sizeof(ELEMTYPE), pointsElemSize, fp) == 0) {
-        fclose(fp);
-        printf("The input point file: %s is an empty file! Exit now!\n", pointsFileName);
-        exit(-1);
+    return outOfCore->rankBuffers[rank_id];
+}
+static void loadFromSpill(outOfCore_t *outOfCore) {  // Switch to the spill file once every point has been written back into it
+    if (outOfCore->loadFd != outOfCore->spillFd) {
+        close(outOfCore->loadFd);
+        outOfCore->loadFd = outOfCore->spillFd;
     }
-    fclose(fp);
 }
-
-void saveDataToFile(const char *const dataFileName, const void *data, const size_t size, const size_t nmemb) {
-    FILE *fp = fopen(dataFileName, "wb");
-    if (fp == NULL) {
-        printf("Failed to open the output point file: %s! Exit now!\n", dataFileName);
-        exit(-1);
+static void copyPointsToDPU(struct dpu_set_t dpu, const uint32_t rank_id, const uint32_t dpuOffset, const ELEMTYPE *points, outOfCore_t *outOfCore, const GADDRTYPE elemAddr, const size_t size) {  // `elemAddr` indexes the elements of all points, either in memory or in the file of the out-of-core mode
+    if (outOfCore == NULL) {
+        DPU_ASSERT(dpu_copy_to(dpu, "points", dpuOffset, (const uint8_t *)&points[elemAddr], size));
+    } else {
+        uint8_t *buffer = getRankBuffer(outOfCore, rank_id, size);
+        readDataAt(outOfCore->loadFd, buffer, size, elemAddr * sizeof(ELEMTYPE));
+        DPU_ASSERT(dpu_copy_to(dpu, "points", dpuOffset, buffer, size));
+    }
+}
+static void copyPointIdsToDPU(struct dpu_set_t dpu, const POINTIDTYPE *pointIds, const GADDRTYPE pointAddr, const ADDRTYPE pointSize) {  // Transfers are rounded up to 8 bytes, which is why `pointIds` has a padding id at its end
+    DPU_ASSERT(dpu_copy_to(dpu, "pointIds", 0, (const uint8_t *)&pointIds[pointAddr], sizeof(POINTIDTYPE) * ((pointSize + 1) & ~(ADDRTYPE)1)));
+}
+static void setTBPCommand(struct dpu_set_t dpu_set, const uint32_t command) {  // Select what the next launch of the resident TBP program runs. Synchronous, since `command` is on the stack
+    DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(command), 0, &command, sizeof(uint32_t), DPU_XFER_DEFAULT));
+}
+static size_t getRankXferSize(const size_t *sizes, const uint32_t nr_dpus) {  // Runs of a rank are moved by one transfer, padded to the largest run and rounded up to 8 bytes. Sizes are 0 for idle DPUs, which are not prepared
+    size_t xferSize = 0;
+    for (uint32_t each_dpu = 0; each_dpu < nr_dpus; ++each_dpu)
+        xferSize = sizes[each_dpu] > xferSize ? sizes[each_dpu] : xferSize;
+    return (xferSize + 7) & ~(size_t)7;
+}
+static void pushPointsToRank(struct dpu_set_t rank, const uint32_t rank_id, const ELEMTYPE *points, outOfCore_t *outOfCore, const GADDRTYPE elemAmt, const GADDRTYPE *elemAddrs, const size_t *sizes) {  // Upload a run of points to each DPU of a rank at once. Padding is read from the points after each run
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    size_t xferSize = getRankXferSize(sizes, nr_dpus);
+    if (xferSize < 1)
+        return;
+    unsigned int each_dpu;
+    struct dpu_set_t dpu;
+    if (outOfCore != NULL) {  // Runs are staged side by side in the buffer of the rank
+        uint8_t *buffer = getRankBuffer(outOfCore, rank_id, xferSize * nr_dpus);
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            if (sizes[each_dpu] > 0) {
+                readDataAt(outOfCore->loadFd, buffer + xferSize * each_dpu, sizes[each_dpu], elemAddrs[each_dpu] * sizeof(ELEMTYPE));
+                DPU_ASSERT(dpu_prepare_xfer(dpu, buffer + xferSize * each_dpu));
+            }
+        }
+    } else {
+        bool padded = true;
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            if (sizes[each_dpu] > 0 && sizeof(ELEMTYPE) * elemAddrs[each_dpu] + xferSize > sizeof(ELEMTYPE) * elemAmt)
+                padded = false;
+        }
+        if (!padded) {  // The padding of a run at the end of the points would be read out of them, so each run is copied on its own
+            DPU_FOREACH (rank, dpu, each_dpu) {
+                if (sizes[each_dpu] > 0)
+                    copyPointsToDPU(dpu, rank_id, 0, points, NULL, elemAddrs[each_dpu], sizes[each_dpu]);
+            }
+            return;
+        }
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            if (sizes[each_dpu] > 0)
+                DPU_ASSERT(dpu_prepare_xfer(dpu, (void *)&points[elemAddrs[each_dpu]]));
+        }
     }
-    fwrite(data, size, nmemb, fp);
-    fclose(fp);
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "points", 0, xferSize, DPU_XFER_DEFAULT));
+}
+static void pullPointsFromRank(struct dpu_set_t rank, const uint32_t rank_id, ELEMTYPE *points, outOfCore_t *outOfCore, const GADDRTYPE *elemAddrs, const size_t *sizes) {  // Download a run of points from each DPU of a rank at once. The padding would overwrite the points after each run, so runs are staged first
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    size_t xferSize = getRankXferSize(sizes, nr_dpus);
+    if (xferSize < 1)
+        return;
+    uint8_t *buffer = outOfCore != NULL ? getRankBuffer(outOfCore, rank_id, xferSize * nr_dpus) : malloc(xferSize * nr_dpus);
+    unsigned int each_dpu;
+    struct dpu_set_t dpu;
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        if (sizes[each_dpu] > 0)
+            DPU_ASSERT(dpu_prepare_xfer(dpu, buffer + xferSize * each_dpu));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "points", 0, xferSize, DPU_XFER_DEFAULT));
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        if (sizes[each_dpu] < 1)
+            continue;
+        if (outOfCore != NULL)
+            writeDataAt(outOfCore->spillFd, buffer + xferSize * each_dpu, sizes[each_dpu], elemAddrs[each_dpu] * sizeof(ELEMTYPE));
+        else
+            memcpy(&points[elemAddrs[each_dpu]], buffer + xferSize * each_dpu, sizes[each_dpu]);
+    }
+    if (outOfCore == NULL)
+        free(buffer);
+}
+static void pushPointIdsToRank(struct dpu_set_t rank, const POINTIDTYPE *pointIds, const GADDRTYPE pointAmt, const GADDRTYPE *pointAddrs, const ADDRTYPE *pointSizes) {  // Upload the ids of a run of points to each DPU of a rank at once
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    size_t sizes[nr_dpus];
+    unsigned int each_dpu;
+    struct dpu_set_t dpu;
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        sizes[each_dpu] = sizeof(POINTIDTYPE) * pointSizes[each_dpu];
+    }
+    size_t xferSize = getRankXferSize(sizes, nr_dpus);
+    if (xferSize < 1)
+        return;
+    bool padded = true;
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        if (pointSizes[each_dpu] > 0 && sizeof(POINTIDTYPE) * pointAddrs[each_dpu] + xferSize > sizeof(POINTIDTYPE) * (pointAmt + 1))  // Past the padding id at the end of `pointIds`
+            padded = false;
+    }
+    if (!padded) {
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            if (pointSizes[each_dpu] > 0)
+                copyPointIdsToDPU(dpu, pointIds, pointAddrs[each_dpu], pointSizes[each_dpu]);
+        }
+        return;
+    }
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        if (pointSizes[each_dpu] > 0)
+            DPU_ASSERT(dpu_prepare_xfer(dpu, (void *)&pointIds[pointAddrs[each_dpu]]));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "pointIds", 0, xferSize, DPU_XFER_DEFAULT));
+}
+static void pullPointIdsFromRank(struct dpu_set_t rank, POINTIDTYPE *pointIds, const GADDRTYPE *pointAddrs, const ADDRTYPE *pointSizes) {  // Download the ids of a run of points from each DPU of a rank at once, staged like the points
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    size_t sizes[nr_dpus];
+    unsigned int each_dpu;
+    struct dpu_set_t dpu;
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        sizes[each_dpu] = sizeof(POINTIDTYPE) * pointSizes[each_dpu];
+    }
+    size_t xferSize = getRankXferSize(sizes, nr_dpus);
+    if (xferSize < 1)
+        return;
+    uint8_t *buffer = malloc(xferSize * nr_dpus);
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        if (pointSizes[each_dpu] > 0)
+            DPU_ASSERT(dpu_prepare_xfer(dpu, buffer + xferSize * each_dpu));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "pointIds", 0, xferSize, DPU_XFER_DEFAULT));
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        if (pointSizes[each_dpu] > 0)
+            memcpy(&pointIds[pointAddrs[each_dpu]], buffer + xferSize * each_dpu, sizes[each_dpu]);
+    }
+    free(buffer);
 }
 
 typedef struct {
-    uint64_t pointAmt;
+    GADDRTYPE *pointAddrs;  // First point of the slice of each DPU
     ELEMTYPE *points;
+    POINTIDTYPE *pointIds;  // NULL if the program does not move points
+    outOfCore_t *outOfCore;
+    pointsReader_t *pointsReader;  // Non-NULL while the input is still being read
     uint32_t *dpu_offset;
     ADDRTYPE *pointSizes;
     uint32_t dimAmt;
-    uint32_t nr_ranks;
 } loadPointsIntoDPUsContext;
 dpu_error_t loadPointsIntoDPUs(struct dpu_set_t rank, uint32_t rank_id, void *args) {
     loadPointsIntoDPUsContext *ctx = (loadPointsIntoDPUsContext *)args;
     ELEMTYPE *points = ctx->points;
+    POINTIDTYPE *pointIds = ctx->pointIds;
+    outOfCore_t *outOfCore = ctx->outOfCore;
+    pointsReader_t *pointsReader = ctx->pointsReader;
+    GADDRTYPE *pointAddrs = ctx->pointAddrs;
     uint32_t *dpu_offset = ctx->dpu_offset;
     ADDRTYPE *pointSizes = ctx->pointSizes;
     uint32_t dimAmt = ctx->dimAmt;
-    uint64_t pointAmt = ctx->pointAmt;
-    uint32_t nr_ranks = ctx->nr_ranks;
 
-    uint64_t pointAmtPerDPU = ceil((double)pointAmt / dpu_offset[nr_ranks]);
-    uint64_t elementPerDPU = pointAmtPerDPU * dimAmt;
     unsigned int each_dpu;
     struct dpu_set_t dpu;
     // DPU_FOREACH (rank, dpu, each_dpu) {
@@ -103,10 +282,15 @@ dpu_error_t loadPointsIntoDPUs(struct dpu_set_t rank, uint32_t rank_id, void *ar
     // }
     // DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, 0, sizeof(ELEMTYPE) * elementPerDPU, DPU_XFER_DEFAULT));  // Use `DPU_MRAM_HEAP_POINTER_NAME` for reuse
     DPU_FOREACH (rank, dpu, each_dpu) {
-        ADDRTYPE pointSize = pointSizes[each_dpu + dpu_offset[rank_id]] * dimAmt * sizeof(ELEMTYPE);
+        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
+        ADDRTYPE pointSize = pointSizes[nr_dpu] * dimAmt * sizeof(ELEMTYPE);
+        if (pointSize > 0 && pointsReader != NULL)
+            waitPointsReader(pointsReader, sizeof(ELEMTYPE) * pointAddrs[nr_dpu] * dimAmt + pointSize);
         if (pointSize > 0)
-            DPU_ASSERT(dpu_copy_to(dpu, "points", 0, &points[(each_dpu + dpu_offset[rank_id]) * elementPerDPU], pointSize));
-        DPU_ASSERT(dpu_prepare_xfer(dpu, &pointSizes[each_dpu + dpu_offset[rank_id]]));
+            copyPointsToDPU(dpu, rank_id, 0, points, outOfCore, pointAddrs[nr_dpu] * dimAmt, pointSize);
+        if (pointSize > 0 && pointIds != NULL)
+            copyPointIdsToDPU(dpu, pointIds, pointAddrs[nr_dpu], pointSizes[nr_dpu]);
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &pointSizes[nr_dpu]));
     }
     DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, STR(pointAmt), 0, sizeof(ADDRTYPE), DPU_XFER_DEFAULT));
 
@@ -114,7 +298,7 @@ dpu_error_t loadPointsIntoDPUs(struct dpu_set_t rank, uint32_t rank_id, void *ar
 }
 
 typedef struct {
-    MEAN_VALUE_TYPE *sums;
+    SUM_VALUE_TYPE *sums;  // TBP_MAX_SEGMENTS per DPU
     uint32_t *dpu_offset;
 #ifdef PERF_EVAL_SIM
     perfcounter_t *perfs;
@@ -123,15 +307,15 @@ typedef struct {
 } appendSumToDPUsContext;
 dpu_error_t appendSumToDPUs(struct dpu_set_t rank, uint32_t rank_id, void *args) {
     appendSumToDPUsContext *ctx = (appendSumToDPUsContext *)args;
-    MEAN_VALUE_TYPE *sums = ctx->sums;
+    SUM_VALUE_TYPE *sums = ctx->sums;
     uint32_t *dpu_offset = ctx->dpu_offset;
 
     unsigned int each_dpu;
     struct dpu_set_t dpu;
     DPU_FOREACH (rank, dpu, each_dpu) {
-        DPU_ASSERT(dpu_prepare_xfer(dpu, &sums[each_dpu + dpu_offset[rank_id]]));
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &sums[(each_dpu + dpu_offset[rank_id]) * TBP_MAX_SEGMENTS]));
     }
-    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "sumRes", 0, sizeof(MEAN_VALUE_TYPE), DPU_XFER_DEFAULT));
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "sumRes", 0, sizeof(SUM_VALUE_TYPE) * TBP_MAX_SEGMENTS, DPU_XFER_DEFAULT));
 
     return DPU_OK;
 }
@@ -158,12 +342,33 @@ dpu_error_t getPerfResponseFromMeanCal(struct dpu_set_t rank, uint32_t rank_id,
 #endif
 
 typedef struct {
-    ADDRTYPE *pointSizes;
-    ADDRTYPE *splits;
-    ELEMTYPE **iterPoints;
+    tbpSegment_t *segments;  // TBP_MAX_SEGMENTS per DPU
+    uint32_t *segmentAmts;
+    uint32_t *dpu_offset;
+} loadSegmentsIntoDPUsContext;
+dpu_error_t loadSegmentsIntoDPUs(struct dpu_set_t rank, uint32_t rank_id, void *args) {
+    loadSegmentsIntoDPUsContext *ctx = (loadSegmentsIntoDPUsContext *)args;
+    tbpSegment_t *segments = ctx->segments;
+    uint32_t *segmentAmts = ctx->segmentAmts;
+    uint32_t *dpu_offset = ctx->dpu_offset;
+
+    unsigned int each_dpu;
+    struct dpu_set_t dpu;
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &segments[(each_dpu + dpu_offset[rank_id]) * TBP_MAX_SEGMENTS]));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "segments", 0, sizeof(tbpSegment_t) * TBP_MAX_SEGMENTS, DPU_XFER_DEFAULT));
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &segmentAmts[each_dpu + dpu_offset[rank_id]]));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, STR(segmentAmt), 0, sizeof(uint32_t), DPU_XFER_DEFAULT));
+
+    return DPU_OK;
+}
+
+typedef struct {
+    ADDRTYPE *splits;  // TBP_MAX_SEGMENTS per DPU
     uint32_t *dpu_offset;
-    uint32_t dimAmt;
-    uint32_t max_dpus;
 #ifdef PERF_EVAL_SIM
     perfcounter_t *perfs;
     uint32_t *freqs;
@@ -177,44 +382,455 @@ dpu_error_t getResponseFromLargeTreesPart1(struct dpu_set_t rank, uint32_t rank_
     unsigned int each_dpu;
     struct dpu_set_t dpu;
     DPU_FOREACH (rank, dpu, each_dpu) {
-        DPU_ASSERT(dpu_prepare_xfer(dpu, &splits[each_dpu + dpu_offset[rank_id]]));
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &splits[(each_dpu + dpu_offset[rank_id]) * TBP_MAX_SEGMENTS]));
     }
-    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "splitRes", 0, sizeof(ADDRTYPE), DPU_XFER_DEFAULT));
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "splitRes", 0, sizeof(ADDRTYPE) * TBP_MAX_SEGMENTS, DPU_XFER_DEFAULT));
 
     return DPU_OK;
 }
-dpu_error_t getResponseFromLargeTreesPart2(struct dpu_set_t rank, uint32_t rank_id, void *args) {
-    getResponseFromLargeTreesContext *ctx = (getResponseFromLargeTreesContext *)args;
+
+typedef struct {  // A run of points moved between a DPU and the host after a level of the top tree is split
+    GADDRTYPE hostAddr;  // First point on the host: the final place of a subtree that got small, or a staging place in the range of a large one
+    ADDRTYPE dpu;
+    ADDRTYPE pointBegin;
+    ADDRTYPE pointSize;
+} tbpTransfer_t;
+typedef struct {
+    tbpTransfer_t *transfers;
+    GADDRTYPE transferAmt;
+    GADDRTYPE transferCapacity;
+    GADDRTYPE *dpuOffsets;  // Once sorted, the transfers of DPU `nr_dpu` are [dpuOffsets[nr_dpu], dpuOffsets[nr_dpu + 1])
+} tbpTransferList_t;
+static void pushTBPTransfer(tbpTransferList_t *list, const GADDRTYPE hostAddr, const ADDRTYPE dpu, const ADDRTYPE pointBegin, const ADDRTYPE pointSize) {
+    if (list->transferAmt == list->transferCapacity) {
+        list->transferCapacity = list->transferCapacity < 1 ? 1024 : list->transferCapacity << 1;
+        list->transfers = realloc(list->transfers, sizeof(tbpTransfer_t) * list->transferCapacity);
+    }
+    tbpTransfer_t *transfer = &list->transfers[list->transferAmt++];
+    transfer->hostAddr = hostAddr, transfer->dpu = dpu, transfer->pointBegin = pointBegin, transfer->pointSize = pointSize;
+}
+static void sortTBPTransfers(tbpTransferList_t *list, const ADDRTYPE nr_all_dpus) {  // Counting sort by DPU, which keeps the order of the transfers of each DPU
+    GADDRTYPE *dpuOffsets = list->dpuOffsets;
+    memset(dpuOffsets, 0, sizeof(GADDRTYPE) * (nr_all_dpus + 1));
+    for (GADDRTYPE transferId = 0; transferId < list->transferAmt; ++transferId)
+        ++dpuOffsets[list->transfers[transferId].dpu + 1];
+    for (ADDRTYPE nr_dpu = 0; nr_dpu < nr_all_dpus; ++nr_dpu)
+        dpuOffsets[nr_dpu + 1] += dpuOffsets[nr_dpu];
+    GADDRTYPE dpuTails[nr_all_dpus];
+    memcpy(dpuTails, dpuOffsets, sizeof(GADDRTYPE) * nr_all_dpus);
+    tbpTransfer_t *sorted = malloc(sizeof(tbpTransfer_t) * list->transferCapacity);
+    for (GADDRTYPE transferId = 0; transferId < list->transferAmt; ++transferId)
+        sorted[dpuTails[list->transfers[transferId].dpu]++] = list->transfers[transferId];
+    free(list->transfers);
+    list->transfers = sorted;
+}
+
+typedef struct {  // Where the parts of large subtrees are on DPUs for the next level, and the transfers that get them there
+    tbpSegment_t *segments;  // TBP_MAX_SEGMENTS per DPU
+    uint32_t *segmentAmts;
+    uint32_t *segmentMasks;  // Segments in use on each DPU, one bit each. Empty segments between them may be used by later subtrees
+    tbpTransferList_t fromDPUs;  // Run first, so DPUs may receive points where others have just been taken away
+    tbpTransferList_t toDPUs;
+    ADDRTYPE dpuPointCapacity;
+} tbpPlan_t;
+static GADDRTYPE getTopTreeDPUMin(const GADDRTYPE *treeSize, const GADDRTYPE *largeTreeIds, const GADDRTYPE largeTreeIdSize, const ADDRTYPE dpuPointCapacity) {  // DPUs filled by the large subtrees of a level, each on DPUs of its own
+    GADDRTYPE dpuMin = 0;
+    for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId)
+        dpuMin += (treeSize[largeTreeIds[largeTreeId]] + dpuPointCapacity - 1) / dpuPointCapacity;
+    return dpuMin;
+}
+static bool spreadTopTree(const GADDRTYPE *treeLeftAddr, const GADDRTYPE *treeSize, const GADDRTYPE *largeTreeIds, const GADDRTYPE largeTreeIdSize, const ADDRTYPE nr_all_dpus, const ADDRTYPE dpuPointCapacity, ADDRTYPE *largeTreeDPUBegins, ADDRTYPE *largeTreeDPUEnds, GADDRTYPE *pointAddrs, ADDRTYPE *pointSizes) {  // Spread each large subtree evenly over a range of DPUs, which takes the DPUs it fills plus a share of the spare ones in proportion to its size. Return false if they do not fit
+    GADDRTYPE dpuMin = getTopTreeDPUMin(treeSize, largeTreeIds, largeTreeIdSize, dpuPointCapacity), pointAmt = 0;
+    if (dpuMin > nr_all_dpus)
+        return false;
+    for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId)
+        pointAmt += treeSize[largeTreeIds[largeTreeId]];
+    ADDRTYPE nr_dpu = 0;
+    for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {
+        GADDRTYPE treeId = largeTreeIds[largeTreeId];
+        ADDRTYPE dpuAmt = (treeSize[treeId] + dpuPointCapacity - 1) / dpuPointCapacity + (nr_all_dpus - dpuMin) * treeSize[treeId] / pointAmt;
+        GADDRTYPE pointAmtPerDPU = (treeSize[treeId] + dpuAmt - 1) / dpuAmt, pointCnt = 0;
+        largeTreeDPUBegins[largeTreeId] = nr_dpu, largeTreeDPUEnds[largeTreeId] = nr_dpu + dpuAmt;
+        for (; nr_dpu < largeTreeDPUEnds[largeTreeId]; ++nr_dpu) {
+            pointAddrs[nr_dpu] = treeLeftAddr[treeId] + pointCnt;
+            pointSizes[nr_dpu] = min(treeSize[treeId] - pointCnt, pointAmtPerDPU);
+            pointCnt += pointSizes[nr_dpu];
+        }
+    }
+    for (; nr_dpu < nr_all_dpus; ++nr_dpu)
+        pointAddrs[nr_dpu] = 0, pointSizes[nr_dpu] = 0;
+    return true;
+}
+static double measureHostBandwidth(uint8_t *buffer, const size_t bytes) {  // Unit: byte/s. Copy one half of a buffer into the other by all threads, once its pages are touched
+    size_t halfBytes = bytes >> 1, chunkAmt = (halfBytes + TBP_PROBE_CHUNK_BYTES - 1) / TBP_PROBE_CHUNK_BYTES;
+    memset(buffer, 1, bytes);
+    struct timeval timecheck;
+    gettimeofday(&timecheck, NULL);
+    long start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#pragma omp parallel for
+    for (size_t chunk = 0; chunk < chunkAmt; ++chunk)
+        memcpy(buffer + halfBytes + chunk * TBP_PROBE_CHUNK_BYTES, buffer + chunk * TBP_PROBE_CHUNK_BYTES, min(TBP_PROBE_CHUNK_BYTES, halfBytes - chunk * TBP_PROBE_CHUNK_BYTES));
+    gettimeofday(&timecheck, NULL);
+    return 2e6 * halfBytes / ((long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec - start + 1);  // Read and written
+}
+static bool isHostLevelFaster(const GADDRTYPE *treeSize, const GADDRTYPE *largeTreeIds, const GADDRTYPE largeTreeIdSize, const uint32_t dimAmt, const ADDRTYPE nr_all_dpus, const double hostBandwidth) {  // The cost model of `-T auto`: the levels left of the top tree are split either each on the host, or all on DPUs after one upload
+    GADDRTYPE levelPointAmt = 0, maxPointAmt = 0;
+    for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {
+        levelPointAmt += treeSize[largeTreeIds[largeTreeId]];
+        maxPointAmt = treeSize[largeTreeIds[largeTreeId]] > maxPointAmt ? treeSize[largeTreeIds[largeTreeId]] : maxPointAmt;
+    }
+    double levelBytes = (double)levelPointAmt * dimAmt * sizeof(ELEMTYPE);
+    double levelAmt = ceil(log2((double)maxPointAmt * dimAmt * sizeof(treeNode_t) / LARGE_TREE_THRESHOLD));  // Until the largest subtree is small, at least one since it is large now
+    double hostTime = levelAmt * TBP_HOST_LEVEL_PASSES * levelBytes / hostBandwidth;
+    double dpuTime = levelBytes / TBP_XFER_BANDWIDTH + levelAmt * (2 * levelBytes / ((double)nr_all_dpus * TBP_DPU_BANDWIDTH) + TBP_LEVEL_LATENCY);  // Summation and split of each level
+    return hostTime <= dpuTime;
+}
+
+static void getTopTreeChildParts(const tbpSegment_t *segments, const ADDRTYPE *splits, const ADDRTYPE dpuBegin, const ADDRTYPE dpuEnd, const uint32_t segmentId, const bool right, tbpSegment_t *parts) {  // The part of a child on each DPU of its parent, once the parent is split
+    for (ADDRTYPE nr_dpu = dpuBegin; nr_dpu < dpuEnd; ++nr_dpu) {
+        const tbpSegment_t *segment = &segments[nr_dpu * TBP_MAX_SEGMENTS + segmentId];
+        ADDRTYPE split = splits[nr_dpu * TBP_MAX_SEGMENTS + segmentId];
+        parts[nr_dpu - dpuBegin].pointBegin = right ? segment->pointBegin + split : segment->pointBegin;
+        parts[nr_dpu - dpuBegin].pointAmt = right ? segment->pointAmt - split : split;
+    }
+}
+static uint32_t keepTopTreeChild(tbpPlan_t *plan, const tbpSegment_t *parts, const ADDRTYPE dpuBegin, const ADDRTYPE dpuEnd, const ADDRTYPE childDPUBegin, const ADDRTYPE childDPUEnd, const GADDRTYPE childAddr) {  // Keep the parts of a large child on the DPUs [childDPUBegin, childDPUEnd) in place and return its segment, or gather a small child to its final place on the host if this range is empty
+    if (childDPUBegin == childDPUEnd) {
+        GADDRTYPE hostAddr = childAddr;
+        for (ADDRTYPE nr_dpu = dpuBegin; nr_dpu < dpuEnd; ++nr_dpu) {
+            const tbpSegment_t *part = &parts[nr_dpu - dpuBegin];
+            if (part->pointAmt > 0) {
+                pushTBPTransfer(&plan->fromDPUs, hostAddr, nr_dpu, part->pointBegin, part->pointAmt);
+                hostAddr += part->pointAmt;
+            }
+        }
+        return 0;
+    }
+    uint32_t usedMask = 0, segmentId = 0;  // The same on all DPUs of the child: the first one free on all of them
+    for (ADDRTYPE nr_dpu = childDPUBegin; nr_dpu < childDPUEnd; ++nr_dpu)
+        usedMask |= plan->segmentMasks[nr_dpu];
+    for (; segmentId < TBP_MAX_SEGMENTS && (usedMask >> segmentId & 1); ++segmentId);
+    if (segmentId >= TBP_MAX_SEGMENTS) {
+        printf("A DPU holds more than %u large subtrees! Exit now!\n", TBP_MAX_SEGMENTS);
+        exit(-1);
+    }
+    for (ADDRTYPE nr_dpu = childDPUBegin; nr_dpu < childDPUEnd; ++nr_dpu) {
+        for (uint32_t emptyId = plan->segmentAmts[nr_dpu]; emptyId < segmentId; ++emptyId)
+            plan->segments[nr_dpu * TBP_MAX_SEGMENTS + emptyId].pointBegin = plan->segments[nr_dpu * TBP_MAX_SEGMENTS + emptyId].pointAmt = 0;
+        tbpSegment_t *segment = &plan->segments[nr_dpu * TBP_MAX_SEGMENTS + segmentId];
+        segment->pointBegin = parts[nr_dpu - dpuBegin].pointBegin, segment->pointAmt = parts[nr_dpu - dpuBegin].pointAmt;
+        plan->segmentAmts[nr_dpu] = plan->segmentAmts[nr_dpu] > segmentId ? plan->segmentAmts[nr_dpu] : segmentId + 1;
+        plan->segmentMasks[nr_dpu] |= 1u << segmentId;
+    }
+    return segmentId;
+}
+static void findTopTreeSpace(const tbpPlan_t *plan, const ADDRTYPE nr_dpu, const uint32_t segmentId, ADDRTYPE *spaceBegin, ADDRTYPE *spaceEnd) {  // Free points around a segment of the next level
+    const tbpSegment_t *segments = &plan->segments[nr_dpu * TBP_MAX_SEGMENTS], *segment = &segments[segmentId];
+    *spaceBegin = 0, *spaceEnd = plan->dpuPointCapacity;
+    for (uint32_t otherId = 0; otherId < plan->segmentAmts[nr_dpu]; ++otherId) {
+        const tbpSegment_t *other = &segments[otherId];
+        if (otherId == segmentId || other->pointAmt < 1)
+            continue;
+        if (other->pointBegin + other->pointAmt <= segment->pointBegin && other->pointBegin + other->pointAmt > *spaceBegin)
+            *spaceBegin = other->pointBegin + other->pointAmt;
+        else if (other->pointBegin >= segment->pointBegin + segment->pointAmt && other->pointBegin < *spaceEnd)
+            *spaceEnd = other->pointBegin;
+    }
+}
+static ADDRTYPE findTopTreeGap(const tbpPlan_t *plan, const ADDRTYPE nr_dpu, const uint32_t segmentId, ADDRTYPE *gapBegin) {  // The largest free range of the next level on a DPU, besides the segment itself
+    const tbpSegment_t *segments = &plan->segments[nr_dpu * TBP_MAX_SEGMENTS];
+    const tbpSegment_t *others[TBP_MAX_SEGMENTS];
+    uint32_t otherAmt = 0;
+    for (uint32_t otherId = 0; otherId < plan->segmentAmts[nr_dpu]; ++otherId) {  // Insertion sort by the first point
+        if (otherId == segmentId || segments[otherId].pointAmt < 1)
+            continue;
+        uint32_t pos = otherAmt++;
+        for (; pos > 0 && others[pos - 1]->pointBegin > segments[otherId].pointBegin; --pos)
+            others[pos] = others[pos - 1];
+        others[pos] = &segments[otherId];
+    }
+    ADDRTYPE gap = 0, cursor = 0;
+    for (uint32_t otherPos = 0; otherPos <= otherAmt; ++otherPos) {
+        ADDRTYPE next = otherPos < otherAmt ? others[otherPos]->pointBegin : plan->dpuPointCapacity;
+        if (next > cursor && next - cursor > gap)
+            gap = next - cursor, *gapBegin = cursor;
+        if (otherPos < otherAmt && others[otherPos]->pointBegin + others[otherPos]->pointAmt > cursor)
+            cursor = others[otherPos]->pointBegin + others[otherPos]->pointAmt;
+    }
+    return gap;
+}
+static bool moveTopTreeChild(tbpPlan_t *plan, const tbpSegment_t *parts, const ADDRTYPE dpuBegin, const ADDRTYPE dpuEnd, const ADDRTYPE childDPUBegin, const ADDRTYPE childDPUEnd, const uint32_t segmentId, const GADDRTYPE childAddr, const GADDRTYPE childSize) {  // Parts of a large child on DPUs of its parent out of its own range are moved into the free space next to its kept parts, up to an even share of each DPU first
+    GADDRTYPE outgoing = 0;
+    for (ADDRTYPE nr_dpu = dpuBegin; nr_dpu < dpuEnd; ++nr_dpu)
+        if (nr_dpu < childDPUBegin || nr_dpu >= childDPUEnd)
+            outgoing += parts[nr_dpu - dpuBegin].pointAmt;
+    ADDRTYPE target = (childSize + (childDPUEnd - childDPUBegin) - 1) / (childDPUEnd - childDPUBegin);
+    GADDRTYPE stageAddr = childAddr;  // The range of a large child on the host is unused until it gets small, so moves are staged there
+    ADDRTYPE src = dpuBegin, srcOffset = 0;
+    for (uint32_t pass = 0; pass < 2 && outgoing > 0; ++pass) {  // The second pass fills DPUs up to their free space, if some could not take their share
+        for (ADDRTYPE nr_dpu = childDPUBegin; nr_dpu < childDPUEnd && outgoing > 0; ++nr_dpu) {
+            tbpSegment_t *segment = &plan->segments[nr_dpu * TBP_MAX_SEGMENTS + segmentId];
+            ADDRTYPE incoming = pass > 0 ? plan->dpuPointCapacity : segment->pointAmt < target ? target - segment->pointAmt : 0;
+            incoming = min(incoming, outgoing);
+            ADDRTYPE spaceBegin = segment->pointBegin, spaceEnd = segment->pointBegin + segment->pointAmt, gapBegin = 0, gap = 0;
+            if (segment->pointAmt > 0)
+                findTopTreeSpace(plan, nr_dpu, segmentId, &spaceBegin, &spaceEnd);
+            if (pass == 0)  // The kept part may move as well. Later, parts moved in would have to be moved again
+                gap = findTopTreeGap(plan, nr_dpu, segmentId, &gapBegin);
+            ADDRTYPE inPlace = spaceEnd - spaceBegin - segment->pointAmt, relocated = gap > segment->pointAmt ? gap - segment->pointAmt : 0;
+            ADDRTYPE room = inPlace > relocated ? inPlace : relocated;
+            incoming = min(incoming, room);
+            if (incoming < 1)
+                continue;
+            ADDRTYPE front = 0, keptEnd;  // Parts moved in go to [segment->pointBegin, + front) and [keptEnd, + incoming - front)
+            if (inPlace >= incoming) {  // Around the kept part, in front of it first
+                front = min(incoming, segment->pointBegin - spaceBegin);
+                keptEnd = segment->pointBegin + segment->pointAmt;
+                segment->pointBegin -= front;
+            } else {  // The kept part is staged too, and the whole segment goes into the gap
+                if (segment->pointAmt > 0) {
+                    pushTBPTransfer(&plan->fromDPUs, stageAddr, nr_dpu, segment->pointBegin, segment->pointAmt);
+                    pushTBPTransfer(&plan->toDPUs, stageAddr, nr_dpu, gapBegin, segment->pointAmt);
+                    stageAddr += segment->pointAmt;
+                }
+                segment->pointBegin = gapBegin;
+                keptEnd = gapBegin + segment->pointAmt;
+            }
+            for (ADDRTYPE moved = 0; moved < incoming;) {
+                while ((src >= childDPUBegin && src < childDPUEnd) || srcOffset >= parts[src - dpuBegin].pointAmt)
+                    ++src, srcOffset = 0;
+                const tbpSegment_t *part = &parts[src - dpuBegin];
+                ADDRTYPE pointSize = min(incoming - moved, part->pointAmt - srcOffset);
+                if (moved < front)
+                    pointSize = min(pointSize, front - moved);
+                ADDRTYPE dst = moved < front ? segment->pointBegin + moved : keptEnd + (moved - front);
+                pushTBPTransfer(&plan->fromDPUs, stageAddr, src, part->pointBegin + srcOffset, pointSize);
+                pushTBPTransfer(&plan->toDPUs, stageAddr, nr_dpu, dst, pointSize);
+                stageAddr += pointSize, srcOffset += pointSize, moved += pointSize;
+            }
+            segment->pointAmt += incoming;
+            outgoing -= incoming;
+        }
+    }
+    return outgoing < 1;  // Free space of the DPUs may be too fragmented
+}
+static void repackTopTree(tbpPlan_t *plan, const ADDRTYPE nr_all_dpus, const tbpSegment_t *segments, const ADDRTYPE *splits, const GADDRTYPE *treeLeftAddr, const GADDRTYPE *treeSize, const GADDRTYPE *largeTreeIds, ADDRTYPE *largeTreeDPUBegins, ADDRTYPE *largeTreeDPUEnds, uint32_t *largeTreeSegmentIds, const GADDRTYPE largeTreeIdSize, const GADDRTYPE newLargeTreeIdSize) {  // If parts cannot be moved in place, gather all subtrees of the level to the host and pack the large children onto DPUs again
+    memset(plan->segmentAmts, 0, sizeof(uint32_t) * nr_all_dpus);
+    memset(plan->segmentMasks, 0, sizeof(uint32_t) * nr_all_dpus);
+    plan->fromDPUs.transferAmt = plan->toDPUs.transferAmt = 0;
+    for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {
+        ADDRTYPE dpuBegin = largeTreeDPUBegins[largeTreeId], dpuEnd = largeTreeDPUEnds[largeTreeId];
+        tbpSegment_t parts[dpuEnd - dpuBegin];
+        GADDRTYPE hostAddr = treeLeftAddr[largeTreeIds[largeTreeId]];
+        for (uint32_t side = 0; side < 2; ++side) {
+            getTopTreeChildParts(segments, splits, dpuBegin, dpuEnd, largeTreeSegmentIds[largeTreeId], side > 0, parts);
+            keepTopTreeChild(plan, parts, dpuBegin, dpuEnd, dpuBegin, dpuBegin, hostAddr);
+            for (ADDRTYPE nr_dpu = dpuBegin; nr_dpu < dpuEnd; ++nr_dpu)
+                hostAddr += parts[nr_dpu - dpuBegin].pointAmt;
+        }
+    }
+    ADDRTYPE dpuCursor = 0, pointCursor = 0;  // All large children fit, as the root did
+    for (GADDRTYPE largeTreeId = largeTreeIdSize; largeTreeId < largeTreeIdSize + newLargeTreeIdSize; ++largeTreeId) {
+        GADDRTYPE treeId = largeTreeIds[largeTreeId];
+        if (pointCursor >= plan->dpuPointCapacity)
+            ++dpuCursor, pointCursor = 0;
+        ADDRTYPE room = plan->dpuPointCapacity - pointCursor, dpuBegin = dpuCursor, dpuEnd = dpuCursor + 1;
+        if (treeSize[treeId] > room)
+            dpuEnd += (treeSize[treeId] - room + plan->dpuPointCapacity - 1) / plan->dpuPointCapacity;
+        if (dpuEnd > nr_all_dpus) {
+            printf("A large subtree does not fit into the MRAM of its DPUs! Exit now!\n");
+            exit(-1);
+        }
+        tbpSegment_t parts[dpuEnd - dpuBegin];
+        GADDRTYPE leftSize = treeSize[treeId];
+        for (ADDRTYPE nr_dpu = dpuBegin; nr_dpu < dpuEnd; ++nr_dpu) {
+            parts[nr_dpu - dpuBegin].pointBegin = nr_dpu == dpuBegin ? pointCursor : 0;
+            parts[nr_dpu - dpuBegin].pointAmt = min(leftSize, plan->dpuPointCapacity - parts[nr_dpu - dpuBegin].pointBegin);
+            pushTBPTransfer(&plan->toDPUs, treeLeftAddr[treeId] + treeSize[treeId] - leftSize, nr_dpu, parts[nr_dpu - dpuBegin].pointBegin, parts[nr_dpu - dpuBegin].pointAmt);
+            leftSize -= parts[nr_dpu - dpuBegin].pointAmt;
+        }
+        largeTreeSegmentIds[largeTreeId] = keepTopTreeChild(plan, parts, dpuBegin, dpuEnd, dpuBegin, dpuEnd, treeLeftAddr[treeId]);
+        largeTreeDPUBegins[largeTreeId] = dpuBegin, largeTreeDPUEnds[largeTreeId] = dpuEnd;
+        dpuCursor = dpuEnd - 1, pointCursor = parts[dpuEnd - dpuBegin - 1].pointBegin + parts[dpuEnd - dpuBegin - 1].pointAmt;
+    }
+}
+
+typedef struct {  // The runs of points moved through the stage of each DPU by one launch: the next transfers of the DPU, up to TBP_MAX_MOVES runs and `stageCapacity` points
+    tbpMove_t *moves;  // TBP_MAX_MOVES per DPU
+    GADDRTYPE *hostAddrs;  // TBP_MAX_MOVES per DPU: the first point of each run on the host
+    uint32_t *moveAmts;
+    ADDRTYPE *stagedSizes;
+    GADDRTYPE *transferCursors;  // The next transfer of each DPU, and the points of it already moved
+    ADDRTYPE *pointCursors;
+    ADDRTYPE stageCapacity;
+} tbpMoveRound_t;
+static void startTBPMoveRounds(tbpMoveRound_t *moveRound, const tbpTransferList_t *list, const ADDRTYPE nr_all_dpus) {
+    memcpy(moveRound->transferCursors, list->dpuOffsets, sizeof(GADDRTYPE) * nr_all_dpus);
+    memset(moveRound->pointCursors, 0, sizeof(ADDRTYPE) * nr_all_dpus);
+}
+static bool planTBPMoveRound(tbpMoveRound_t *moveRound, const tbpTransferList_t *list, const ADDRTYPE nr_all_dpus) {  // Return false once all transfers are done
+    bool moving = false;
+    for (ADDRTYPE nr_dpu = 0; nr_dpu < nr_all_dpus; ++nr_dpu) {
+        tbpMove_t *moves = &moveRound->moves[nr_dpu * TBP_MAX_MOVES];
+        GADDRTYPE *hostAddrs = &moveRound->hostAddrs[nr_dpu * TBP_MAX_MOVES];
+        uint32_t moveAmt = 0;
+        ADDRTYPE stagedSize = 0;
+        while (moveRound->transferCursors[nr_dpu] < list->dpuOffsets[nr_dpu + 1] && moveAmt < TBP_MAX_MOVES && stagedSize < moveRound->stageCapacity) {  // Transfers larger than the stage are split over launches
+            const tbpTransfer_t *transfer = &list->transfers[moveRound->transferCursors[nr_dpu]];
+            ADDRTYPE pointSize = min(transfer->pointSize - moveRound->pointCursors[nr_dpu], moveRound->stageCapacity - stagedSize);
+            moves[moveAmt].pointBegin = transfer->pointBegin + moveRound->pointCursors[nr_dpu], moves[moveAmt].pointAmt = pointSize;
+            hostAddrs[moveAmt++] = transfer->hostAddr + moveRound->pointCursors[nr_dpu];
+            stagedSize += pointSize, moveRound->pointCursors[nr_dpu] += pointSize;
+            if (moveRound->pointCursors[nr_dpu] >= transfer->pointSize)
+                ++moveRound->transferCursors[nr_dpu], moveRound->pointCursors[nr_dpu] = 0;
+        }
+        moveRound->moveAmts[nr_dpu] = moveAmt, moveRound->stagedSizes[nr_dpu] = stagedSize;
+        moving = moving || moveAmt > 0;
+    }
+    return moving;
+}
+static void pushTBPMovesToRank(struct dpu_set_t rank, const tbpMoveRound_t *moveRound, const uint32_t dpuOffset) {  // DPUs without runs get none, so that they do not move the runs of the last launch again
+    unsigned int each_dpu;
+    struct dpu_set_t dpu;
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &moveRound->moves[(each_dpu + dpuOffset) * TBP_MAX_MOVES]));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "moves", 0, sizeof(tbpMove_t) * TBP_MAX_MOVES, DPU_XFER_DEFAULT));
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &moveRound->moveAmts[each_dpu + dpuOffset]));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, STR(moveAmt), 0, sizeof(uint32_t), DPU_XFER_DEFAULT));
+}
+
+typedef struct {
+    tbpMoveRound_t *moveRound;
+    ELEMTYPE *points;
+    POINTIDTYPE *pointIds;
+    outOfCore_t *outOfCore;
+    uint32_t *dpu_offset;
+    uint32_t dimAmt;
+} moveTopTreePartsContext;
+dpu_error_t loadTopTreeMovesIntoDPUs(struct dpu_set_t rank, uint32_t rank_id, void *args) {
+    moveTopTreePartsContext *ctx = (moveTopTreePartsContext *)args;
+    pushTBPMovesToRank(rank, ctx->moveRound, ctx->dpu_offset[rank_id]);
+
+    return DPU_OK;
+}
+dpu_error_t getTopTreePartsFromDPUs(struct dpu_set_t rank, uint32_t rank_id, void *args) {  // Pull the runs gathered into the stage of each DPU of a rank at once, and put them at their places on the host
+    moveTopTreePartsContext *ctx = (moveTopTreePartsContext *)args;
+    tbpMoveRound_t *moveRound = ctx->moveRound;
+    ELEMTYPE *points = ctx->points;
+    POINTIDTYPE *pointIds = ctx->pointIds;
+    outOfCore_t *outOfCore = ctx->outOfCore;
     uint32_t *dpu_offset = ctx->dpu_offset;
     uint32_t dimAmt = ctx->dimAmt;
-    uint32_t max_dpus = ctx->max_dpus;
-    ADDRTYPE *pointSizes = ctx->pointSizes;
-    ADDRTYPE *splits = ctx->splits;
-    ELEMTYPE **iterPoints = ctx->iterPoints;
 
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    size_t pointBytes = sizeof(ELEMTYPE) * dimAmt, sizes[nr_dpus], idSizes[nr_dpus];
     unsigned int each_dpu;
     struct dpu_set_t dpu;
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
-        if (nr_dpu >= max_dpus)
-            continue;
-        ADDRTYPE lsplit = splits[nr_dpu] * dimAmt;
-        // DPU_ASSERT(dpu_copy_from(dpu, DPU_MRAM_HEAP_POINTER_NAME, 0, (uint8_t *)iterPoints[nr_dpu], sizeof(ELEMTYPE) * lsplit));
-        if (lsplit > 0)  // It is possible that all points distributed to a dpu should be split into the left/right child node during the construction phase of the top tree, and it is invalid to transfer no data with the dpu API
-            DPU_ASSERT(dpu_copy_from(dpu, "points", 0, (uint8_t *)iterPoints[nr_dpu], sizeof(ELEMTYPE) * lsplit));
+        sizes[each_dpu] = pointBytes * moveRound->stagedSizes[each_dpu + dpu_offset[rank_id]];
+        idSizes[each_dpu] = sizeof(POINTIDTYPE) * moveRound->stagedSizes[each_dpu + dpu_offset[rank_id]];
     }
+    size_t xferSize = getRankXferSize(sizes, nr_dpus), idXferSize = getRankXferSize(idSizes, nr_dpus);
+    if (xferSize < 1)
+        return DPU_OK;
+    uint8_t *buffer = outOfCore != NULL ? getRankBuffer(outOfCore, rank_id, xferSize * nr_dpus) : malloc(xferSize * nr_dpus);
+    uint8_t *idBuffer = malloc(idXferSize * nr_dpus);
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        if (sizes[each_dpu] > 0)
+            DPU_ASSERT(dpu_prepare_xfer(dpu, buffer + xferSize * each_dpu));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "stagedPoints", 0, xferSize, DPU_XFER_DEFAULT));
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        if (idSizes[each_dpu] > 0)
+            DPU_ASSERT(dpu_prepare_xfer(dpu, idBuffer + idXferSize * each_dpu));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "stagedPointIds", 0, idXferSize, DPU_XFER_DEFAULT));
     DPU_FOREACH (rank, dpu, each_dpu) {
         unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
-        if (nr_dpu >= max_dpus)
-            continue;
-        ADDRTYPE rsplit = (pointSizes[nr_dpu] - splits[nr_dpu]) * dimAmt;
-        // DPU_ASSERT(dpu_copy_from(dpu, DPU_MRAM_HEAP_POINTER_NAME, sizeof(ELEMTYPE) * splits[nr_dpu] * dimAmt, (uint8_t *)iterPoints[nr_dpu + nr_all_dpus], sizeof(ELEMTYPE) * rsplit));
-        if (rsplit > 0)  // It is possible that all points distributed to a dpu should be split into the left/right child node during the construction phase of the top tree, and it is invalid to transfer no data with the dpu API
-            DPU_ASSERT(dpu_copy_from(dpu, "points", sizeof(ELEMTYPE) * splits[nr_dpu] * dimAmt, (uint8_t *)iterPoints[nr_dpu + max_dpus], sizeof(ELEMTYPE) * rsplit));
+        ADDRTYPE staged = 0;
+        for (uint32_t moveId = 0; moveId < moveRound->moveAmts[nr_dpu]; ++moveId) {
+            tbpMove_t *move = &moveRound->moves[nr_dpu * TBP_MAX_MOVES + moveId];
+            GADDRTYPE hostAddr = moveRound->hostAddrs[nr_dpu * TBP_MAX_MOVES + moveId];
+            if (outOfCore != NULL)
+                writeDataAt(outOfCore->spillFd, buffer + xferSize * each_dpu + pointBytes * staged, pointBytes * move->pointAmt, pointBytes * hostAddr);
+            else
+                memcpy(&points[hostAddr * dimAmt], buffer + xferSize * each_dpu + pointBytes * staged, pointBytes * move->pointAmt);
+            memcpy(&pointIds[hostAddr], idBuffer + idXferSize * each_dpu + sizeof(POINTIDTYPE) * staged, sizeof(POINTIDTYPE) * move->pointAmt);
+            staged += move->pointAmt;
+        }
+    }
+    if (outOfCore == NULL)
+        free(buffer);
+    free(idBuffer);
+
+    return DPU_OK;
+}
+dpu_error_t loadTopTreePartsIntoDPUs(struct dpu_set_t rank, uint32_t rank_id, void *args) {  // Stage the runs of each DPU of a rank one after the other on the host, and push them to the stages of all DPUs at once
+    moveTopTreePartsContext *ctx = (moveTopTreePartsContext *)args;
+    tbpMoveRound_t *moveRound = ctx->moveRound;
+    ELEMTYPE *points = ctx->points;
+    POINTIDTYPE *pointIds = ctx->pointIds;
+    outOfCore_t *outOfCore = ctx->outOfCore;
+    uint32_t *dpu_offset = ctx->dpu_offset;
+    uint32_t dimAmt = ctx->dimAmt;
+
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    size_t pointBytes = sizeof(ELEMTYPE) * dimAmt, sizes[nr_dpus], idSizes[nr_dpus];
+    unsigned int each_dpu;
+    struct dpu_set_t dpu;
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        sizes[each_dpu] = pointBytes * moveRound->stagedSizes[each_dpu + dpu_offset[rank_id]];
+        idSizes[each_dpu] = sizeof(POINTIDTYPE) * moveRound->stagedSizes[each_dpu + dpu_offset[rank_id]];
     }
+    size_t xferSize = getRankXferSize(sizes, nr_dpus), idXferSize = getRankXferSize(idSizes, nr_dpus);
+    if (xferSize > 0) {
+        uint8_t *buffer = outOfCore != NULL ? getRankBuffer(outOfCore, rank_id, xferSize * nr_dpus) : malloc(xferSize * nr_dpus);
+        uint8_t *idBuffer = malloc(idXferSize * nr_dpus);
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
+            ADDRTYPE staged = 0;
+            for (uint32_t moveId = 0; moveId < moveRound->moveAmts[nr_dpu]; ++moveId) {
+                tbpMove_t *move = &moveRound->moves[nr_dpu * TBP_MAX_MOVES + moveId];
+                GADDRTYPE hostAddr = moveRound->hostAddrs[nr_dpu * TBP_MAX_MOVES + moveId];
+                if (outOfCore != NULL)
+                    readDataAt(outOfCore->loadFd, buffer + xferSize * each_dpu + pointBytes * staged, pointBytes * move->pointAmt, pointBytes * hostAddr);
+                else
+                    memcpy(buffer + xferSize * each_dpu + pointBytes * staged, &points[hostAddr * dimAmt], pointBytes * move->pointAmt);
+                memcpy(idBuffer + idXferSize * each_dpu + sizeof(POINTIDTYPE) * staged, &pointIds[hostAddr], sizeof(POINTIDTYPE) * move->pointAmt);
+                staged += move->pointAmt;
+            }
+            if (sizes[each_dpu] > 0)
+                DPU_ASSERT(dpu_prepare_xfer(dpu, buffer + xferSize * each_dpu));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "stagedPoints", 0, xferSize, DPU_XFER_DEFAULT));
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            if (idSizes[each_dpu] > 0)
+                DPU_ASSERT(dpu_prepare_xfer(dpu, idBuffer + idXferSize * each_dpu));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "stagedPointIds", 0, idXferSize, DPU_XFER_DEFAULT));
+        if (outOfCore == NULL)
+            free(buffer);
+        free(idBuffer);
+    }
+    pushTBPMovesToRank(rank, moveRound, dpu_offset[rank_id]);
 
     return DPU_OK;
 }
+static void moveTopTreeParts(struct dpu_set_t dpu_set, moveTopTreePartsContext *ctx, const tbpTransferList_t *list, const bool fromDPUs, const ADDRTYPE nr_all_dpus) {  // Each launch gathers runs into the stages of DPUs, or scatters them from there, so the host moves them by one transfer per rank
+    startTBPMoveRounds(ctx->moveRound, list, nr_all_dpus);
+    setTBPCommand(dpu_set, fromDPUs ? TBP_COMMAND_GATHER : TBP_COMMAND_SCATTER);
+    while (planTBPMoveRound(ctx->moveRound, list, nr_all_dpus)) {
+        DPU_ASSERT(dpu_callback(dpu_set, fromDPUs ? loadTopTreeMovesIntoDPUs : loadTopTreePartsIntoDPUs, ctx, DPU_CALLBACK_DEFAULT));
+        DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
+        if (fromDPUs)
+            DPU_ASSERT(dpu_callback(dpu_set, getTopTreePartsFromDPUs, ctx, DPU_CALLBACK_DEFAULT));
+    }
+}
 #ifdef PERF_EVAL_SIM
 dpu_error_t getPerfResponseFromMeanSpliter(struct dpu_set_t rank, uint32_t rank_id, void *args) {
     getResponseFromLargeTreesContext *ctx = (getResponseFromLargeTreesContext *)args;
@@ -237,162 +853,210 @@ dpu_error_t getPerfResponseFromMeanSpliter(struct dpu_set_t rank, uint32_t rank_
 }
 #endif
 
+typedef struct {  // Subtrees of the tree building phase are built on ranks at once, so each rank appends its nodes and leaves to the tree as soon as it is drained
+    pthread_mutex_t mutex;
+    GADDRTYPE treeIdSize;
+    GADDRTYPE leafIdSize;
+    rankDispatcher_t *dispatcher;
+#ifdef PERF_EVAL
+    uint64_t *rankLoadTimes;  // Unit: us. Time of the callbacks of each rank, which overlaps with the other ranks
+    uint64_t *rankResponseTimes;
+#endif
+} tbpPipeline_t;
+static GADDRTYPE reserveTBPTree(tbpPipeline_t *pipeline, GADDRTYPE *size, const GADDRTYPE amount) {  // Thread-safe. Take `amount` slots at the end of the tree or of the leaves, and return the first one
+    pthread_mutex_lock(&pipeline->mutex);
+    GADDRTYPE begin = *size;
+    *size += amount;
+    pthread_mutex_unlock(&pipeline->mutex);
+    return begin;
+}
+
 typedef struct {
     ADDRTYPE max_dpus;
+    uint32_t nr_rank;  // The rank the batch runs on. The callbacks of the batch are queued on it alone
     ELEMTYPE *points;
-    uint32_t *dpu_offset;
-    ADDRTYPE *treeLeftAddr;
-    ADDRTYPE *treeSize;
-    ADDRTYPE *leafIds;
+    POINTIDTYPE *pointIds;
+    outOfCore_t *outOfCore;
+    GADDRTYPE *treeLeftAddr;
+    GADDRTYPE *treeSize;
+    GADDRTYPE *leafIds;  // DPU `nr_dpu` of the batch builds the subtree of leafIds[nr_dpu]
+    GADDRTYPE pointAmt;
     uint32_t dimAmt;
+    tbpPipeline_t *pipeline;
 } loadLargeLeavesIntoDPUsContext;
 dpu_error_t loadLargeLeavesIntoDPUs(struct dpu_set_t rank, uint32_t rank_id, void *args) {
     loadLargeLeavesIntoDPUsContext *ctx = (loadLargeLeavesIntoDPUsContext *)args;
     ELEMTYPE *points = ctx->points;
-    uint32_t *dpu_offset = ctx->dpu_offset;
-    ADDRTYPE *treeLeftAddr = ctx->treeLeftAddr;
-    ADDRTYPE *treeSize = ctx->treeSize;
-    ADDRTYPE *leafIds = ctx->leafIds;
+    POINTIDTYPE *pointIds = ctx->pointIds;
+    outOfCore_t *outOfCore = ctx->outOfCore;
+    uint32_t nr_rank = ctx->nr_rank;
+    (void)rank_id;  // Always 0, since the callbacks of a batch are queued on its rank alone
+    GADDRTYPE *treeLeftAddr = ctx->treeLeftAddr;
+    GADDRTYPE *treeSize = ctx->treeSize;
+    GADDRTYPE *leafIds = ctx->leafIds;
+    GADDRTYPE pointAmt = ctx->pointAmt;
     uint32_t dimAmt = ctx->dimAmt;
     ADDRTYPE max_dpus = ctx->max_dpus;
+#ifdef PERF_EVAL
+    struct timeval timecheck;
+    gettimeofday(&timecheck, NULL);
+    long start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
 
     unsigned int each_dpu;
     struct dpu_set_t dpu;
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    GADDRTYPE pointAddrs[nr_dpus], elemAddrs[nr_dpus];
+    ADDRTYPE pointSizes[nr_dpus];  // 0 for DPUs without a subtree
+    size_t sizes[nr_dpus];
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
-        if (nr_dpu >= max_dpus)
-            break;
-        DPU_ASSERT(dpu_copy_to(dpu, "points", 0, (uint8_t *)&points[treeLeftAddr[leafIds[nr_dpu]] * dimAmt], sizeof(ELEMTYPE) * treeSize[leafIds[nr_dpu]] * dimAmt));
+        unsigned int nr_dpu = each_dpu;
+        pointAddrs[each_dpu] = nr_dpu < max_dpus ? treeLeftAddr[leafIds[nr_dpu]] : 0;
+        pointSizes[each_dpu] = nr_dpu < max_dpus ? treeSize[leafIds[nr_dpu]] : 0;
+        elemAddrs[each_dpu] = pointAddrs[each_dpu] * dimAmt;
+        sizes[each_dpu] = sizeof(ELEMTYPE) * pointSizes[each_dpu] * dimAmt;
     }
+    pushPointsToRank(rank, nr_rank, points, outOfCore, pointAmt * dimAmt, elemAddrs, sizes);
+    pushPointIdsToRank(rank, pointIds, pointAmt, pointAddrs, pointSizes);
+    ADDRTYPE pointAmts[nr_dpus];  // Subtrees are small enough for a DPU, so their sizes fit in ADDRTYPE
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
-        if (nr_dpu < max_dpus)
-            DPU_ASSERT(dpu_prepare_xfer(dpu, &treeSize[leafIds[nr_dpu]]));
-        else
-            DPU_ASSERT(dpu_prepare_xfer(dpu, &treeSize[leafIds[max_dpus - 1]]));
+        unsigned int nr_dpu = each_dpu;
+        pointAmts[each_dpu] = treeSize[leafIds[nr_dpu < max_dpus ? nr_dpu : max_dpus - 1]];
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &pointAmts[each_dpu]));
     }
     DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "pointAmt", 0, sizeof(ADDRTYPE), DPU_XFER_DEFAULT));
+#ifdef PERF_EVAL
+    gettimeofday(&timecheck, NULL);
+    ctx->pipeline->rankLoadTimes[nr_rank] += (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec - start;
+#endif
 
     return DPU_OK;
 }
 
 typedef struct {
     ADDRTYPE max_dpus;
-    ADDRTYPE *subtreeSizes;
-    ADDRTYPE *treeIdSizes;
-    ADDRTYPE *newLeafSizes;
-    ADDRTYPE *leafIdAddrs;
+    uint32_t nr_rank;
+    GADDRTYPE subtreeBegin;  // DPU `nr_dpu` of the batch built the subtree of leafIds[subtreeBegin + nr_dpu]
     ELEMTYPE *points;
+    POINTIDTYPE *pointIds;
+    outOfCore_t *outOfCore;
     uint32_t *dpu_offset;
-    treeNode_t *tree;
-    ADDRTYPE *treeLeftAddr;
-    ADDRTYPE *treeSize;
-    ADDRTYPE *leafIds;
+    globalTreeNode_t *tree;
+    GADDRTYPE *treeLeftAddr;
+    GADDRTYPE *treeSize;
+    GADDRTYPE *leafIds;
     uint32_t dimAmt;
+    tbpPipeline_t *pipeline;
+#ifdef PERF_EVAL
+    perfcounter_t *dpuCycles;  // Cycles of each DPU of the batch
+#endif
 #ifdef PERF_EVAL_SIM
     perfcounter_t *perfs;
     uint32_t *freqs;
 #endif
 } getResponseFromTreesContext;
-dpu_error_t getResponseFromTreesPart1(struct dpu_set_t rank, uint32_t rank_id, void *args) {
+static void setGlobalTreeNode(globalTreeNode_t *node, const treeNode_t *dpuNode, const GADDRTYPE treeIdBase, const GADDRTYPE pointBase, GADDRTYPE *newLeafSize) {  // Convert a node of a subtree built on a DPU into the global tree: children are relocated after `treeIdBase - 1` (the root of a subtree replaces an existing leaf), and leaves are relocated after `pointBase`
+    node->left = dpuNode->left != ADDRTYPE_NULL ? dpuNode->left + treeIdBase - 1 : GADDRTYPE_NULL;
+    node->right = dpuNode->right != ADDRTYPE_NULL ? dpuNode->right + treeIdBase - 1 : GADDRTYPE_NULL;
+    node->dim = dpuNode->dim;
+    if (node->left != GADDRTYPE_NULL || node->right != GADDRTYPE_NULL) {
+        node->mean = dpuNode->mean;
+    } else {
+        node->mean = dpuNode->mean + pointBase;
+        ++(*newLeafSize);
+    }
+}
+dpu_error_t getResponseFromTrees(struct dpu_set_t rank, uint32_t rank_id, void *args) {  // Pull the points and the subtrees of a rank, then append the nodes and the leaves of its subtrees to the tree
     getResponseFromTreesContext *ctx = (getResponseFromTreesContext *)args;
     ELEMTYPE *points = ctx->points;
-    uint32_t *dpu_offset = ctx->dpu_offset;
-    ADDRTYPE *treeLeftAddr = ctx->treeLeftAddr;
-    ADDRTYPE *treeSize = ctx->treeSize;
-    ADDRTYPE *leafIds = ctx->leafIds;
+    POINTIDTYPE *pointIds = ctx->pointIds;
+    outOfCore_t *outOfCore = ctx->outOfCore;
+    uint32_t nr_rank = ctx->nr_rank;
+    (void)rank_id;  // Always 0, since the callbacks of a batch are queued on its rank alone
+    globalTreeNode_t *tree = ctx->tree;
+    GADDRTYPE *treeLeftAddr = ctx->treeLeftAddr;
+    GADDRTYPE *treeSize = ctx->treeSize;
+    GADDRTYPE *leafIds = ctx->leafIds;
+    GADDRTYPE *subtreeIds = ctx->leafIds + ctx->subtreeBegin;
     uint32_t dimAmt = ctx->dimAmt;
     ADDRTYPE max_dpus = ctx->max_dpus;
-    ADDRTYPE *subtreeSizes = ctx->subtreeSizes;
+    tbpPipeline_t *pipeline = ctx->pipeline;
+#ifdef PERF_EVAL
+    struct timeval timecheck;
+    gettimeofday(&timecheck, NULL);
+    long start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
 
     unsigned int each_dpu;
     struct dpu_set_t dpu;
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    GADDRTYPE pointAddrs[nr_dpus], elemAddrs[nr_dpus];
+    ADDRTYPE pointSizes[nr_dpus];
+    size_t sizes[nr_dpus];
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
+        unsigned int nr_dpu = each_dpu;
+        pointAddrs[each_dpu] = nr_dpu < max_dpus ? treeLeftAddr[subtreeIds[nr_dpu]] : 0;
+        pointSizes[each_dpu] = nr_dpu < max_dpus ? treeSize[subtreeIds[nr_dpu]] : 0;
+        elemAddrs[each_dpu] = pointAddrs[each_dpu] * dimAmt;
+        sizes[each_dpu] = sizeof(ELEMTYPE) * pointSizes[each_dpu] * dimAmt;
+    }
+    pullPointsFromRank(rank, nr_rank, points, outOfCore, elemAddrs, sizes);
+    pullPointIdsFromRank(rank, pointIds, pointAddrs, pointSizes);
+    ADDRTYPE subtreeSizes[nr_dpus];  // Nodes of each subtree but its root, which replaces an existing leaf
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &subtreeSizes[each_dpu]));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "treeSizeRes", 0, sizeof(ADDRTYPE), DPU_XFER_DEFAULT));
+#ifdef PERF_EVAL
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        unsigned int nr_dpu = each_dpu;
         if (nr_dpu >= max_dpus)
             break;
-        DPU_ASSERT(dpu_copy_from(dpu, "points", 0, (uint8_t *)&points[treeLeftAddr[leafIds[nr_dpu]] * dimAmt], sizeof(ELEMTYPE) * treeSize[leafIds[nr_dpu]] * dimAmt));
-        DPU_ASSERT(dpu_copy_from(dpu, "treeSizeRes", 0, (uint8_t *)&subtreeSizes[nr_dpu], sizeof(ADDRTYPE)));
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &ctx->dpuCycles[nr_dpu]));
     }
-
-    return DPU_OK;
-}
-dpu_error_t getResponseFromTreesPart2(struct dpu_set_t rank, uint32_t rank_id, void *args) {
-    getResponseFromTreesContext *ctx = (getResponseFromTreesContext *)args;
-    uint32_t *dpu_offset = ctx->dpu_offset;
-    treeNode_t *tree = ctx->tree;
-    ADDRTYPE *treeLeftAddr = ctx->treeLeftAddr;
-    ADDRTYPE *leafIds = ctx->leafIds;
-    ADDRTYPE max_dpus = ctx->max_dpus;
-    ADDRTYPE *treeIdSizes = ctx->treeIdSizes;
-    ADDRTYPE *subtreeSizes = ctx->subtreeSizes;
-    ADDRTYPE *newLeafSizes = ctx->newLeafSizes;
-
-    unsigned int each_dpu;
-    struct dpu_set_t dpu;
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "exec_time", 0, sizeof(perfcounter_t), DPU_XFER_DEFAULT));
+#endif
+    GADDRTYPE rankTreeIdSize = 0;
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
+        unsigned int nr_dpu = each_dpu;
         if (nr_dpu >= max_dpus)
             break;
-        DPU_ASSERT(dpu_copy_from(dpu, "tree", 0, (uint8_t *)&tree[leafIds[nr_dpu]], sizeof(treeNode_t)));
-        if (subtreeSizes[nr_dpu] > 0) {
-            DPU_ASSERT(dpu_copy_from(dpu, "tree", sizeof(treeNode_t), (uint8_t *)&tree[treeIdSizes[nr_dpu]], sizeof(treeNode_t) * subtreeSizes[nr_dpu]));
-        }
-
-        newLeafSizes[nr_dpu] = 0;
-        if (tree[leafIds[nr_dpu]].left != (ADDRTYPE)(uint64_t)NULL || tree[leafIds[nr_dpu]].right != (ADDRTYPE)(uint64_t)NULL) {
-            if (tree[leafIds[nr_dpu]].left != (ADDRTYPE)(uint64_t)NULL)
-                tree[leafIds[nr_dpu]].left += treeIdSizes[nr_dpu] - 1;
-            if (tree[leafIds[nr_dpu]].right != (ADDRTYPE)(uint64_t)NULL)
-                tree[leafIds[nr_dpu]].right += treeIdSizes[nr_dpu] - 1;
-        } else {
-            tree[leafIds[nr_dpu]].mean += treeLeftAddr[leafIds[nr_dpu]];
-            ++(newLeafSizes[nr_dpu]);
-        }
-        ADDRTYPE treeIdSizesEnd = treeIdSizes[nr_dpu] + subtreeSizes[nr_dpu];
-        for (ADDRTYPE treeIdSize = treeIdSizes[nr_dpu]; treeIdSize < treeIdSizesEnd; ++treeIdSize) {
-            if (tree[treeIdSize].left != (ADDRTYPE)(uint64_t)NULL || tree[treeIdSize].right != (ADDRTYPE)(uint64_t)NULL) {
-                if (tree[treeIdSize].left != (ADDRTYPE)(uint64_t)NULL)
-                    tree[treeIdSize].left += treeIdSizes[nr_dpu] - 1;
-                if (tree[treeIdSize].right != (ADDRTYPE)(uint64_t)NULL)
-                    tree[treeIdSize].right += treeIdSizes[nr_dpu] - 1;
-            } else {
-                tree[treeIdSize].mean += treeLeftAddr[leafIds[nr_dpu]];
-                ++(newLeafSizes[nr_dpu]);
-            }
-        }
+        rankTreeIdSize += --subtreeSizes[each_dpu];
     }
-
-    return DPU_OK;
-}
-dpu_error_t getResponseFromTreesPart3(struct dpu_set_t rank, uint32_t rank_id, void *args) {
-    getResponseFromTreesContext *ctx = (getResponseFromTreesContext *)args;
-    uint32_t *dpu_offset = ctx->dpu_offset;
-    treeNode_t *tree = ctx->tree;
-    ADDRTYPE *leafIds = ctx->leafIds;
-    ADDRTYPE max_dpus = ctx->max_dpus;
-    ADDRTYPE *treeIdSizes = ctx->treeIdSizes;
-    ADDRTYPE *leafIdAddrs = ctx->leafIdAddrs;
-    ADDRTYPE *subtreeSizes = ctx->subtreeSizes;
-
-    unsigned int each_dpu;
-    struct dpu_set_t dpu;
+    GADDRTYPE treeIdSize = reserveTBPTree(pipeline, &pipeline->treeIdSize, rankTreeIdSize), newLeafSizes[nr_dpus], rankLeafIdSize = 0;
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
-        if (nr_dpu >= max_dpus || &dpu == &rank)  // `&dpu == &rank` is just used to avoid warnings. It is expected to be false
+        unsigned int nr_dpu = each_dpu;
+        if (nr_dpu >= max_dpus)
             break;
-
-        ADDRTYPE leafIdAddr = leafIdAddrs[nr_dpu];
-        if (tree[leafIds[nr_dpu]].left == (ADDRTYPE)(uint64_t)NULL && tree[leafIds[nr_dpu]].right == (ADDRTYPE)(uint64_t)NULL) {
-            leafIds[leafIdAddr++] = leafIds[nr_dpu];
-        }
-        ADDRTYPE treeIdSizesEnd = treeIdSizes[nr_dpu] + subtreeSizes[nr_dpu];
-        for (ADDRTYPE treeIdSize = treeIdSizes[nr_dpu]; treeIdSize < treeIdSizesEnd; ++treeIdSize) {
-            if (tree[treeIdSize].left == (ADDRTYPE)(uint64_t)NULL && tree[treeIdSize].right == (ADDRTYPE)(uint64_t)NULL) {
+        treeNode_t *dpuTree = malloc(sizeof(treeNode_t) * (subtreeSizes[each_dpu] + 1));
+        DPU_ASSERT(dpu_copy_from(dpu, "tree", 0, (uint8_t *)dpuTree, sizeof(treeNode_t) * (subtreeSizes[each_dpu] + 1)));
+
+        newLeafSizes[each_dpu] = 0;
+        setGlobalTreeNode(&tree[subtreeIds[nr_dpu]], dpuTree, treeIdSize, treeLeftAddr[subtreeIds[nr_dpu]], &newLeafSizes[each_dpu]);
+        for (ADDRTYPE dpuTreeId = 1; dpuTreeId <= subtreeSizes[each_dpu]; ++dpuTreeId)
+            setGlobalTreeNode(&tree[treeIdSize + dpuTreeId - 1], &dpuTree[dpuTreeId], treeIdSize, treeLeftAddr[subtreeIds[nr_dpu]], &newLeafSizes[each_dpu]);
+        free(dpuTree);
+        treeIdSize += subtreeSizes[each_dpu], rankLeafIdSize += newLeafSizes[each_dpu];
+    }
+    treeIdSize -= rankTreeIdSize;
+    GADDRTYPE leafIdAddr = reserveTBPTree(pipeline, &pipeline->leafIdSize, rankLeafIdSize);
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        unsigned int nr_dpu = each_dpu;
+        if (nr_dpu >= max_dpus)
+            break;
+        if (tree[subtreeIds[nr_dpu]].left == GADDRTYPE_NULL && tree[subtreeIds[nr_dpu]].right == GADDRTYPE_NULL)
+            leafIds[leafIdAddr++] = subtreeIds[nr_dpu];
+        for (GADDRTYPE treeIdEnd = treeIdSize + subtreeSizes[each_dpu]; treeIdSize < treeIdEnd; ++treeIdSize)
+            if (tree[treeIdSize].left == GADDRTYPE_NULL && tree[treeIdSize].right == GADDRTYPE_NULL)
                 leafIds[leafIdAddr++] = treeIdSize;
-            }
-        }
     }
+#ifdef PERF_EVAL
+    gettimeofday(&timecheck, NULL);
+    pipeline->rankResponseTimes[nr_rank] += (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec - start;
+#endif
+    releaseRank(pipeline->dispatcher, nr_rank);
 
     return DPU_OK;
 }
@@ -418,50 +1082,114 @@ dpu_error_t getPerfResponseFromTrees(struct dpu_set_t rank, uint32_t rank_id, vo
 }
 #endif
 
+static double getSubtreeCost(const GADDRTYPE pointSize, const uint32_t dimAmt) {  // Points scanned over the levels of a subtree in TBP
+    return pointSize > 1 ? (double)pointSize * log2((double)pointSize) * dimAmt : dimAmt;
+}
+
 typedef struct {
     ADDRTYPE max_dpus;
+    uint32_t nr_rank;  // The rank the batch runs on. The callbacks of the batch are queued on it alone
     ELEMTYPE *points;
-    uint32_t *dpu_offset;
-    treeNode_t *tree;
-    ADDRTYPE *leafIds;
+    outOfCore_t *outOfCore;
+    globalTreeNode_t *tree;
+    GADDRTYPE *leafIds;
+    GADDRTYPE *dpuLeafBegins;  // DPU `nr_dpu` of the batch builds the leaves leafIds[dpuLeafBegins[nr_dpu], dpuLeafBegins[nr_dpu + 1])
+    GADDRTYPE pointAmt;
     uint32_t dimAmt;
+    gbpPipeline_t *pipeline;
 } loadLeavesIntoDPUsContext;
 dpu_error_t loadLeavesIntoDPUs(struct dpu_set_t rank, uint32_t rank_id, void *args) {
     loadLeavesIntoDPUsContext *ctx = (loadLeavesIntoDPUsContext *)args;
     ELEMTYPE *points = ctx->points;
-    uint32_t *dpu_offset = ctx->dpu_offset;
-    treeNode_t *tree = ctx->tree;
-    ADDRTYPE *leafIds = ctx->leafIds;
+    outOfCore_t *outOfCore = ctx->outOfCore;
+    uint32_t nr_rank = ctx->nr_rank;
+    (void)rank_id;  // Always 0, since the callbacks of a batch are queued on its rank alone
+    globalTreeNode_t *tree = ctx->tree;
+    GADDRTYPE *leafIds = ctx->leafIds;
+    GADDRTYPE *dpuLeafBegins = ctx->dpuLeafBegins;
+    GADDRTYPE pointAmt = ctx->pointAmt;
     uint32_t dimAmt = ctx->dimAmt;
     ADDRTYPE max_dpus = ctx->max_dpus;
+#ifdef PERF_EVAL
+    struct timeval timecheck;
+    gettimeofday(&timecheck, NULL);
+    long start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
 
     unsigned int each_dpu;
     struct dpu_set_t dpu;
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    uint32_t leafAmts[nr_dpus];  // 0 for DPUs without leaves in the batch
+    gbpLeaf_t leafTables[nr_dpus][GBP_MAX_LEAVES];
+    GADDRTYPE elemAddrs[nr_dpus];
+    size_t sizes[nr_dpus];
+    uint32_t maxLeafAmt = 0;
+    bool contiguous = true;  // Leaves of each DPU follow each other in the points, so they are uploaded in place
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
-        if (nr_dpu < max_dpus)
-            DPU_ASSERT(dpu_prepare_xfer(dpu, &tree[leafIds[nr_dpu]].dim));
-        else
-            DPU_ASSERT(dpu_prepare_xfer(dpu, &tree[leafIds[max_dpus - 1]].dim));
+        unsigned int nr_dpu = each_dpu;
+        leafAmts[each_dpu] = nr_dpu < max_dpus ? dpuLeafBegins[nr_dpu + 1] - dpuLeafBegins[nr_dpu] : 0;
+        elemAddrs[each_dpu] = leafAmts[each_dpu] > 0 ? tree[leafIds[dpuLeafBegins[nr_dpu]]].mean * dimAmt : 0;
+        ADDRTYPE dpuPointAmt = 0;
+        for (uint32_t leaf = 0; leaf < leafAmts[each_dpu]; ++leaf) {
+            const globalTreeNode_t *node = &tree[leafIds[dpuLeafBegins[nr_dpu] + leaf]];
+            contiguous = contiguous && node->mean * dimAmt == elemAddrs[each_dpu] + (GADDRTYPE)dpuPointAmt * dimAmt;
+            leafTables[each_dpu][leaf].pointBegin = dpuPointAmt, leafTables[each_dpu][leaf].pointAmt = node->dim;
+            dpuPointAmt += node->dim;
+        }
+        sizes[each_dpu] = sizeof(ELEMTYPE) * dpuPointAmt * dimAmt;
+        maxLeafAmt = leafAmts[each_dpu] > maxLeafAmt ? leafAmts[each_dpu] : maxLeafAmt;
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &leafAmts[each_dpu]));
     }
-    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "pointAmt", 0, sizeof(ADDRTYPE), DPU_XFER_DEFAULT));
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "leafAmt", 0, sizeof(uint32_t), DPU_XFER_DEFAULT));
+    if (maxLeafAmt < 1)
+        return DPU_OK;
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
-        if (nr_dpu >= max_dpus)
-            break;
-        DPU_ASSERT(dpu_copy_to(dpu, "points", 0, (uint8_t *)&points[tree[leafIds[nr_dpu]].mean * dimAmt], sizeof(ELEMTYPE) * tree[leafIds[nr_dpu]].dim * dimAmt));
+        DPU_ASSERT(dpu_prepare_xfer(dpu, leafTables[each_dpu]));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "leaves", 0, sizeof(gbpLeaf_t) * maxLeafAmt, DPU_XFER_DEFAULT));
+    if (contiguous) {
+        pushPointsToRank(rank, nr_rank, points, outOfCore, pointAmt * dimAmt, elemAddrs, sizes);
+    } else {  // Leaves of each DPU are staged one after another
+        size_t xferSize = getRankXferSize(sizes, nr_dpus);
+        uint8_t *buffer = outOfCore != NULL ? getRankBuffer(outOfCore, nr_rank, xferSize * nr_dpus) : malloc(xferSize * nr_dpus);
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            unsigned int nr_dpu = each_dpu;
+            for (uint32_t leaf = 0; leaf < leafAmts[each_dpu]; ++leaf) {
+                const globalTreeNode_t *node = &tree[leafIds[dpuLeafBegins[nr_dpu] + leaf]];
+                uint8_t *leafBuffer = buffer + xferSize * each_dpu + sizeof(ELEMTYPE) * leafTables[each_dpu][leaf].pointBegin * dimAmt;
+                if (outOfCore != NULL)
+                    readDataAt(outOfCore->loadFd, leafBuffer, sizeof(ELEMTYPE) * node->dim * dimAmt, sizeof(ELEMTYPE) * node->mean * dimAmt);
+                else
+                    memcpy(leafBuffer, &points[node->mean * dimAmt], sizeof(ELEMTYPE) * node->dim * dimAmt);
+            }
+            if (sizes[each_dpu] > 0)
+                DPU_ASSERT(dpu_prepare_xfer(dpu, buffer + xferSize * each_dpu));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_TO_DPU, "points", 0, xferSize, DPU_XFER_DEFAULT));
+        if (outOfCore == NULL)
+            free(buffer);
     }
+#ifdef PERF_EVAL
+    gettimeofday(&timecheck, NULL);
+    ctx->pipeline->rankLoadTimes[nr_rank] += (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec - start;
+#endif
 
     return DPU_OK;
 }
 
 typedef struct {
     ADDRTYPE max_dpus;
-    pqueue_elem_t_mram *neighbors;
+    uint32_t nr_rank;
+    GADDRTYPE batch;
+    gbpPipeline_t *pipeline;
     uint32_t *dpu_offset;
-    treeNode_t *tree;
-    ADDRTYPE *leafIds;
-    uint32_t neighborAmt;
+    GADDRTYPE *dpuLeafBegins;
+    double cost;  // Estimated cost of the leaves of the batch
+    long dispatchTime;  // Unit: us
+#ifdef PERF_EVAL
+    perfcounter_t *dpuCycles;  // Cycles of each DPU of the batch
+#endif
 #ifdef PERF_EVAL_SIM
     perfcounter_t *perfs;
     uint32_t *freqs;
@@ -469,24 +1197,113 @@ typedef struct {
 } getResponseFromGraphsContext;
 dpu_error_t getResponseFromGraphs(struct dpu_set_t rank, uint32_t rank_id, void *args) {
     getResponseFromGraphsContext *ctx = (getResponseFromGraphsContext *)args;
-    pqueue_elem_t_mram *neighbors = ctx->neighbors;
-    uint32_t *dpu_offset = ctx->dpu_offset;
-    treeNode_t *tree = ctx->tree;
-    ADDRTYPE *leafIds = ctx->leafIds;
-    uint32_t neighborAmt = ctx->neighborAmt;
+    uint32_t nr_rank = ctx->nr_rank;
+    (void)rank_id;  // Always 0, since the callbacks of a batch are queued on its rank alone
+    GADDRTYPE *dpuLeafBegins = ctx->dpuLeafBegins;
     ADDRTYPE max_dpus = ctx->max_dpus;
+    gbpPipeline_t *pipeline = ctx->pipeline;
+    globalTreeNode_t *tree = pipeline->tree;
+    GADDRTYPE *leafIds = pipeline->leafIds;
+    uint32_t neighborAmt = pipeline->neighborAmt;
+#ifdef PERF_EVAL
+    struct timeval timecheck;
+    gettimeofday(&timecheck, NULL);
+    long start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
 
     unsigned int each_dpu;
     struct dpu_set_t dpu;
+    uint32_t nr_dpus;
+    DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+    size_t sizes[nr_dpus];
     DPU_FOREACH (rank, dpu, each_dpu) {
-        unsigned int nr_dpu = each_dpu + dpu_offset[rank_id];
+        unsigned int nr_dpu = each_dpu;
+        GADDRTYPE dpuPointAmt = 0;
+        if (nr_dpu < max_dpus)
+            for (GADDRTYPE leafId = dpuLeafBegins[nr_dpu]; leafId < dpuLeafBegins[nr_dpu + 1]; ++leafId)
+                dpuPointAmt += tree[leafIds[leafId]].dim;
+        sizes[each_dpu] = sizeof(pqueue_elem_t_mram) * dpuPointAmt * neighborAmt;
+    }
+    size_t xferSize = getRankXferSize(sizes, nr_dpus);  // Lists of all DPUs of the rank come back in one transfer, padded to the largest DPU
+    globalNeighbor_t *rankNeighbors[nr_dpus];
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        rankNeighbors[each_dpu] = NULL;
+        if (sizes[each_dpu] > 0) {
+            rankNeighbors[each_dpu] = malloc(xferSize);
+            DPU_ASSERT(dpu_prepare_xfer(dpu, rankNeighbors[each_dpu]));
+        }
+    }
+    if (xferSize > 0)
+        DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "neighbors", 0, xferSize, DPU_XFER_DEFAULT));
+#ifdef PERF_EVAL
+    if (xferSize > 0) {
+        DPU_FOREACH (rank, dpu, each_dpu) {
+            if (sizes[each_dpu] > 0)
+                DPU_ASSERT(dpu_prepare_xfer(dpu, &ctx->dpuCycles[each_dpu]));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "exec_time", 0, sizeof(perfcounter_t), DPU_XFER_DEFAULT));
+    }
+#endif
+    DPU_FOREACH (rank, dpu, each_dpu) {
+        unsigned int nr_dpu = each_dpu;
         if (nr_dpu >= max_dpus)
             break;
-        DPU_ASSERT(dpu_copy_from(dpu, "neighbors", 0, (uint8_t *)&neighbors[tree[leafIds[nr_dpu]].mean * neighborAmt], sizeof(pqueue_elem_t_mram) * tree[leafIds[nr_dpu]].dim * neighborAmt));  // If the leaf size is smaller than neighborAmt, this operation may cause overflow of address, which leads to a segment fault. Caution please!
+        pushGraphsOfLeaves(pipeline, dpuLeafBegins[nr_dpu], dpuLeafBegins[nr_dpu + 1], rankNeighbors[each_dpu]);
     }
+#ifdef PERF_EVAL
+    gettimeofday(&timecheck, NULL);
+    pipeline->rankResponseTimes[nr_rank] += (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec - start;
+#endif
+    completeGBPBatch(pipeline, ctx->batch);
+    measureGBPBatch(pipeline, nr_rank, ctx->cost, ctx->dispatchTime);
+    releaseRank(pipeline->dispatcher, nr_rank);
 
     return DPU_OK;
 }
+typedef struct {  // Batches are planned while the tree is still growing, so each one is allocated on its own. Alive until all queued callbacks have run
+    loadLeavesIntoDPUsContext loadContext;
+    getResponseFromGraphsContext responseContext;
+    GADDRTYPE dpuLeafBegins[];  // DPU `nr_dpu` of the batch builds the leaves leafIds[dpuLeafBegins[nr_dpu], dpuLeafBegins[nr_dpu + 1])
+} gbpBatch_t;
+static void *buildGraphsOnHost(void *args) {  // A batch of the host engine, run by a thread of its own. The leaves of each DPU of the batch are packed as in its MRAM, built by all cores and drained as its results
+    gbpBatch_t *batch = (gbpBatch_t *)args;
+    loadLeavesIntoDPUsContext *ctx = &batch->loadContext;
+    ELEMTYPE *points = ctx->points;
+    globalTreeNode_t *tree = ctx->tree;
+    GADDRTYPE *leafIds = ctx->leafIds;
+    GADDRTYPE *dpuLeafBegins = ctx->dpuLeafBegins;
+    uint32_t dimAmt = ctx->dimAmt;
+    gbpPipeline_t *pipeline = ctx->pipeline;
+    uint32_t neighborAmt = pipeline->neighborAmt;
+    for (ADDRTYPE nr_dpu = 0; nr_dpu < ctx->max_dpus; ++nr_dpu) {
+        uint32_t leafAmt = dpuLeafBegins[nr_dpu + 1] - dpuLeafBegins[nr_dpu];
+        gbpLeaf_t leaves[GBP_MAX_LEAVES];
+        GADDRTYPE firstPoint = tree[leafIds[dpuLeafBegins[nr_dpu]]].mean;
+        ADDRTYPE dpuPointAmt = 0;
+        bool contiguous = true;  // Leaves following each other in the points are built in place
+        for (uint32_t leaf = 0; leaf < leafAmt; ++leaf) {
+            const globalTreeNode_t *node = &tree[leafIds[dpuLeafBegins[nr_dpu] + leaf]];
+            contiguous = contiguous && node->mean == firstPoint + dpuPointAmt;
+            leaves[leaf].pointBegin = dpuPointAmt, leaves[leaf].pointAmt = node->dim;
+            dpuPointAmt += node->dim;
+        }
+        ELEMTYPE *dpuPoints = points + firstPoint * dimAmt;
+        if (!contiguous) {  // Leaves are staged one after another
+            dpuPoints = malloc(sizeof(ELEMTYPE) * dpuPointAmt * dimAmt);
+            for (uint32_t leaf = 0; leaf < leafAmt; ++leaf)
+                memcpy(dpuPoints + (size_t)leaves[leaf].pointBegin * dimAmt, &points[tree[leafIds[dpuLeafBegins[nr_dpu] + leaf]].mean * dimAmt], sizeof(ELEMTYPE) * leaves[leaf].pointAmt * dimAmt);
+        }
+        globalNeighbor_t *dpuNeighbors = malloc(sizeof(globalNeighbor_t) * dpuPointAmt * neighborAmt);  // Lists of leaves of no more than neighborAmt points are not full. Their tails are set by `pushGraphsOfLeaves`, as for DPUs
+        graphBuildingHost(dpuPoints, leaves, leafAmt, dimAmt, neighborAmt, (pqueue_elem_t_mram *)dpuNeighbors);
+        if (!contiguous)
+            free(dpuPoints);
+        pushGraphsOfLeaves(pipeline, dpuLeafBegins[nr_dpu], dpuLeafBegins[nr_dpu + 1], dpuNeighbors);
+    }
+    completeGBPBatch(pipeline, batch->responseContext.batch);
+    measureGBPBatch(pipeline, pipeline->hostRank, batch->responseContext.cost, batch->responseContext.dispatchTime);
+    releaseRank(pipeline->dispatcher, pipeline->hostRank);
+    return NULL;
+}
 #ifdef PERF_EVAL_SIM
 dpu_error_t getPerfResponseFromGraphs(struct dpu_set_t rank, uint32_t rank_id, void *args) {
     getResponseFromGraphsContext *ctx = (getResponseFromGraphsContext *)args;
@@ -513,22 +1330,32 @@ __attribute__((noreturn)) static void usage(FILE *f, int exit_code, const char *
     /* clang-format off */
     fprintf(f,
 #ifdef PERF_EVAL
-            "\nusage: %s [-p <points_path>] [-t <tree_result_path>] [-l <leaf_result_path>] [-k <knn_result_path>] [-D <number_of_dimension>] [-F <frequency_of_dpus>] [-K <number_of_neighbors>] [-L <capacity_of_leaves>] [-M <number_of_mrams>]\n"
+            "\nusage: %s [-p <points_path>] [-f <points_format>] [-t <tree_result_path>] [-l <leaf_result_path>] [-k <knn_result_path>] [-B <bundle_path>] [-D <number_of_dimension>] [-F <frequency_of_dpus>] [-K <number_of_neighbors>] [-L <capacity_of_leaves>] [-M <number_of_mrams>] [-C <bits_of_distances>] [-c <checkpoint_prefix>] [-T <engine_of_tree>] [-g <engine_of_graphs>] [-r] [-m] [-d] [-O]\n"
 #else
-            "\nusage: %s [-p <points_path>] [-t <tree_result_path>] [-l <leaf_result_path>] [-k <knn_result_path>] [-D <number_of_dimension>] [-K <number_of_neighbors>] [-L <capacity_of_leaves>] [-M <number_of_mrams>]\n"
+            "\nusage: %s [-p <points_path>] [-f <points_format>] [-t <tree_result_path>] [-l <leaf_result_path>] [-k <knn_result_path>] [-B <bundle_path>] [-D <number_of_dimension>] [-K <number_of_neighbors>] [-L <capacity_of_leaves>] [-M <number_of_mrams>] [-C <bits_of_distances>] [-c <checkpoint_prefix>] [-T <engine_of_tree>] [-g <engine_of_graphs>] [-r] [-m] [-d] [-O]\n"
 #endif
             "\n"
             "\t-p \tthe path to the points location (default: points.bin)\n"
+            "\t-f \tthe format of points: raw, fvecs, bvecs, fbin or u8bin (default: guessed from the extension of the points path, raw for the others). Float points are quantized into ELEMTYPE, and the scale and offset are saved beside the leaf result\n"
             "\t-t \tthe path to the tree result location (default: tree.bin)\n"
-            "\t-l \tthe path to the leaf result location (default: leaf.bin)\n"
+            "\t-l \tthe path to the leaf result location, i.e. the original ids of points in the order of leaves (default: leaf.bin)\n"
             "\t-k \tthe path to the k nearest neighbor, a.k.a, the result graph, location (default: knn.bin)\n"
-            "\t-D \tthe number of dimensions of input points (default: 128)\n"
+            "\t-B \twrite the tree, leaf and knn results into one self-describing bundle instead of the three paths above (default: no bundle)\n"
+            "\t-D \tthe number of dimensions of input points (default: read from fvecs, bvecs, fbin and u8bin points, 128 for raw points)\n"
 #ifdef PERF_EVAL
             "\t-F \tthe frequency of DPUs (default: 450000000)\n"
 #endif
             "\t-K \tthe number of neighbors (default: 10)\n"
             "\t-L \tthe capacity of leaves (default: 1000)\n"
             "\t-M \tthe number of mram to used (default: DPU_ALLOCATE_ALL)\n"
+            "\t-C \twrite the knn result in the compact format, with ids delta and varint coded and distances quantized into 0 (dropped), 8 or 16 bits (default: the raw format)\n"
+            "\t-c \tcheckpoint the build into files with this prefix: the tree and the permuted points after the tree building phase, and a journal of the batches done by the graph building phase (default: no checkpoint)\n"
+            "\t-T \tthe engine of the tree building phase: dpu to split the top tree level by level on DPUs, host to build the whole tree on the host with all cores and hand its leaves to the graph building phase as soon as they are final (unless the build is checkpointed or bundled, which needs the whole tree first), or auto to split the first levels of the top tree on the host while a cost model of their sizes, the dimensions and the measured bandwidth of the host expects them to be faster there, and the rest on DPUs (default: dpu)\n"
+            "\t-g \tthe engine of the graph building phase: dpu, host to build the graphs with all cores of the host CPU and allocate no DPU (with -T host or -r only), or hybrid to share the leaves between DPUs and the host CPU by their measured rates (default: dpu)\n"
+            "\t-r \tresume the build from the checkpoint given by -c: the tree building phase and the journaled batches are skipped, and the results of the failed build are completed in place\n"
+            "\t-m \tmap the points file into memory instead of reading it (only the pages permuted by the tree building phase are copied)\n"
+            "\t-d \tread raw points with O_DIRECT, bypassing the page cache\n"
+            "\t-O \tbuild out of core: points are streamed between the disk and DPUs through a spill file beside the leaf result, for datasets larger than the host memory\n"
             "\t-h \tshow the usage message\n",
             exec_name);
     /* clang-format on */
@@ -543,21 +1370,24 @@ static void verify_path_exists(const char *path) {
 }
 
 #ifdef PERF_EVAL
-static void parse_args(int argc, char **argv, uint32_t *dimAmt, uint32_t *neighborAmt, uint32_t *leafCapacity, uint32_t *nb_mram, uint64_t *frequency, char **pointsFileName, char **treeFileName, char **leafFileName, char **knnFileName) {
+static void parse_args(int argc, char **argv, uint32_t *dimAmt, uint32_t *neighborAmt, uint32_t *leafCapacity, uint32_t *nb_mram, int32_t *compactKnnBits, bool *mmapPoints, bool *directIO, bool *outOfCore, bool *resume, tbpEngine_t *tbpEngine, gbpEngine_t *gbpEngine, uint64_t *frequency, char **pointsFileName, char **pointsFormatName, char **treeFileName, char **leafFileName, char **knnFileName, char **checkpointPrefix, char **bundleFileName) {
 #else
-static void parse_args(int argc, char **argv, uint32_t *dimAmt, uint32_t *neighborAmt, uint32_t *leafCapacity, uint32_t *nb_mram, char **pointsFileName, char **treeFileName, char **leafFileName, char **knnFileName) {
+static void parse_args(int argc, char **argv, uint32_t *dimAmt, uint32_t *neighborAmt, uint32_t *leafCapacity, uint32_t *nb_mram, int32_t *compactKnnBits, bool *mmapPoints, bool *directIO, bool *outOfCore, bool *resume, tbpEngine_t *tbpEngine, gbpEngine_t *gbpEngine, char **pointsFileName, char **pointsFormatName, char **treeFileName, char **leafFileName, char **knnFileName, char **checkpointPrefix, char **bundleFileName) {
 #endif
     int opt;
     extern char *optarg;
 #ifdef PERF_EVAL
-    while ((opt = getopt(argc, argv, "hD:K:L:M:F:p:t:l:k:")) != -1) {
+    while ((opt = getopt(argc, argv, "hmdrOD:K:L:M:F:C:c:T:g:p:f:t:l:k:B:")) != -1) {
 #else
-    while ((opt = getopt(argc, argv, "hD:K:L:M:p:t:l:k:")) != -1) {
+    while ((opt = getopt(argc, argv, "hmdrOD:K:L:M:C:c:T:g:p:f:t:l:k:B:")) != -1) {
 #endif
         switch (opt) {
             case 'p':
                 *pointsFileName = optarg;
                 break;
+            case 'f':
+                *pointsFormatName = optarg;
+                break;
             case 'D':
                 *dimAmt = (uint32_t)atoi(optarg);
                 break;
@@ -581,27 +1411,166 @@ static void parse_args(int argc, char **argv, uint32_t *dimAmt, uint32_t *neighb
             case 'k':
                 *knnFileName = optarg;
                 break;
+            case 'B':
+                *bundleFileName = optarg;
+                break;
             case 'M':
                 *nb_mram = (uint32_t)atoi(optarg);
                 break;
+            case 'C':
+                *compactKnnBits = (int32_t)atoi(optarg);
+                break;
+            case 'c':
+                *checkpointPrefix = optarg;
+                break;
+            case 'T':
+                if (strcmp(optarg, "dpu") == 0) {
+                    *tbpEngine = TBP_ENGINE_DPU;
+                } else if (strcmp(optarg, "host") == 0) {
+                    *tbpEngine = TBP_ENGINE_HOST;
+                } else if (strcmp(optarg, "auto") == 0) {
+                    *tbpEngine = TBP_ENGINE_AUTO;
+                } else {
+                    printf("Unknown engine of the tree building phase: %s! Exit now!\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'g':
+                if (strcmp(optarg, "dpu") == 0) {
+                    *gbpEngine = GBP_ENGINE_DPU;
+                } else if (strcmp(optarg, "host") == 0) {
+                    *gbpEngine = GBP_ENGINE_HOST;
+                } else if (strcmp(optarg, "hybrid") == 0) {
+                    *gbpEngine = GBP_ENGINE_HYBRID;
+                } else {
+                    printf("Unknown engine of the graph building phase: %s! Exit now!\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'r':
+                *resume = true;
+                break;
+            case 'm':
+                *mmapPoints = true;
+                break;
+            case 'd':
+                *directIO = true;
+                break;
+            case 'O':
+                *outOfCore = true;
+                break;
             case 'h':
                 usage(stdout, EXIT_SUCCESS, argv[0]);
             default:
                 usage(stderr, EXIT_FAILURE, argv[0]);
         }
     }
-    verify_path_exists(*pointsFileName);
+    if (*outOfCore && *tbpEngine == TBP_ENGINE_HOST) {
+        printf("The points are never resident on the host in the out-of-core mode, so the tree cannot be built there! Exit now!\n");
+        exit(-1);
+    }
+    if (*outOfCore && *gbpEngine != GBP_ENGINE_DPU) {
+        printf("The points are never resident on the host in the out-of-core mode, so the graphs cannot be built there! Exit now!\n");
+        exit(-1);
+    }
+    if (*gbpEngine == GBP_ENGINE_HOST && *tbpEngine != TBP_ENGINE_HOST && !*resume) {
+        printf("No DPU is allocated for the host engine of the graph building phase, so the tree must be built on the host by -T host! Exit now!\n");
+        exit(-1);
+    }
+    if (*resume && *checkpointPrefix == NULL) {
+        printf("Resuming needs the checkpoint prefix given by -c! Exit now!\n");
+        exit(-1);
+    }
+    if (!*resume)  // The points of the checkpoint replace the input
+        verify_path_exists(*pointsFileName);
+    if (*dimAmt == 0)
+        *dimAmt = *resume ? getCheckpointDimAmt(*checkpointPrefix) : getPointsDimAmt(*pointsFileName, getPointsFormat(*pointsFileName, *pointsFormatName));
+    if (*dimAmt == 0)  // Raw points record no dimension
+        *dimAmt = 128;
 }
 
 #ifdef PERF_EVAL
-static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, const uint32_t dimAmt, const uint32_t neighborAmt, const uint32_t leafCapacity, const char *const pointsFileName, const char *const treeFileName, const char *const leafFileName, const char *const knnFileName) {
+static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, const uint32_t dimAmt, const uint32_t neighborAmt, const uint32_t leafCapacity, const int32_t compactKnnBits, const bool mmapPoints, const bool directIO, const bool outOfCore, const bool resume, const tbpEngine_t tbpEngine, const gbpEngine_t gbpEngine, const char *const pointsFileName, const char *const pointsFormatName, const char *const treeFileName, const char *const leafFileName, const char *const knnFileName, const char *const checkpointPrefix, const char *const bundleFileName) {
 #else
-static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, const uint32_t dimAmt, const uint32_t neighborAmt, const uint32_t leafCapacity, const char *const pointsFileName, const char *const treeFileName, const char *const leafFileName, const char *const knnFileName) {
+static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, const uint32_t dimAmt, const uint32_t neighborAmt, const uint32_t leafCapacity, const int32_t compactKnnBits, const bool mmapPoints, const bool directIO, const bool outOfCore, const bool resume, const tbpEngine_t tbpEngine, const gbpEngine_t gbpEngine, const char *const pointsFileName, const char *const pointsFormatName, const char *const treeFileName, const char *const leafFileName, const char *const knnFileName, const char *const checkpointPrefix, const char *const bundleFileName) {
 #endif
-    const ADDRTYPE pointAmt = getPointsAmount(pointsFileName, dimAmt);
-    const ADDRTYPE MAX_TREE_SIZE = pointAmt + 3;
-    ELEMTYPE *points = malloc(pointAmt * dimAmt * sizeof(ELEMTYPE));
-    loadPointsFromFile(pointsFileName, points);
+    pointsFile_t pointsFile;
+    checkpointHeader_t checkpointHeader;
+    const GADDRTYPE pointAmt = resume ? loadCheckpointHeader(checkpointPrefix, &checkpointHeader, &pointsFile, dimAmt, leafCapacity) : getPointsAmount(pointsFileName, dimAmt, getPointsFormat(pointsFileName, pointsFormatName), &pointsFile);
+    if (pointAmt > (GADDRTYPE)UINT32_MAX + 1) {
+        printf("The leaf result holds %zu-byte ids, which cannot identify all %lu points! Exit now!\n", sizeof(POINTIDTYPE), pointAmt);
+        exit(-1);
+    }
+    pointsFile.direct = directIO;
+    char checkpointPointsFileName[checkpointPrefix != NULL ? strlen(checkpointPrefix) + sizeof(CHECKPOINT_POINTS_SUFFIX) : 1];
+    if (checkpointPrefix != NULL)
+        sprintf(checkpointPointsFileName, "%s" CHECKPOINT_POINTS_SUFFIX, checkpointPrefix);
+    const GADDRTYPE MAX_TREE_SIZE = pointAmt + 3;
+    size_t pointsMappedBytes = 0;
+    ELEMTYPE *points = NULL;
+    outOfCore_t outOfCoreFiles = { .loadFd = -1, .spillFd = -1, .rankBuffers = NULL, .rankBufferBytes = NULL };
+    pointsReader_t pointsReader;
+    pointsReader_t *pendingReader = NULL;  // Non-NULL while the input is still being read
+    if (outOfCore) {
+        char spillFileName[strlen(leafFileName) + sizeof(".spill")];
+        if (checkpointPrefix != NULL)  // The spill file ends up with the permuted points, so it is kept as the points file of the checkpoint
+            strcpy(spillFileName, checkpointPointsFileName);
+        else
+            sprintf(spillFileName, "%s.spill", leafFileName);
+        struct stat pointsFileStat, spillFileStat;
+        if (stat(spillFileName, &spillFileStat) == 0 && stat(pointsFileName, &pointsFileStat) == 0 && spillFileStat.st_dev == pointsFileStat.st_dev && spillFileStat.st_ino == pointsFileStat.st_ino) {
+            printf("The spill file: %s is the input point file, which would be overwritten by the out-of-core mode! Exit now!\n", spillFileName);
+            exit(-1);
+        }
+        outOfCoreFiles.spillFd = open(spillFileName, resume ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (outOfCoreFiles.spillFd < 0) {
+            printf("Failed to open the spill file: %s! Exit now!\n", spillFileName);
+            exit(-1);
+        }
+        if (checkpointPrefix == NULL)
+            unlink(spillFileName);  // Removed once closed, even on failures
+        if (resume) {
+            outOfCoreFiles.loadFd = outOfCoreFiles.spillFd;
+        } else if (pointsFile.format == POINTS_FORMAT_RAW) {  // The first pass reads the input file directly, and later passes read back what has been spilled
+            outOfCoreFiles.loadFd = open(pointsFileName, O_RDONLY);
+            if (outOfCoreFiles.loadFd < 0) {
+                printf("Failed to open the input point file: %s! Exit now!\n", pointsFileName);
+                exit(-1);
+            }
+        } else {
+            convertPointsToFile(&pointsFile, outOfCoreFiles.spillFd, (LARGE_TREE_THRESHOLD / sizeof(ELEMTYPE) + dimAmt - 1) / dimAmt);
+            outOfCoreFiles.loadFd = outOfCoreFiles.spillFd;
+        }
+        outOfCoreFiles.rankBuffers = calloc(nr_ranks, sizeof(uint8_t *));
+        outOfCoreFiles.rankBufferBytes = calloc(nr_ranks, sizeof(size_t));
+        if (mmapPoints)
+            printf("[Host]  The points in %s are streamed from the disk in the out-of-core mode, so they are not mapped\n", pointsFileName);
+    } else if (resume) {  // The points of the checkpoint are already permuted
+        if (mmapPoints) {
+            points = mapPointsFromFile(checkpointPointsFileName, &pointsMappedBytes);
+        } else {
+            pointsFile_t checkpointPointsFile;
+            getPointsAmount(checkpointPointsFileName, dimAmt, POINTS_FORMAT_RAW, &checkpointPointsFile);
+            checkpointPointsFile.direct = directIO;
+            points = malloc(pointAmt * dimAmt * sizeof(ELEMTYPE));
+            loadPointsFromFile(&checkpointPointsFile, points);
+        }
+    } else if (mmapPoints && pointsFile.format == POINTS_FORMAT_RAW) {
+        points = mapPointsFromFile(pointsFileName, &pointsMappedBytes);
+    } else if (pointsFile.format == POINTS_FORMAT_RAW) {  // Slices of the root are uploaded to DPUs as soon as they land
+        points = malloc(pointAmt * dimAmt * sizeof(ELEMTYPE));
+        startPointsReader(&pointsReader, &pointsFile, points);
+        pendingReader = &pointsReader;
+    } else {
+        if (mmapPoints)
+            printf("[Host]  The points in %s need conversion, so they are read instead of mapped\n", pointsFileName);
+        points = malloc(pointAmt * dimAmt * sizeof(ELEMTYPE));
+        loadPointsFromFile(&pointsFile, points);
+    }
+    POINTIDTYPE *pointIds = malloc((pointAmt + 1) * sizeof(POINTIDTYPE));  // Original ids follow points through every swap of the tree building phase. The last one pads transfers to DPUs
+#pragma omp parallel for
+    for (GADDRTYPE pointId = 0; pointId <= pointAmt; ++pointId)
+        pointIds[pointId] = pointId;
 
 #ifdef ENERGY_EVAL
     double ESU = getEnergyUnit();
@@ -634,11 +1603,15 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
 
     struct dpu_set_t rank;
     uint32_t each_rank;
-    DPU_RANK_FOREACH (dpu_set, rank, each_rank) {
-        uint32_t nr_dpus;
-        DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
-        dpu_offset[each_rank + 1] = dpu_offset[each_rank] + nr_dpus;
-        nr_all_dpus += nr_dpus;
+    struct dpu_set_t ranks[nr_ranks + 1];  // Ranks are launched one by one in the batches of the subtrees and of the graph building phase
+    if (nr_ranks > 0) {  // No DPU is allocated for the host engine of the graph building phase
+        DPU_RANK_FOREACH (dpu_set, rank, each_rank) {
+            uint32_t nr_dpus;
+            DPU_ASSERT(dpu_get_nr_dpus(rank, &nr_dpus));
+            dpu_offset[each_rank + 1] = dpu_offset[each_rank] + nr_dpus;
+            nr_all_dpus += nr_dpus;
+            ranks[each_rank] = rank;
+        }
     }
 
 #ifdef PERF_EVAL
@@ -661,20 +1634,39 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
     start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
     // printf("Initializing buffers\n");
-    treeNode_t *tree = malloc(MAX_TREE_SIZE * sizeof(treeNode_t));
-    ADDRTYPE *treeLeftAddr = malloc(MAX_TREE_SIZE * sizeof(ADDRTYPE));
-    ADDRTYPE *treeSize = malloc(MAX_TREE_SIZE * sizeof(ADDRTYPE));
-    ADDRTYPE *largeTreeIds = malloc(pointAmt * dimAmt * sizeof(treeNode_t) / LARGE_TREE_THRESHOLD * sizeof(ADDRTYPE));
-    ADDRTYPE largeTreeIdSize = 0;
-    ADDRTYPE treeIdSize = 0;
-    tree[0].left = tree[0].right = (ADDRTYPE)(uint64_t)NULL;
-    treeLeftAddr[0] = 0;
-    treeSize[0] = pointAmt;
-    tree[0].mean = treeLeftAddr[0], tree[0].dim = treeSize[0];
-    ++treeIdSize;
-    if (pointAmt * dimAmt * sizeof(treeNode_t) > LARGE_TREE_THRESHOLD)
-        largeTreeIds[largeTreeIdSize++] = 0;
+    globalTreeNode_t *tree = malloc(MAX_TREE_SIZE * sizeof(globalTreeNode_t));
+    GADDRTYPE *treeLeftAddr = malloc(MAX_TREE_SIZE * sizeof(GADDRTYPE));
+    GADDRTYPE *treeSize = malloc(MAX_TREE_SIZE * sizeof(GADDRTYPE));
+    GADDRTYPE *largeTreeIds = malloc(((pointAmt * dimAmt * sizeof(treeNode_t) / LARGE_TREE_THRESHOLD << 1) + 1) * sizeof(GADDRTYPE));  // Large subtrees of the current level and of the next level are stored together
+    GADDRTYPE largeTreeIdSize = 0;
+    GADDRTYPE treeIdSize = 0;
+    GADDRTYPE *leafIds = malloc(MAX_TREE_SIZE * sizeof(GADDRTYPE));
+    GADDRTYPE leafIdSize = 0;
+    if (resume) {  // Without large subtrees and large leaves, the tree building phase below is skipped
+        loadCheckpoint(checkpointPrefix, &checkpointHeader, tree, leafIds, pointIds);
+        treeIdSize = checkpointHeader.treeIdSize, leafIdSize = checkpointHeader.leafIdSize;
+    } else {
+        tree[0].left = tree[0].right = GADDRTYPE_NULL;
+        treeLeftAddr[0] = 0;
+        treeSize[0] = pointAmt;
+        tree[0].mean = treeLeftAddr[0], tree[0].dim = treeSize[0];
+        ++treeIdSize;
+        if (pointAmt * dimAmt * sizeof(treeNode_t) > LARGE_TREE_THRESHOLD)
+            largeTreeIds[largeTreeIdSize++] = 0;
+    }
     srand(time(0));
+    const bool hostTree = tbpEngine == TBP_ENGINE_HOST && !resume;
+    const bool dpuTree = !resume && !hostTree;
+    const bool streamLeaves = hostTree && checkpointPrefix == NULL && bundleFileName == NULL;  // Checkpoints and bundles need the whole tree before the first batch
+    if (hostTree) {  // Neither the top tree nor the subtrees are split on DPUs
+        if (pendingReader != NULL) {
+            stopPointsReader(pendingReader);
+            pendingReader = NULL;
+        }
+        if (!streamLeaves)  // Streamed leaves are built in the background once the graph building phase starts
+            treeConstrDPU(tree, &treeIdSize, points, pointIds, 0, pointAmt, dimAmt, leafCapacity, leafIds, &leafIdSize, NULL);
+        largeTreeIdSize = 0;
+    }
     // 1. Transfer data to DPU
     // 2. TBP (here, I record the left most address of points in each corresponding leaf node to reduce memory usage, which might be changed into `leafId * leafCapacity` for the future incremental updating)
     // printf("Tree building phase:\n");
@@ -683,303 +1675,126 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
     end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
     printf("[Host]  Total time for data preparation: %.3lfs\n", (end - start) / 1e6);
 #endif
-    // Split all large subtrees
-    while (largeTreeIdSize > 0) {
-        MEAN_VALUE_TYPE sums[nr_all_dpus];
-        ADDRTYPE pointSizes[nr_all_dpus];
-        ADDRTYPE splits[nr_all_dpus];
-        uint32_t iterPointsSize = nr_all_dpus << 1;
-        ELEMTYPE *iterPoints[iterPointsSize];
-        ADDRTYPE newLargeTreeIdSize = 0;
-        for (ADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {
-            ADDRTYPE max_dpus = nr_all_dpus;
-            DPU_ASSERT(dpu_load_from_incbin(dpu_set, &dpu_binary_TBP_accumulator, NULL));
-            // Send data to DPUs
-            loadPointsIntoDPUsContext loadPointsIntoDPUsContext_ctx = { .pointAmt = treeSize[largeTreeIds[largeTreeId]], .points = points + treeLeftAddr[largeTreeIds[largeTreeId]], .dpu_offset = dpu_offset, .pointSizes = pointSizes, .dimAmt = dimAmt, .nr_ranks = nr_ranks };
-            {
-                uint64_t pointAmtPerDPU = ceil((double)loadPointsIntoDPUsContext_ctx.pointAmt / dpu_offset[nr_ranks]);
-                uint64_t pointCnt = 0;
-                for (ADDRTYPE nr_dpu = 0; nr_dpu < nr_all_dpus; ++nr_dpu) {
-                    pointSizes[nr_dpu] = min(loadPointsIntoDPUsContext_ctx.pointAmt - pointCnt, pointAmtPerDPU);
-                    pointCnt += pointSizes[nr_dpu];
-                    if (pointSizes[nr_dpu] < 1) {
-                        max_dpus = nr_dpu;
-                        break;
-                    }
-                }
-            }
+    // Split all large subtrees. Their parts stay in MRAM from one level to the next: only the parts that change DPUs, and those of subtrees that get small, go through the host
+    if (dpuTree) {  // Resident for the whole tree building phase. Each launch runs the command set before it
+        DPU_ASSERT(dpu_load_from_incbin(dpu_set, &dpu_binary_TBP, NULL));
+        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dimAmt), 0, &dimAmt, sizeof(uint32_t), DPU_XFER_ASYNC));
+    }
+    tbpSegment_t *segments = calloc(nr_all_dpus * TBP_MAX_SEGMENTS, sizeof(tbpSegment_t));
+    uint32_t *segmentAmts = calloc(nr_all_dpus, sizeof(uint32_t));
+    tbpPlan_t plan = { .segments = calloc(nr_all_dpus * TBP_MAX_SEGMENTS, sizeof(tbpSegment_t)), .segmentAmts = calloc(nr_all_dpus, sizeof(uint32_t)), .segmentMasks = calloc(nr_all_dpus, sizeof(uint32_t)), .fromDPUs = { .dpuOffsets = malloc(sizeof(GADDRTYPE) * (nr_all_dpus + 1)) }, .toDPUs = { .dpuOffsets = malloc(sizeof(GADDRTYPE) * (nr_all_dpus + 1)) } };
+    plan.dpuPointCapacity = min(TBP_POINT_MEM_SIZE / (sizeof(ELEMTYPE) * dimAmt), TBP_POINT_ID_MEM_SIZE / sizeof(POINTIDTYPE) - 1);  // One id is kept for the rounding of transfers
+    tbpMoveRound_t moveRound = { .moves = malloc(sizeof(tbpMove_t) * nr_all_dpus * TBP_MAX_MOVES), .hostAddrs = malloc(sizeof(GADDRTYPE) * nr_all_dpus * TBP_MAX_MOVES), .moveAmts = malloc(sizeof(uint32_t) * nr_all_dpus), .stagedSizes = malloc(sizeof(ADDRTYPE) * nr_all_dpus), .transferCursors = malloc(sizeof(GADDRTYPE) * nr_all_dpus), .pointCursors = malloc(sizeof(ADDRTYPE) * nr_all_dpus) };
+    moveRound.stageCapacity = min(TBP_STAGE_MEM_SIZE / (sizeof(ELEMTYPE) * dimAmt), TBP_STAGE_ID_MEM_SIZE / sizeof(POINTIDTYPE) - 1);  // One id is kept for the rounding of transfers
+    if (moveRound.stageCapacity < 1) {
+        printf("A point of %u dimensions does not fit into the stage of a DPU! Exit now!\n", dimAmt);
+        exit(-1);
+    }
+    SUM_VALUE_TYPE *sums = malloc(sizeof(SUM_VALUE_TYPE) * nr_all_dpus * TBP_MAX_SEGMENTS);
+    ADDRTYPE *splits = malloc(sizeof(ADDRTYPE) * nr_all_dpus * TBP_MAX_SEGMENTS);
+    GADDRTYPE largeTreeIdCapacity = (pointAmt * dimAmt * sizeof(treeNode_t) / LARGE_TREE_THRESHOLD << 1) + 1;
+    ADDRTYPE *largeTreeDPUBegins = malloc(sizeof(ADDRTYPE) * largeTreeIdCapacity);  // Each large subtree has a part on each DPU of [largeTreeDPUBegins[id], largeTreeDPUEnds[id]), in the same segment of all of them
+    ADDRTYPE *largeTreeDPUEnds = malloc(sizeof(ADDRTYPE) * largeTreeIdCapacity);
+    uint32_t *largeTreeSegmentIds = malloc(sizeof(uint32_t) * largeTreeIdCapacity);
+    GADDRTYPE *largeChildIds = malloc(sizeof(GADDRTYPE) * largeTreeIdCapacity);  // Entries of the large children of each large subtree of a level, or 0
+    // With `-T auto`, levels are split on the host first while they are expected to be faster there, or while their subtrees do not fit into DPUs. The host is measured by a probe before its first level, then by each level
+    ELEMTYPE *scratchPoints = NULL;
+    POINTIDTYPE *scratchIds = NULL;
+    double hostBandwidth = 0;  // Unit: byte/s
+    uint32_t hostLevelAmt = 0;
+    if (tbpEngine == TBP_ENGINE_AUTO && largeTreeIdSize > 0 && !outOfCore) {  // Out of core, the points are never resident on the host
+        scratchPoints = malloc(sizeof(ELEMTYPE) * pointAmt * dimAmt), scratchIds = malloc(sizeof(POINTIDTYPE) * pointAmt);
+        if (scratchPoints == NULL || scratchIds == NULL) {  // Levels split in place are left to DPUs
+            free(scratchPoints), free(scratchIds);
+            scratchPoints = NULL, scratchIds = NULL;
+        } else {
+            hostBandwidth = measureHostBandwidth((uint8_t *)scratchPoints, min(TBP_PROBE_BYTES, sizeof(ELEMTYPE) * pointAmt * dimAmt));
+        }
+    }
+    while (scratchPoints != NULL && largeTreeIdSize > 0 && (getTopTreeDPUMin(treeSize, largeTreeIds, largeTreeIdSize, plan.dpuPointCapacity) > nr_all_dpus || isHostLevelFaster(treeSize, largeTreeIds, largeTreeIdSize, dimAmt, nr_all_dpus, hostBandwidth))) {
+        if (pendingReader != NULL) {  // Levels on the host need all points
+            stopPointsReader(pendingReader);
+            pendingReader = NULL;
+        }
+        struct timeval levelTimecheck;
+        gettimeofday(&levelTimecheck, NULL);
+        long levelStart = (long)levelTimecheck.tv_sec * 1e6 + (long)levelTimecheck.tv_usec;
+        GADDRTYPE newLargeTreeIdSize = 0, levelPointAmt = 0;
+        for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {  // Each subtree is split by all threads, and its children are added as on DPUs
+            GADDRTYPE treeId = largeTreeIds[largeTreeId];
             uint32_t dim = rand() % dimAmt;
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            hostExecTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dim), 0, &dim, sizeof(uint32_t), DPU_XFER_ASYNC));
-            DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dimAmt), 0, &dimAmt, sizeof(uint32_t), DPU_XFER_ASYNC));
-            DPU_ASSERT(dpu_callback(dpu_set, loadPointsIntoDPUs, &loadPointsIntoDPUsContext_ctx, DPU_CALLBACK_DEFAULT));
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            dataTransferhost2DPUTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            dpuExecTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-#ifdef PERF_EVAL_SIM
-            perfcounter_t perfs[nr_all_dpus];
-            uint32_t freqs[nr_all_dpus];
-            appendSumToDPUsContext appendSumToDPUsContext_ctx = { .sums = sums, .dpu_offset = dpu_offset, .perfs = perfs, .freqs = freqs };
-#else
-            appendSumToDPUsContext appendSumToDPUsContext_ctx = { .sums = sums, .dpu_offset = dpu_offset };
-#endif
-            DPU_ASSERT(dpu_callback(dpu_set, appendSumToDPUs, &appendSumToDPUsContext_ctx, DPU_CALLBACK_DEFAULT));
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            dataTransferDPU2hostTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            DPU_ASSERT(dpu_load_from_incbin(dpu_set, &dpu_binary_TBP_meanSpliter, NULL));
-            MEAN_VALUE_TYPE splitVal = 0;
-            for (ADDRTYPE nr_dpu = 0; nr_dpu < max_dpus; ++nr_dpu)
-                splitVal += sums[nr_dpu];
-            splitVal /= treeSize[largeTreeIds[largeTreeId]];
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            hostExecTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(mean), 0, &splitVal, sizeof(MEAN_VALUE_TYPE), DPU_XFER_ASYNC));
-            DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dim), 0, &dim, sizeof(uint32_t), DPU_XFER_ASYNC));
-            DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dimAmt), 0, &dimAmt, sizeof(uint32_t), DPU_XFER_ASYNC));
-            // It seems that DPUs would not preserve variables after loading new binary codes, so transfer the data again
-            DPU_ASSERT(dpu_callback(dpu_set, loadPointsIntoDPUs, &loadPointsIntoDPUsContext_ctx, DPU_CALLBACK_DEFAULT));
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            dataTransferhost2DPUTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            dpuExecTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            // Get responses and update largeTreeIds, tree, treeSize, largeTreeIdSize and newLargeTreeIdSize
-#ifdef PERF_EVAL_SIM
-            getResponseFromLargeTreesContext getResponseFromLargeTreesContext_ctx = { .pointSizes = pointSizes, .splits = splits, .iterPoints = iterPoints, .dpu_offset = dpu_offset, .dimAmt = dimAmt, .max_dpus = max_dpus, .perfs = perfs, .freqs = freqs };
-#else
-            getResponseFromLargeTreesContext getResponseFromLargeTreesContext_ctx = { .pointSizes = pointSizes, .splits = splits, .iterPoints = iterPoints, .dpu_offset = dpu_offset, .dimAmt = dimAmt, .max_dpus = max_dpus };
-#endif
-            DPU_ASSERT(dpu_callback(dpu_set, getResponseFromLargeTreesPart1, &getResponseFromLargeTreesContext_ctx, DPU_CALLBACK_DEFAULT));
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            dataTransferDPU2hostTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            {
-                iterPoints[0] = loadPointsIntoDPUsContext_ctx.points;
-                for (uint32_t iterPointsCnt = 1; iterPointsCnt < max_dpus; ++iterPointsCnt)
-                    iterPoints[iterPointsCnt] = iterPoints[iterPointsCnt - 1] + getResponseFromLargeTreesContext_ctx.splits[iterPointsCnt - 1] * dimAmt;
-                if (max_dpus > 1)
-                    iterPoints[max_dpus] = iterPoints[max_dpus - 1] + getResponseFromLargeTreesContext_ctx.splits[max_dpus - 1] * dimAmt;
-                for (uint32_t iterPointsCnt = max_dpus + 1, splitCnt = 0; iterPointsCnt < iterPointsSize; ++iterPointsCnt, ++splitCnt)
-                    iterPoints[iterPointsCnt] = iterPoints[iterPointsCnt - 1] + (getResponseFromLargeTreesContext_ctx.pointSizes[splitCnt] - getResponseFromLargeTreesContext_ctx.splits[splitCnt]) * dimAmt;
-            }
-            ADDRTYPE leftPointSize = (iterPoints[max_dpus] - loadPointsIntoDPUsContext_ctx.points) / dimAmt;
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            hostExecTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            DPU_ASSERT(dpu_callback(dpu_set, getResponseFromLargeTreesPart2, &getResponseFromLargeTreesContext_ctx, DPU_CALLBACK_DEFAULT));
-#ifdef PERF_EVAL
-            gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-            end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-            totalExecTime += end - start;
-            dataTransferDPU2hostTime += end - start;
-#ifdef ENERGY_EVAL
-            for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-                startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-            gettimeofday(&timecheck, NULL);
-            start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-            // Update tree data structures
-            tree[largeTreeIds[largeTreeId]].mean = splitVal, tree[largeTreeIds[largeTreeId]].dim = dim;
-            if (leftPointSize > 0) {
-                tree[largeTreeIds[largeTreeId]].left = treeIdSize;
-                tree[treeIdSize].left = tree[treeIdSize].right = (ADDRTYPE)(uint64_t)NULL;
-                treeLeftAddr[treeIdSize] = treeLeftAddr[largeTreeIds[largeTreeId]];
-                treeSize[treeIdSize] = leftPointSize;
+            MEAN_VALUE_TYPE mean;
+            GADDRTYPE childSizes[2];
+            childSizes[0] = splitNodeOnHost(points, pointIds, scratchPoints, scratchIds, treeLeftAddr[treeId], treeLeftAddr[treeId] + treeSize[treeId], dim, dimAmt, &mean) - treeLeftAddr[treeId];
+            childSizes[1] = treeSize[treeId] - childSizes[0];
+            levelPointAmt += treeSize[treeId];
+            tree[treeId].mean = mean, tree[treeId].dim = dim;
+            for (uint32_t side = 0; side < 2; ++side) {
+                if (childSizes[side] < 1)
+                    continue;
+                if (side > 0)
+                    tree[treeId].right = treeIdSize;
+                else
+                    tree[treeId].left = treeIdSize;
+                tree[treeIdSize].left = tree[treeIdSize].right = GADDRTYPE_NULL;
+                treeLeftAddr[treeIdSize] = treeLeftAddr[treeId] + (side > 0 ? childSizes[0] : 0);
+                treeSize[treeIdSize] = childSizes[side];
                 tree[treeIdSize].mean = treeLeftAddr[treeIdSize], tree[treeIdSize].dim = treeSize[treeIdSize];
-                if (leftPointSize * dimAmt * sizeof(treeNode_t) > LARGE_TREE_THRESHOLD)
-                    largeTreeIds[largeTreeIdSize + newLargeTreeIdSize++] = treeIdSize;
-                ++treeIdSize;
-            }
-            ADDRTYPE rightPointSize = treeSize[largeTreeIds[largeTreeId]] - leftPointSize;
-            if (rightPointSize > 0) {
-                tree[largeTreeIds[largeTreeId]].right = treeIdSize;
-                tree[treeIdSize].left = tree[treeIdSize].right = (ADDRTYPE)(uint64_t)NULL;
-                treeLeftAddr[treeIdSize] = treeLeftAddr[largeTreeIds[largeTreeId]] + leftPointSize;
-                treeSize[treeIdSize] = rightPointSize;
-                tree[treeIdSize].mean = treeLeftAddr[treeIdSize], tree[treeIdSize].dim = treeSize[treeIdSize];
-                if (rightPointSize * dimAmt * sizeof(treeNode_t) > LARGE_TREE_THRESHOLD)
+                if (treeSize[treeIdSize] * dimAmt * sizeof(treeNode_t) > LARGE_TREE_THRESHOLD)
                     largeTreeIds[largeTreeIdSize + newLargeTreeIdSize++] = treeIdSize;
                 ++treeIdSize;
             }
         }
-        if (newLargeTreeIdSize > 0)
-            memmove(largeTreeIds, largeTreeIds + largeTreeIdSize, sizeof(ADDRTYPE) * newLargeTreeIdSize);
+        memmove(largeTreeIds, largeTreeIds + largeTreeIdSize, sizeof(GADDRTYPE) * newLargeTreeIdSize);
         largeTreeIdSize = newLargeTreeIdSize;
+        ++hostLevelAmt;
+        gettimeofday(&levelTimecheck, NULL);
+        hostBandwidth = 1e6 * TBP_HOST_LEVEL_PASSES * levelPointAmt * dimAmt * sizeof(ELEMTYPE) / ((long)levelTimecheck.tv_sec * 1e6 + (long)levelTimecheck.tv_usec - levelStart + 1);
     }
-    free(largeTreeIds);
-#ifdef PRINT_PERF_EACH_PHASE
-    gettimeofday(&timecheck, NULL);
-    end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-    printf("[Host]  Total time until top tree building phase completed: %.3lfs\n", (end - start) / 1e6);
+    free(scratchPoints);
+    free(scratchIds);
+    if (tbpEngine == TBP_ENGINE_AUTO)
+        printf("[Host]  %u levels of the top tree are split on the host, and the others on DPUs\n", hostLevelAmt);
+    if (largeTreeIdSize > 0) {  // Large subtrees are spread evenly over DPUs: the root over all of them, or the subtrees left by the levels on the host over shares of them
+        ADDRTYPE pointSizes[nr_all_dpus];
+        GADDRTYPE pointAddrs[nr_all_dpus];
+        if (!spreadTopTree(treeLeftAddr, treeSize, largeTreeIds, largeTreeIdSize, nr_all_dpus, plan.dpuPointCapacity, largeTreeDPUBegins, largeTreeDPUEnds, pointAddrs, pointSizes)) {
+            printf("The points do not fit into the MRAM of %u DPUs! Exit now!\n", nr_all_dpus);
+            exit(-1);
+        }
+        for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {
+            largeTreeSegmentIds[largeTreeId] = 0;
+            for (ADDRTYPE nr_dpu = largeTreeDPUBegins[largeTreeId]; nr_dpu < largeTreeDPUEnds[largeTreeId]; ++nr_dpu) {
+                segments[nr_dpu * TBP_MAX_SEGMENTS].pointBegin = 0, segments[nr_dpu * TBP_MAX_SEGMENTS].pointAmt = pointSizes[nr_dpu];
+                segmentAmts[nr_dpu] = 1;
+            }
+        }
+#ifdef PERF_EVAL
+        gettimeofday(&timecheck, NULL);
+#ifdef ENERGY_EVAL
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
+#endif
+        end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+        totalExecTime += end - start;
+        hostExecTime += end - start;
+#ifdef ENERGY_EVAL
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
 #endif
-    // Split all subtrees only on DPUs
-    ADDRTYPE *leafIds = malloc(MAX_TREE_SIZE * sizeof(ADDRTYPE));
-    ADDRTYPE leafIdSize = 0;
-    for (ADDRTYPE treeId = 0; treeId < treeIdSize; ++treeId)
-        if (tree[treeId].left == (ADDRTYPE)(uint64_t)NULL && tree[treeId].right == (ADDRTYPE)(uint64_t)NULL)
-            leafIds[leafIdSize++] = treeId;
-    ADDRTYPE largeLeafIdSize = leafIdSize;
-    DPU_ASSERT(dpu_sync(dpu_set));
-    for (ADDRTYPE TBPbatch = 0; TBPbatch < largeLeafIdSize; TBPbatch += nr_all_dpus) {
-        ADDRTYPE subtreeSizes[nr_all_dpus];
-        ADDRTYPE treeIdSizes[nr_all_dpus];
-        ADDRTYPE newLeafSizes[nr_all_dpus];
-        ADDRTYPE leafIdAddrs[nr_all_dpus];
-        treeIdSizes[0] = treeIdSize, leafIdAddrs[0] = leafIdSize;
-        ADDRTYPE max_dpus = min(largeLeafIdSize - TBPbatch, nr_all_dpus);
-        DPU_ASSERT(dpu_load_from_incbin(dpu_set, &dpu_binary_TBP, NULL));
+        gettimeofday(&timecheck, NULL);
+        start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
+        loadPointsIntoDPUsContext loadPointsIntoDPUsContext_ctx = { .pointAddrs = pointAddrs, .points = points, .pointIds = pointIds, .outOfCore = outOfCore ? &outOfCoreFiles : NULL, .pointsReader = pendingReader, .dpu_offset = dpu_offset, .pointSizes = pointSizes, .dimAmt = dimAmt };
+        DPU_ASSERT(dpu_callback(dpu_set, loadPointsIntoDPUs, &loadPointsIntoDPUsContext_ctx, DPU_CALLBACK_DEFAULT));  // The only upload of points in the top tree
+        if (pendingReader != NULL) {  // The root has been uploaded while it was read. The host ranges of points are used for staging from now on, so wait for the rest
+            stopPointsReader(pendingReader);
+            pendingReader = NULL;
+        }
+        if (outOfCore)
+            loadFromSpill(&outOfCoreFiles);  // Everything is on DPUs, and staged parts are written into the spill file
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -990,7 +1805,7 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
 #endif
         end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
         totalExecTime += end - start;
-        hostExecTime += end - start;
+        dataTransferhost2DPUTime += end - start;
 #ifdef ENERGY_EVAL
         for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
             startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
@@ -998,12 +1813,16 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        // Send data to DPUs. Note that redundant DPUs would be ignored
-        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dimAmt), 0, &dimAmt, sizeof(uint32_t), DPU_XFER_ASYNC));
-        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(leafCapacity), 0, &leafCapacity, sizeof(uint32_t), DPU_XFER_ASYNC));
-        loadLargeLeavesIntoDPUsContext loadLargeLeavesIntoDPUsContext_ctx = { .max_dpus = max_dpus, .points = points, .dpu_offset = dpu_offset, .treeLeftAddr = treeLeftAddr, .treeSize = treeSize, .leafIds = leafIds + TBPbatch, .dimAmt = dimAmt };
-        DPU_ASSERT(dpu_callback(dpu_set, loadLargeLeavesIntoDPUs, &loadLargeLeavesIntoDPUsContext_ctx, DPU_CALLBACK_DEFAULT));
-        // Execute on DPUs
+    }
+    while (largeTreeIdSize > 0) {
+        for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {
+            uint32_t dim = rand() % dimAmt;
+            for (ADDRTYPE nr_dpu = largeTreeDPUBegins[largeTreeId]; nr_dpu < largeTreeDPUEnds[largeTreeId]; ++nr_dpu)
+                segments[nr_dpu * TBP_MAX_SEGMENTS + largeTreeSegmentIds[largeTreeId]].dim = dim;
+        }
+        loadSegmentsIntoDPUsContext loadSegmentsIntoDPUsContext_ctx = { .segments = segments, .segmentAmts = segmentAmts, .dpu_offset = dpu_offset };
+        setTBPCommand(dpu_set, TBP_COMMAND_ACCUMULATE);
+        DPU_ASSERT(dpu_callback(dpu_set, loadSegmentsIntoDPUs, &loadSegmentsIntoDPUsContext_ctx, DPU_CALLBACK_DEFAULT));
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -1022,7 +1841,7 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));  // Can be replaced by `DPU_ASYNCHRONOUS`. Use `DPU_SYNCHRONOUS` here for measurement of actual DPU executing time. But it seems that the performance with both signs is similar
+        DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -1041,15 +1860,14 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        // Get responses and update tree and treeSize
 #ifdef PERF_EVAL_SIM
         perfcounter_t perfs[nr_all_dpus];
         uint32_t freqs[nr_all_dpus];
-        getResponseFromTreesContext getResponseFromTreesContext_ctx = { .max_dpus = max_dpus, .subtreeSizes = subtreeSizes, .treeIdSizes = treeIdSizes, .newLeafSizes = newLeafSizes, .leafIdAddrs = leafIdAddrs, .points = points, .dpu_offset = dpu_offset, .tree = tree, .treeLeftAddr = treeLeftAddr, .treeSize = treeSize, .leafIds = leafIds + TBPbatch, .dimAmt = dimAmt, .perfs = perfs, .freqs = freqs };
+        appendSumToDPUsContext appendSumToDPUsContext_ctx = { .sums = sums, .dpu_offset = dpu_offset, .perfs = perfs, .freqs = freqs };
 #else
-        getResponseFromTreesContext getResponseFromTreesContext_ctx = { .max_dpus = max_dpus, .subtreeSizes = subtreeSizes, .treeIdSizes = treeIdSizes, .newLeafSizes = newLeafSizes, .leafIdAddrs = leafIdAddrs, .points = points, .dpu_offset = dpu_offset, .tree = tree, .treeLeftAddr = treeLeftAddr, .treeSize = treeSize, .leafIds = leafIds + TBPbatch, .dimAmt = dimAmt };
+        appendSumToDPUsContext appendSumToDPUsContext_ctx = { .sums = sums, .dpu_offset = dpu_offset };
 #endif
-        DPU_ASSERT(dpu_callback(dpu_set, getResponseFromTreesPart1, &getResponseFromTreesContext_ctx, DPU_CALLBACK_DEFAULT));
+        DPU_ASSERT(dpu_callback(dpu_set, appendSumToDPUs, &appendSumToDPUsContext_ctx, DPU_CALLBACK_DEFAULT));
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -1068,10 +1886,14 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        --(subtreeSizes[0]);
-        for (uint32_t subtreeSizeCnt = 1; subtreeSizeCnt < max_dpus; ++subtreeSizeCnt) {
-            treeIdSizes[subtreeSizeCnt] = treeIdSizes[subtreeSizeCnt - 1] + subtreeSizes[subtreeSizeCnt - 1];
-            --(subtreeSizes[subtreeSizeCnt]);
+        for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {
+            uint32_t segmentId = largeTreeSegmentIds[largeTreeId];
+            SUM_VALUE_TYPE sum = 0;
+            for (ADDRTYPE nr_dpu = largeTreeDPUBegins[largeTreeId]; nr_dpu < largeTreeDPUEnds[largeTreeId]; ++nr_dpu)
+                sum += sums[nr_dpu * TBP_MAX_SEGMENTS + segmentId];
+            MEAN_VALUE_TYPE splitVal = sum / treeSize[largeTreeIds[largeTreeId]];
+            for (ADDRTYPE nr_dpu = largeTreeDPUBegins[largeTreeId]; nr_dpu < largeTreeDPUEnds[largeTreeId]; ++nr_dpu)
+                segments[nr_dpu * TBP_MAX_SEGMENTS + segmentId].mean = splitVal;
         }
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
@@ -1091,7 +1913,51 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        DPU_ASSERT(dpu_callback(dpu_set, getResponseFromTreesPart2, &getResponseFromTreesContext_ctx, DPU_CALLBACK_DEFAULT));
+        setTBPCommand(dpu_set, TBP_COMMAND_SPLIT);
+        DPU_ASSERT(dpu_callback(dpu_set, loadSegmentsIntoDPUs, &loadSegmentsIntoDPUsContext_ctx, DPU_CALLBACK_DEFAULT));
+#ifdef PERF_EVAL
+        gettimeofday(&timecheck, NULL);
+#ifdef ENERGY_EVAL
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
+#endif
+        end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+        totalExecTime += end - start;
+        dataTransferhost2DPUTime += end - start;
+#ifdef ENERGY_EVAL
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+#endif
+        gettimeofday(&timecheck, NULL);
+        start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
+        DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
+#ifdef PERF_EVAL
+        gettimeofday(&timecheck, NULL);
+#ifdef ENERGY_EVAL
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
+#endif
+        end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+        totalExecTime += end - start;
+        dpuExecTime += end - start;
+#ifdef ENERGY_EVAL
+        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+            startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+#endif
+        gettimeofday(&timecheck, NULL);
+        start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
+#ifdef PERF_EVAL_SIM
+        getResponseFromLargeTreesContext getResponseFromLargeTreesContext_ctx = { .splits = splits, .dpu_offset = dpu_offset, .perfs = perfs, .freqs = freqs };
+#else
+        getResponseFromLargeTreesContext getResponseFromLargeTreesContext_ctx = { .splits = splits, .dpu_offset = dpu_offset };
+#endif
+        DPU_ASSERT(dpu_callback(dpu_set, getResponseFromLargeTreesPart1, &getResponseFromLargeTreesContext_ctx, DPU_CALLBACK_DEFAULT));
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -1110,10 +1976,90 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        leafIdAddrs[0] -= TBPbatch;
-        for (uint32_t leafSizeCnt = 1; leafSizeCnt < max_dpus; ++leafSizeCnt) {
-            leafIdAddrs[leafSizeCnt] = leafIdAddrs[leafSizeCnt - 1] + newLeafSizes[leafSizeCnt - 1];
+        // Update tree data structures, and plan where the parts of children go: first keep all parts that stay, then move the others into the space left
+        memset(plan.segmentAmts, 0, sizeof(uint32_t) * nr_all_dpus);
+        memset(plan.segmentMasks, 0, sizeof(uint32_t) * nr_all_dpus);
+        plan.fromDPUs.transferAmt = plan.toDPUs.transferAmt = 0;
+        GADDRTYPE newLargeTreeIdSize = 0;
+        for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize; ++largeTreeId) {
+            GADDRTYPE treeId = largeTreeIds[largeTreeId];
+            ADDRTYPE dpuBegin = largeTreeDPUBegins[largeTreeId], dpuEnd = largeTreeDPUEnds[largeTreeId];
+            uint32_t segmentId = largeTreeSegmentIds[largeTreeId];
+            tbpSegment_t leftParts[dpuEnd - dpuBegin], rightParts[dpuEnd - dpuBegin];
+            getTopTreeChildParts(segments, splits, dpuBegin, dpuEnd, segmentId, false, leftParts);
+            getTopTreeChildParts(segments, splits, dpuBegin, dpuEnd, segmentId, true, rightParts);
+            GADDRTYPE leftPointSize = 0;
+            for (ADDRTYPE nr_dpu = dpuBegin; nr_dpu < dpuEnd; ++nr_dpu)
+                leftPointSize += leftParts[nr_dpu - dpuBegin].pointAmt;
+            GADDRTYPE rightPointSize = treeSize[treeId] - leftPointSize;
+            bool leftLarge = leftPointSize * dimAmt * sizeof(treeNode_t) > LARGE_TREE_THRESHOLD, rightLarge = rightPointSize * dimAmt * sizeof(treeNode_t) > LARGE_TREE_THRESHOLD;
+            ADDRTYPE leftDPUEnd = dpuEnd, rightDPUBegin = dpuBegin;  // A large child keeps all DPUs of its parent, unless both are large and there are DPUs to share: then each gets a share in proportion to its size
+            if (leftLarge && rightLarge && dpuEnd - dpuBegin > 1) {
+                ADDRTYPE leftDPUMin = (leftPointSize + plan.dpuPointCapacity - 1) / plan.dpuPointCapacity, rightDPUMin = (rightPointSize + plan.dpuPointCapacity - 1) / plan.dpuPointCapacity;  // Neither child may get fewer DPUs than it fills
+                if (leftDPUMin + rightDPUMin > dpuEnd - dpuBegin) {  // The parent nearly fills its DPUs, so its children share one of them
+                    leftDPUEnd = dpuBegin + leftDPUMin, rightDPUBegin = dpuEnd - rightDPUMin;
+                } else {
+                    ADDRTYPE dpuMid = dpuBegin + (ADDRTYPE)round((double)(dpuEnd - dpuBegin) * leftPointSize / treeSize[treeId]);
+                    dpuMid = dpuMid > dpuBegin + leftDPUMin ? dpuMid : dpuBegin + leftDPUMin;
+                    dpuMid = dpuMid < dpuEnd - rightDPUMin ? dpuMid : dpuEnd - rightDPUMin;
+                    leftDPUEnd = rightDPUBegin = dpuMid;
+                }
+            }
+            if (!leftLarge)
+                leftDPUEnd = dpuBegin;
+            if (!rightLarge)
+                rightDPUBegin = dpuEnd;
+            tree[treeId].mean = segments[dpuBegin * TBP_MAX_SEGMENTS + segmentId].mean, tree[treeId].dim = segments[dpuBegin * TBP_MAX_SEGMENTS + segmentId].dim;
+            largeChildIds[largeTreeId << 1] = largeChildIds[(largeTreeId << 1) + 1] = 0;
+            if (leftPointSize > 0) {
+                tree[treeId].left = treeIdSize;
+                tree[treeIdSize].left = tree[treeIdSize].right = GADDRTYPE_NULL;
+                treeLeftAddr[treeIdSize] = treeLeftAddr[treeId];
+                treeSize[treeIdSize] = leftPointSize;
+                tree[treeIdSize].mean = treeLeftAddr[treeIdSize], tree[treeIdSize].dim = treeSize[treeIdSize];
+                uint32_t childSegmentId = keepTopTreeChild(&plan, leftParts, dpuBegin, dpuEnd, dpuBegin, leftDPUEnd, treeLeftAddr[treeIdSize]);
+                if (leftLarge) {
+                    GADDRTYPE newLargeTreeId = largeTreeIdSize + newLargeTreeIdSize++;
+                    largeTreeIds[newLargeTreeId] = treeIdSize;
+                    largeTreeDPUBegins[newLargeTreeId] = dpuBegin, largeTreeDPUEnds[newLargeTreeId] = leftDPUEnd;
+                    largeTreeSegmentIds[newLargeTreeId] = childSegmentId;
+                    largeChildIds[largeTreeId << 1] = newLargeTreeId;
+                }
+                ++treeIdSize;
+            }
+            if (rightPointSize > 0) {
+                tree[treeId].right = treeIdSize;
+                tree[treeIdSize].left = tree[treeIdSize].right = GADDRTYPE_NULL;
+                treeLeftAddr[treeIdSize] = treeLeftAddr[treeId] + leftPointSize;
+                treeSize[treeIdSize] = rightPointSize;
+                tree[treeIdSize].mean = treeLeftAddr[treeIdSize], tree[treeIdSize].dim = treeSize[treeIdSize];
+                uint32_t childSegmentId = keepTopTreeChild(&plan, rightParts, dpuBegin, dpuEnd, rightDPUBegin, dpuEnd, treeLeftAddr[treeIdSize]);
+                if (rightLarge) {
+                    GADDRTYPE newLargeTreeId = largeTreeIdSize + newLargeTreeIdSize++;
+                    largeTreeIds[newLargeTreeId] = treeIdSize;
+                    largeTreeDPUBegins[newLargeTreeId] = rightDPUBegin, largeTreeDPUEnds[newLargeTreeId] = dpuEnd;
+                    largeTreeSegmentIds[newLargeTreeId] = childSegmentId;
+                    largeChildIds[(largeTreeId << 1) + 1] = newLargeTreeId;
+                }
+                ++treeIdSize;
+            }
         }
+        bool movedInPlace = true;
+        for (GADDRTYPE largeTreeId = 0; largeTreeId < largeTreeIdSize && movedInPlace; ++largeTreeId) {
+            ADDRTYPE dpuBegin = largeTreeDPUBegins[largeTreeId], dpuEnd = largeTreeDPUEnds[largeTreeId];
+            for (uint32_t side = 0; side < 2 && movedInPlace; ++side) {
+                GADDRTYPE childId = largeChildIds[(largeTreeId << 1) + side];
+                if (childId == 0 || (largeTreeDPUBegins[childId] == dpuBegin && largeTreeDPUEnds[childId] == dpuEnd))  // Small, or no part to move
+                    continue;
+                tbpSegment_t parts[dpuEnd - dpuBegin];
+                getTopTreeChildParts(segments, splits, dpuBegin, dpuEnd, largeTreeSegmentIds[largeTreeId], side > 0, parts);
+                movedInPlace = moveTopTreeChild(&plan, parts, dpuBegin, dpuEnd, largeTreeDPUBegins[childId], largeTreeDPUEnds[childId], largeTreeSegmentIds[childId], treeLeftAddr[largeTreeIds[childId]], treeSize[largeTreeIds[childId]]);
+            }
+        }
+        if (!movedInPlace)
+            repackTopTree(&plan, nr_all_dpus, segments, splits, treeLeftAddr, treeSize, largeTreeIds, largeTreeDPUBegins, largeTreeDPUEnds, largeTreeSegmentIds, largeTreeIdSize, newLargeTreeIdSize);
+        sortTBPTransfers(&plan.fromDPUs, nr_all_dpus);
+        sortTBPTransfers(&plan.toDPUs, nr_all_dpus);
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -1132,7 +2078,8 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        DPU_ASSERT(dpu_callback(dpu_set, getResponseFromTreesPart3, &getResponseFromTreesContext_ctx, DPU_CALLBACK_DEFAULT));
+        moveTopTreePartsContext moveTopTreePartsContext_ctx = { .moveRound = &moveRound, .points = points, .pointIds = pointIds, .outOfCore = outOfCore ? &outOfCoreFiles : NULL, .dpu_offset = dpu_offset, .dimAmt = dimAmt };
+        moveTopTreeParts(dpu_set, &moveTopTreePartsContext_ctx, &plan.fromDPUs, true, nr_all_dpus);
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -1151,7 +2098,7 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        treeIdSize = treeIdSizes[max_dpus - 1] + subtreeSizes[max_dpus - 1], leafIdSize = leafIdAddrs[max_dpus - 1] + TBPbatch + newLeafSizes[max_dpus - 1];  // leafIdAddrs[0] -= TBPbatch;
+        moveTopTreeParts(dpu_set, &moveTopTreePartsContext_ctx, &plan.toDPUs, false, nr_all_dpus);
 #ifdef PERF_EVAL
         gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -1162,7 +2109,7 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
 #endif
         end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
         totalExecTime += end - start;
-        hostExecTime += end - start;
+        dataTransferhost2DPUTime += end - start;
 #ifdef ENERGY_EVAL
         for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
             startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
@@ -1170,10 +2117,197 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
         gettimeofday(&timecheck, NULL);
         start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
+        {  // The plan becomes the segments of the next level
+            tbpSegment_t *swapSegments = segments;
+            segments = plan.segments, plan.segments = swapSegments;
+            uint32_t *swapSegmentAmts = segmentAmts;
+            segmentAmts = plan.segmentAmts, plan.segmentAmts = swapSegmentAmts;
+        }
+        if (newLargeTreeIdSize > 0) {
+            memmove(largeTreeIds, largeTreeIds + largeTreeIdSize, sizeof(GADDRTYPE) * newLargeTreeIdSize);
+            memmove(largeTreeDPUBegins, largeTreeDPUBegins + largeTreeIdSize, sizeof(ADDRTYPE) * newLargeTreeIdSize);
+            memmove(largeTreeDPUEnds, largeTreeDPUEnds + largeTreeIdSize, sizeof(ADDRTYPE) * newLargeTreeIdSize);
+            memmove(largeTreeSegmentIds, largeTreeSegmentIds + largeTreeIdSize, sizeof(uint32_t) * newLargeTreeIdSize);
+        }
+        largeTreeIdSize = newLargeTreeIdSize;
+    }
+    free(segments);
+    free(segmentAmts);
+    free(plan.segments);
+    free(plan.segmentAmts);
+    free(plan.segmentMasks);
+    free(plan.fromDPUs.transfers);
+    free(plan.fromDPUs.dpuOffsets);
+    free(plan.toDPUs.transfers);
+    free(plan.toDPUs.dpuOffsets);
+    free(moveRound.moves);
+    free(moveRound.hostAddrs);
+    free(moveRound.moveAmts);
+    free(moveRound.stagedSizes);
+    free(moveRound.transferCursors);
+    free(moveRound.pointCursors);
+    free(sums);
+    free(splits);
+    free(largeTreeDPUBegins);
+    free(largeTreeDPUEnds);
+    free(largeTreeSegmentIds);
+    free(largeChildIds);
+    if (pendingReader != NULL)  // The root is small, so it was never uploaded by slices
+        stopPointsReader(pendingReader);
+    free(largeTreeIds);
+#ifdef PRINT_PERF_EACH_PHASE
+    gettimeofday(&timecheck, NULL);
+    end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+    printf("[Host]  Total time until top tree building phase completed: %.3lfs\n", (end - start) / 1e6);
+#endif
+    // Split all subtrees only on DPUs
+    if (dpuTree) {
+        for (GADDRTYPE treeId = 0; treeId < treeIdSize; ++treeId)
+            if (tree[treeId].left == GADDRTYPE_NULL && tree[treeId].right == GADDRTYPE_NULL)
+                leafIds[leafIdSize++] = treeId;
+    }
+    GADDRTYPE largeLeafIdSize = dpuTree ? leafIdSize : 0;  // Leaves of a tree built on the host are final
+    if (dpuTree) {
+        DPU_ASSERT(dpu_sync(dpu_set));
+        setTBPCommand(dpu_set, TBP_COMMAND_BUILD);
+    }
+    if (largeLeafIdSize > 0) {  // Subtrees are built largest first, so the ranks drained last build the smallest subtrees instead of one large subtree holding all others
+        leafCost_t *leafCosts = malloc(sizeof(leafCost_t) * largeLeafIdSize);
+        for (GADDRTYPE leafId = 0; leafId < largeLeafIdSize; ++leafId)
+            leafCosts[leafId].cost = getSubtreeCost(treeSize[leafIds[leafId]], dimAmt), leafCosts[leafId].treeId = leafIds[leafId];
+        sortLeafIdsByCost(leafCosts, largeLeafIdSize, leafIds);
+        free(leafCosts);
+    }
+    // Each rank takes the next subtrees, one per DPU, as soon as its last ones are drained
+    GADDRTYPE *tbpBatchBegins = malloc(sizeof(GADDRTYPE) * (largeLeafIdSize + 1));  // Batch `batch` builds the subtrees of leafIds[tbpBatchBegins[batch], tbpBatchBegins[batch + 1])
+    loadLargeLeavesIntoDPUsContext *loadLargeLeavesIntoDPUsContexts = malloc(sizeof(loadLargeLeavesIntoDPUsContext) * (largeLeafIdSize + 1));  // Alive until all queued callbacks have run
+    getResponseFromTreesContext *getResponseFromTreesContexts = malloc(sizeof(getResponseFromTreesContext) * (largeLeafIdSize + 1));
+    rankDispatcher_t dispatcher;
+    tbpPipeline_t tbpPipeline = { .treeIdSize = treeIdSize, .leafIdSize = leafIdSize, .dispatcher = &dispatcher };
+    pthread_mutex_init(&tbpPipeline.mutex, NULL);
+    imbalance_t predictedTBPImbalance = { 0, 0 };
+#ifdef PERF_EVAL
+    tbpPipeline.rankLoadTimes = calloc(nr_ranks, sizeof(uint64_t)), tbpPipeline.rankResponseTimes = calloc(nr_ranks, sizeof(uint64_t));
+    perfcounter_t *dpuCycles = calloc(largeLeafIdSize + 1, sizeof(perfcounter_t));
+#endif
+#ifdef PERF_EVAL_SIM
+    perfcounter_t perfs[nr_all_dpus];
+    uint32_t freqs[nr_all_dpus];
+#endif
+    if (dpuTree) {
+        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dimAmt), 0, &dimAmt, sizeof(uint32_t), DPU_XFER_DEFAULT));
+        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(leafCapacity), 0, &leafCapacity, sizeof(uint32_t), DPU_XFER_DEFAULT));
+    }
+#ifdef PERF_EVAL
+    gettimeofday(&timecheck, NULL);
+#ifdef ENERGY_EVAL
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
+#endif
+    end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+    totalExecTime += end - start;
+    hostExecTime += end - start;
+#ifdef ENERGY_EVAL
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+#endif
+    gettimeofday(&timecheck, NULL);
+    start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
+    startRankDispatcher(&dispatcher, nr_ranks);
+    GADDRTYPE tbpBatchAmt = 0;
+    for (GADDRTYPE TBPbatch = 0; TBPbatch < largeLeafIdSize; ++tbpBatchAmt) {
+        uint32_t nr_rank = waitIdleRank(&dispatcher);
+        ADDRTYPE dpuBegin = dpu_offset[nr_rank], dpuEnd = dpu_offset[nr_rank + 1];
+        ADDRTYPE max_dpus = min(largeLeafIdSize - TBPbatch, dpuEnd - dpuBegin);
+        double dpuLoads[max_dpus];
+        for (ADDRTYPE nr_dpu = 0; nr_dpu < max_dpus; ++nr_dpu)
+            dpuLoads[nr_dpu] = getSubtreeCost(treeSize[leafIds[TBPbatch + nr_dpu]], dimAmt);
+        addImbalance(&predictedTBPImbalance, dpuLoads, max_dpus);
+        tbpBatchBegins[tbpBatchAmt] = TBPbatch;
+        loadLargeLeavesIntoDPUsContexts[tbpBatchAmt] = (loadLargeLeavesIntoDPUsContext){ .max_dpus = max_dpus, .nr_rank = nr_rank, .points = points, .pointIds = pointIds, .outOfCore = outOfCore ? &outOfCoreFiles : NULL, .treeLeftAddr = treeLeftAddr, .treeSize = treeSize, .leafIds = leafIds + TBPbatch, .pointAmt = pointAmt, .dimAmt = dimAmt, .pipeline = &tbpPipeline };
+#ifdef PERF_EVAL_SIM
+        getResponseFromTreesContexts[tbpBatchAmt] = (getResponseFromTreesContext){ .max_dpus = max_dpus, .nr_rank = nr_rank, .subtreeBegin = TBPbatch, .points = points, .pointIds = pointIds, .outOfCore = outOfCore ? &outOfCoreFiles : NULL, .dpu_offset = dpu_offset, .tree = tree, .treeLeftAddr = treeLeftAddr, .treeSize = treeSize, .leafIds = leafIds, .dimAmt = dimAmt, .pipeline = &tbpPipeline, .perfs = perfs, .freqs = freqs };
+#else
+        getResponseFromTreesContexts[tbpBatchAmt] = (getResponseFromTreesContext){ .max_dpus = max_dpus, .nr_rank = nr_rank, .subtreeBegin = TBPbatch, .points = points, .pointIds = pointIds, .outOfCore = outOfCore ? &outOfCoreFiles : NULL, .dpu_offset = dpu_offset, .tree = tree, .treeLeftAddr = treeLeftAddr, .treeSize = treeSize, .leafIds = leafIds, .dimAmt = dimAmt, .pipeline = &tbpPipeline };
+#endif
+#ifdef PERF_EVAL
+        getResponseFromTreesContexts[tbpBatchAmt].dpuCycles = dpuCycles + TBPbatch;
+#endif
+        DPU_ASSERT(dpu_callback(ranks[nr_rank], loadLargeLeavesIntoDPUs, &loadLargeLeavesIntoDPUsContexts[tbpBatchAmt], DPU_CALLBACK_ASYNC));
+        DPU_ASSERT(dpu_launch(ranks[nr_rank], DPU_ASYNCHRONOUS));
+        DPU_ASSERT(dpu_callback(ranks[nr_rank], getResponseFromTrees, &getResponseFromTreesContexts[tbpBatchAmt], DPU_CALLBACK_ASYNC));  // Releases the rank once its subtrees are appended to the tree
+        TBPbatch += max_dpus;
+    }
+    tbpBatchBegins[tbpBatchAmt] = largeLeafIdSize;
+    if (dpuTree)
+        DPU_ASSERT(dpu_sync(dpu_set));
+    stopRankDispatcher(&dispatcher);
+    treeIdSize = tbpPipeline.treeIdSize, leafIdSize = tbpPipeline.leafIdSize;
+#ifdef PERF_EVAL
+    gettimeofday(&timecheck, NULL);
+#ifdef ENERGY_EVAL
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
+#endif
+    end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+    totalExecTime += end - start;
+    dpuExecTime += end - start;  // Transfers are overlapped with DPU execution, so the time of the callbacks on each rank is only added to the time of transfers on average
+    for (uint32_t nr_rank = 0; nr_rank < nr_ranks; ++nr_rank)
+        dataTransferhost2DPUTime += tbpPipeline.rankLoadTimes[nr_rank] / nr_ranks, dataTransferDPU2hostTime += tbpPipeline.rankResponseTimes[nr_rank] / nr_ranks;
+#ifdef ENERGY_EVAL
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+#endif
+    gettimeofday(&timecheck, NULL);
+    start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#endif
+    pthread_mutex_destroy(&tbpPipeline.mutex);
+    free(loadLargeLeavesIntoDPUsContexts);
+    free(getResponseFromTreesContexts);
+    if (outOfCore)
+        loadFromSpill(&outOfCoreFiles);  // Leaves of the top tree are disjoint, so each one was read once and all of them have been spilled now
+#ifdef PERF_EVAL
+    imbalance_t achievedTBPImbalance = { 0, 0 };
+    for (GADDRTYPE batch = 0; batch < tbpBatchAmt; ++batch) {
+        ADDRTYPE max_dpus = tbpBatchBegins[batch + 1] - tbpBatchBegins[batch];
+        double dpuLoads[max_dpus];
+        for (ADDRTYPE nr_dpu = 0; nr_dpu < max_dpus; ++nr_dpu)
+            dpuLoads[nr_dpu] = dpuCycles[tbpBatchBegins[batch] + nr_dpu];
+        addImbalance(&achievedTBPImbalance, dpuLoads, max_dpus);
     }
-    DPU_ASSERT(dpu_sync(dpu_set));
-    memmove(leafIds, leafIds + largeLeafIdSize, sizeof(ADDRTYPE) * (leafIdSize - largeLeafIdSize));
+    if (largeLeafIdSize > 0)
+        printf("[Host]  Imbalance of subtrees over DPUs: predicted %.3lf, achieved %.3lf\n", getImbalance(&predictedTBPImbalance), getImbalance(&achievedTBPImbalance));
+    free(dpuCycles);
+    free(tbpPipeline.rankLoadTimes);
+    free(tbpPipeline.rankResponseTimes);
+#else
+    if (largeLeafIdSize > 0)
+        printf("[Host]  Imbalance of subtrees over DPUs: predicted %.3lf\n", getImbalance(&predictedTBPImbalance));
+#endif
+    free(tbpBatchBegins);
+    memmove(leafIds, leafIds + largeLeafIdSize, sizeof(GADDRTYPE) * (leafIdSize - largeLeafIdSize));
     leafIdSize -= largeLeafIdSize;
+    leafQueue_t leafQueue;
+    startLeafQueue(&leafQueue);
+    pthread_t treeBuilder;
+    buildTreeContext buildTreeCtx = { .tree = tree, .treeIdSize = &treeIdSize, .points = points, .pointIds = pointIds, .pointAmt = pointAmt, .dimAmt = dimAmt, .leafCapacity = leafCapacity, .leafIds = leafIds, .leafIdSize = &leafIdSize, .leafQueue = &leafQueue };
+    if (streamLeaves) {  // Leaves go to DPUs while the rest of the tree is built. Nothing else writes the tree from here on
+        if (pthread_create(&treeBuilder, NULL, buildTree, &buildTreeCtx) != 0) {
+            printf("Failed to create the tree builder! Exit now!\n");
+            exit(-1);
+        }
+    } else if (!resume) {  // Leaves are packed into DPUs largest first, i.e. in LPT order. The order is checkpointed with the leaves, so a resumed build packs them the same way
+        leafCost_t *leafCosts = malloc(sizeof(leafCost_t) * leafIdSize);
+        for (GADDRTYPE leafId = 0; leafId < leafIdSize; ++leafId)
+            leafCosts[leafId].cost = getGraphCost(tree[leafIds[leafId]].dim, dimAmt), leafCosts[leafId].treeId = leafIds[leafId];
+        sortLeafIdsByCost(leafCosts, leafIdSize, leafIds);
+        free(leafCosts);
+    }
 #ifdef PRINT_PERF_EACH_PHASE
     gettimeofday(&timecheck, NULL);
     end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
@@ -1181,6 +2315,16 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
 #endif
     free(treeLeftAddr);
     free(treeSize);
+    if (checkpointPrefix != NULL && !resume) {  // The tree building phase is never repeated from here on
+        if (outOfCore)
+            fsync(outOfCoreFiles.spillFd);  // The spill file is the points file of the checkpoint
+        else
+            saveDataToFile(checkpointPointsFileName, points, sizeof(ELEMTYPE), pointAmt * dimAmt);
+        saveCheckpoint(checkpointPrefix, &pointsFile, leafCapacity, tree, treeIdSize, leafIds, leafIdSize, pointIds);
+        printf("[Host]  The tree building phase is checkpointed in %s%s and %s\n", checkpointPrefix, CHECKPOINT_TREE_SUFFIX, checkpointPointsFileName);
+    }
+    if (!streamLeaves)
+        pushLeaves(&leafQueue, leafIdSize, true);
 #ifdef PERF_EVAL
     gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
@@ -1205,100 +2349,280 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
     // 3. GBP
     // 4. Transfer results from DPU
     // printf("Graph building phase:\n");
-    pqueue_elem_t_mram *neighbors = malloc(pointAmt * neighborAmt * sizeof(pqueue_elem_t_mram));
-    for (ADDRTYPE GBPbatch = 0; GBPbatch < leafIdSize; GBPbatch += nr_all_dpus) {
-        ADDRTYPE max_dpus = min(leafIdSize - GBPbatch, nr_all_dpus);
-        DPU_ASSERT(dpu_load_from_incbin(dpu_set, &dpu_binary_GBP, NULL));
-#ifdef PERF_EVAL
-        gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-        end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-        totalExecTime += end - start;
-        hostExecTime += end - start;
-#ifdef ENERGY_EVAL
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-#endif
-        gettimeofday(&timecheck, NULL);
-        start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-#endif
-        // Send data to DPUs. Note that redundant DPUs would be ignored
-        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dimAmt), 0, &dimAmt, sizeof(uint32_t), DPU_XFER_ASYNC));
-        loadLeavesIntoDPUsContext loadLeavesIntoDPUsContext_ctx = { .max_dpus = max_dpus, .points = points, .dpu_offset = dpu_offset, .tree = tree, .leafIds = leafIds + GBPbatch, .dimAmt = dimAmt };
-        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(neighborAmt), 0, &neighborAmt, sizeof(uint32_t), DPU_XFER_ASYNC));
-        DPU_ASSERT(dpu_callback(dpu_set, loadLeavesIntoDPUs, &loadLeavesIntoDPUsContext_ctx, DPU_CALLBACK_DEFAULT));
-        // Execute on DPUs
+    // Results of each batch are written in the background while the next batch runs on DPUs
+    bundleWriter_t bundle;
+    int knnFd, leafFd;
+    uint64_t knnBase = 0, leafBase = 0;
+    if (bundleFileName != NULL) {  // The tree is final since the tree building phase, so all sections can be laid out now
+        startBundle(&bundle, bundleFileName, resume, &pointsFile, neighborAmt, leafCapacity, compactKnnBits, treeIdSize);
+        knnFd = leafFd = bundle.fd;
+        knnBase = bundle.header.sections[BUNDLE_SECTION_KNN].offset, leafBase = bundle.header.sections[BUNDLE_SECTION_PERM].offset;
+    } else {
+        knnFd = open(knnFileName, resume ? O_WRONLY | O_CREAT : O_WRONLY | O_CREAT | O_TRUNC, 0644);  // Results of the journaled batches are kept
+        leafFd = open(leafFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (knnFd < 0 || leafFd < 0) {
+            printf("Failed to open the output files: %s and %s! Exit now!\n", leafFileName, knnFileName);
+            exit(-1);
+        }
+    }
+    resultWriter_t writer;
+    startResultWriter(&writer, RESULT_WRITER_BUDGET);
+    if (!streamLeaves)
+        pushResult(&writer, leafFd, pointIds, sizeof(POINTIDTYPE) * pointAmt, leafBase, false);  // The permutation is final since the tree building phase
+    knnEncoder_t knnEncoder;
+    if (compactKnnBits >= 0)
+        startKnnEncoder(&knnEncoder, knnFd, knnBase, pointAmt, neighborAmt, compactKnnBits);
+    journal_t journal;
+    GADDRTYPE leafBegin = checkpointPrefix != NULL ? openJournal(&journal, checkpointPrefix, resume, compactKnnBits, neighborAmt, pointAmt, compactKnnBits >= 0 ? &knnEncoder : NULL) : 0;
+    if (leafBegin > 0)
+        printf("[Host]  The graph building phase resumes from leaf %lu of %lu\n", leafBegin, leafIdSize);
+    // Each rank takes the next leaves as soon as its last ones are drained, so fast ranks build more leaves and no rank waits for the slowest one. A batch is one launch of one rank: the rank uploads, computes and drains it in order, while the other ranks run their own
+    // With the host or hybrid engine, the host takes the slot after the ranks: it builds the leaves of a batch with all cores, as packed for HOST_GRAPH_BATCH_GROUPS DPUs
+    uint32_t slotAmt = gbpEngine != GBP_ENGINE_DPU ? nr_ranks + 1 : nr_ranks;
+    pthread_t hostWorker;
+    GADDRTYPE hostBatchAmt = 0;
+    double hostCost = 0, allCost = 0;
+    // Leaves are packed into the DPUs of a rank by their points and neighbors in MRAM, and by their costs. A batch takes half of the share of its slot in the points left, so batches shrink towards the end and all slots finish at once. Shares follow the rates measured on the last batches of the slots, so the host and DPUs split the leaves by how fast they build them
+    // Streamed leaves are taken as soon as they are final. A rank waits for more leaves until its batch is full or the tree is done
+    ADDRTYPE dpuPointCapacity = GBP_POINT_MEM_SIZE / (sizeof(ELEMTYPE) * dimAmt), dpuNeighborCapacity = GBP_NEIGHBOR_MEM_SIZE / (sizeof(pqueue_elem_t_mram) * neighborAmt);
+    dpuPointCapacity = min(dpuPointCapacity, dpuNeighborCapacity);
+    GADDRTYPE leafPointLeft = pointAmt;  // Leaves hold all points, so the points left are known before the tree is done
+    for (GADDRTYPE leafId = 0; leafId < leafBegin; ++leafId)
+        leafPointLeft -= tree[leafIds[leafId]].dim;
+    ADDRTYPE maxRankDPUAmt = gbpEngine != GBP_ENGINE_DPU ? HOST_GRAPH_BATCH_GROUPS : 0;
+    for (uint32_t nr_rank = 0; nr_rank < nr_ranks; ++nr_rank)
+        maxRankDPUAmt = dpu_offset[nr_rank + 1] - dpu_offset[nr_rank] > maxRankDPUAmt ? dpu_offset[nr_rank + 1] - dpu_offset[nr_rank] : maxRankDPUAmt;
+    GADDRTYPE batchCapacity = streamLeaves ? slotAmt : leafIdSize - leafBegin + 1;  // A batch holds one leaf at least, so batches only grow while leaves are streamed, i.e. without journal
+    gbpBatch_t **batches = malloc(sizeof(gbpBatch_t *) * batchCapacity);
+    double *dpuLoads = malloc(sizeof(double) * maxRankDPUAmt);
+    ADDRTYPE *dpuPointAmts = malloc(sizeof(ADDRTYPE) * maxRankDPUAmt), *dpuLeafAmts = malloc(sizeof(ADDRTYPE) * maxRankDPUAmt), *dpuHeap = malloc(sizeof(ADDRTYPE) * maxRankDPUAmt);
+    ADDRTYPE *leafDPUs = malloc(sizeof(ADDRTYPE) * maxRankDPUAmt * GBP_MAX_LEAVES);
+    GADDRTYPE *batchLeafIds = malloc(sizeof(GADDRTYPE) * maxRankDPUAmt * GBP_MAX_LEAVES);
+    leafCost_t *leafCosts = streamLeaves ? malloc(sizeof(leafCost_t) * maxRankDPUAmt * GBP_MAX_LEAVES) : NULL;
+    imbalance_t predictedGBPImbalance = { 0, 0 };
+    gbpPipeline_t pipeline = { .batchAmt = 0, .batchLeafBegins = malloc(sizeof(GADDRTYPE) * (batchCapacity + 1)), .ranksLeft = malloc(sizeof(uint32_t) * batchCapacity), .journaledBatchAmt = 0, .journal = checkpointPrefix != NULL ? &journal : NULL, .writer = &writer, .knnEncoder = compactKnnBits >= 0 ? &knnEncoder : NULL, .knnFd = knnFd, .knnBase = knnBase, .pointIds = pointIds, .tree = tree, .leafIds = leafIds, .neighborAmt = neighborAmt, .dispatcher = &dispatcher, .hostRank = nr_ranks, .slotAmt = slotAmt, .slotUnits = malloc(sizeof(double) * slotAmt), .slotRates = calloc(slotAmt, sizeof(double)), .blocks = checkpointPrefix != NULL && compactKnnBits >= 0 ? malloc(sizeof(knnBlock_t) * (leafIdSize - leafBegin)) : NULL };
+    pthread_mutex_init(&pipeline.mutex, NULL);
+    pipeline.batchLeafBegins[0] = leafBegin;
+    for (uint32_t slot = 0; slot < slotAmt; ++slot)
+        pipeline.slotUnits[slot] = slot == pipeline.hostRank ? HOST_GRAPH_BATCH_GROUPS : dpu_offset[slot + 1] - dpu_offset[slot];
 #ifdef PERF_EVAL
-        gettimeofday(&timecheck, NULL);
-#ifdef ENERGY_EVAL
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
-#endif
-        end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-        totalExecTime += end - start;
-        dataTransferhost2DPUTime += end - start;
-#ifdef ENERGY_EVAL
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+    pipeline.rankLoadTimes = calloc(nr_ranks, sizeof(uint64_t)), pipeline.rankResponseTimes = calloc(nr_ranks, sizeof(uint64_t));
 #endif
-        gettimeofday(&timecheck, NULL);
-        start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+#ifdef PERF_EVAL_SIM
+    perfcounter_t perfs[nr_all_dpus];
+    uint32_t freqs[nr_all_dpus];
 #endif
-        DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));  // Can be replaced by `DPU_ASYNCHRONOUS`. Use `DPU_SYNCHRONOUS` here for measurement of actual DPU executing time. But it seems that the performance with both signs is similar
+    if (nr_ranks > 0) {
+        DPU_ASSERT(dpu_load_from_incbin(dpu_set, &dpu_binary_GBP, NULL));  // Loaded once for all batches
+        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(dimAmt), 0, &dimAmt, sizeof(uint32_t), DPU_XFER_DEFAULT));
+        DPU_ASSERT(dpu_broadcast_to(dpu_set, STR(neighborAmt), 0, &neighborAmt, sizeof(uint32_t), DPU_XFER_DEFAULT));
+    }
 #ifdef PERF_EVAL
-        gettimeofday(&timecheck, NULL);
+    gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
 #endif
-        end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-        totalExecTime += end - start;
-        dpuExecTime += end - start;
+    end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+    totalExecTime += end - start;
+    hostExecTime += end - start;
 #ifdef ENERGY_EVAL
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
 #endif
-        gettimeofday(&timecheck, NULL);
-        start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+    gettimeofday(&timecheck, NULL);
+    start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
-        // Get responses and update tree and treeSize
+    startRankDispatcher(&dispatcher, slotAmt);
+    GADDRTYPE batchAmt = 0, packedDPUAmt = 0, readyLeafIdSize = leafBegin;  // Leaves leafIds[0, readyLeafIdSize) are final
+    bool leavesPending = true;
+    for (GADDRTYPE leafCursor = leafBegin;; ++batchAmt) {
+        uint32_t nr_rank = waitIdleRank(&dispatcher);
+        bool onHost = nr_rank == pipeline.hostRank;
+        ADDRTYPE dpuBegin = onHost ? 0 : dpu_offset[nr_rank], dpuEnd = onHost ? 0 : dpu_offset[nr_rank + 1], rankDPUAmt = onHost ? HOST_GRAPH_BATCH_GROUPS : dpuEnd - dpuBegin;
+        GADDRTYPE batchPointTarget = ceil(leafPointLeft * getSlotShare(&pipeline, nr_rank) / 2), batchPointAmt = 0, batchLeafEnd = leafCursor;
+        while (true) {
+            for (; batchLeafEnd < readyLeafIdSize && batchPointAmt < batchPointTarget && batchLeafEnd - leafCursor < (GADDRTYPE)rankDPUAmt * GBP_MAX_LEAVES; ++batchLeafEnd) {
+                if (tree[leafIds[batchLeafEnd]].dim > dpuPointCapacity) {
+                    printf("A leaf of %u points does not fit in a DPU of %u points! Exit now!\n", tree[leafIds[batchLeafEnd]].dim, dpuPointCapacity);
+                    exit(-1);
+                }
+                if (batchPointAmt + tree[leafIds[batchLeafEnd]].dim > (GADDRTYPE)dpuPointCapacity * rankDPUAmt)
+                    break;
+                batchPointAmt += tree[leafIds[batchLeafEnd]].dim;
+            }
+            if (batchLeafEnd < readyLeafIdSize || batchPointAmt >= batchPointTarget || batchLeafEnd - leafCursor >= (GADDRTYPE)rankDPUAmt * GBP_MAX_LEAVES || !leavesPending || (onHost && batchLeafEnd > leafCursor))  // The host has no launch to amortize, so it takes what is ready
+                break;
+            leavesPending = waitLeaves(&leafQueue, &readyLeafIdSize);
+        }
+        if (batchLeafEnd == leafCursor) {  // All leaves are dispatched
+            releaseRank(&dispatcher, nr_rank);
+            break;
+        }
+        if (streamLeaves) {  // Streamed leaves come in the order of the tree, so each batch is sorted on its own. Leaves of a whole tree are sorted already
+            for (GADDRTYPE leafId = leafCursor; leafId < batchLeafEnd; ++leafId)
+                leafCosts[leafId - leafCursor].cost = getGraphCost(tree[leafIds[leafId]].dim, dimAmt), leafCosts[leafId - leafCursor].treeId = leafIds[leafId];
+            sortLeafIdsByCost(leafCosts, batchLeafEnd - leafCursor, leafIds + leafCursor);
+        }
+        // LPT: leaves come largest first, and each one goes to the least loaded DPU. DPUs which cannot hold a leaf are left out of the batch, and the leaves after it go to the next batch once no DPU is left
+        ADDRTYPE heapSize = rankDPUAmt;
+        for (ADDRTYPE nr_dpu = 0; nr_dpu < rankDPUAmt; ++nr_dpu)
+            dpuLoads[nr_dpu] = 0, dpuPointAmts[nr_dpu] = dpuLeafAmts[nr_dpu] = 0, dpuHeap[nr_dpu] = nr_dpu;
+        GADDRTYPE leafId = leafCursor;
+        while (leafId < batchLeafEnd && heapSize > 0) {
+            ADDRTYPE nr_dpu = dpuHeap[0];
+            if (dpuLeafAmts[nr_dpu] >= GBP_MAX_LEAVES || dpuPointAmts[nr_dpu] + tree[leafIds[leafId]].dim > dpuPointCapacity) {
+                dpuHeap[0] = dpuHeap[--heapSize];
+                siftDownDPULoads(dpuHeap, heapSize, dpuLoads, 0);
+                continue;
+            }
+            leafDPUs[leafId - leafCursor] = nr_dpu;
+            dpuLoads[nr_dpu] += getGraphCost(tree[leafIds[leafId]].dim, dimAmt), dpuPointAmts[nr_dpu] += tree[leafIds[leafId]].dim, ++dpuLeafAmts[nr_dpu];
+            leafPointLeft -= tree[leafIds[leafId]].dim;
+            siftDownDPULoads(dpuHeap, heapSize, dpuLoads, 0);
+            ++leafId;
+        }
+        batchLeafEnd = leafId;
+        // Leaves of each DPU are gathered in leafIds. Batches keep their leaves, so journaled batches still hold a prefix of leafIds
+        gbpBatch_t *batch = malloc(sizeof(gbpBatch_t) + sizeof(GADDRTYPE) * (rankDPUAmt + 1));
+        GADDRTYPE batchLeafBegin = leafCursor;
+        ADDRTYPE max_dpus = 0;
+        for (ADDRTYPE nr_dpu = 0; nr_dpu < rankDPUAmt; ++nr_dpu) {
+            if (dpuLeafAmts[nr_dpu] < 1)
+                continue;
+            dpuLoads[max_dpus] = dpuLoads[nr_dpu];
+            batch->dpuLeafBegins[max_dpus] = leafCursor;
+            dpuPointAmts[nr_dpu] = max_dpus++;  // From now on, the position of the DPU in the batch
+            leafCursor += dpuLeafAmts[nr_dpu], dpuLeafAmts[nr_dpu] = 0;
+        }
+        batch->dpuLeafBegins[max_dpus] = leafCursor;
+        packedDPUAmt += max_dpus;
+        for (leafId = batchLeafBegin; leafId < batchLeafEnd; ++leafId) {
+            ADDRTYPE nr_dpu = leafDPUs[leafId - batchLeafBegin];
+            batchLeafIds[batch->dpuLeafBegins[dpuPointAmts[nr_dpu]] - batchLeafBegin + dpuLeafAmts[nr_dpu]++] = leafIds[leafId];
+        }
+        memcpy(leafIds + batchLeafBegin, batchLeafIds, sizeof(GADDRTYPE) * (batchLeafEnd - batchLeafBegin));
+        addImbalance(&predictedGBPImbalance, dpuLoads, max_dpus);
+        batch->loadContext = (loadLeavesIntoDPUsContext){ .max_dpus = max_dpus, .nr_rank = nr_rank, .points = points, .outOfCore = outOfCore ? &outOfCoreFiles : NULL, .tree = tree, .leafIds = leafIds, .dpuLeafBegins = batch->dpuLeafBegins, .pointAmt = pointAmt, .dimAmt = dimAmt, .pipeline = &pipeline };
 #ifdef PERF_EVAL_SIM
-        perfcounter_t perfs[nr_all_dpus];
-        uint32_t freqs[nr_all_dpus];
-        getResponseFromGraphsContext getResponseFromGraphsContext_ctx = { .max_dpus = max_dpus, .neighbors = neighbors, .dpu_offset = dpu_offset, .tree = tree, .leafIds = leafIds + GBPbatch, .neighborAmt = neighborAmt, .perfs = perfs, .freqs = freqs };
+        batch->responseContext = (getResponseFromGraphsContext){ .max_dpus = max_dpus, .nr_rank = nr_rank, .batch = batchAmt, .pipeline = &pipeline, .dpu_offset = dpu_offset, .dpuLeafBegins = batch->dpuLeafBegins, .perfs = perfs, .freqs = freqs };
 #else
-        getResponseFromGraphsContext getResponseFromGraphsContext_ctx = { .max_dpus = max_dpus, .neighbors = neighbors, .dpu_offset = dpu_offset, .tree = tree, .leafIds = leafIds + GBPbatch, .neighborAmt = neighborAmt };
+        batch->responseContext = (getResponseFromGraphsContext){ .max_dpus = max_dpus, .nr_rank = nr_rank, .batch = batchAmt, .pipeline = &pipeline, .dpu_offset = dpu_offset, .dpuLeafBegins = batch->dpuLeafBegins };
 #endif
-        DPU_ASSERT(dpu_callback(dpu_set, getResponseFromGraphs, &getResponseFromGraphsContext_ctx, DPU_CALLBACK_DEFAULT));
 #ifdef PERF_EVAL
-        gettimeofday(&timecheck, NULL);
+        batch->responseContext.dpuCycles = calloc(max_dpus, sizeof(perfcounter_t));
+#endif
+        for (ADDRTYPE nr_dpu = 0; nr_dpu < max_dpus; ++nr_dpu)
+            batch->responseContext.cost += dpuLoads[nr_dpu];
+        allCost += batch->responseContext.cost, hostCost += onHost ? batch->responseContext.cost : 0;
+        if (batchAmt == batchCapacity) {  // Callbacks only hold their own batch, so the arrays of all batches can move
+            batchCapacity <<= 1;
+            batches = realloc(batches, sizeof(gbpBatch_t *) * batchCapacity);
+            pthread_mutex_lock(&pipeline.mutex);
+            pipeline.batchLeafBegins = realloc(pipeline.batchLeafBegins, sizeof(GADDRTYPE) * (batchCapacity + 1)), pipeline.ranksLeft = realloc(pipeline.ranksLeft, sizeof(uint32_t) * batchCapacity);
+            pthread_mutex_unlock(&pipeline.mutex);
+        }
+        batches[batchAmt] = batch;
+        pthread_mutex_lock(&pipeline.mutex);
+        pipeline.batchLeafBegins[batchAmt + 1] = leafCursor, pipeline.ranksLeft[batchAmt] = 1, pipeline.batchAmt = batchAmt + 1;
+        pthread_mutex_unlock(&pipeline.mutex);
+        struct timeval dispatchTimecheck;
+        gettimeofday(&dispatchTimecheck, NULL);
+        batch->responseContext.dispatchTime = (long)dispatchTimecheck.tv_sec * 1e6 + (long)dispatchTimecheck.tv_usec;
+        if (onHost) {
+            if (hostBatchAmt++ > 0)  // The slot is idle, so the last host batch has returned
+                pthread_join(hostWorker, NULL);
+            if (pthread_create(&hostWorker, NULL, buildGraphsOnHost, batch) != 0) {
+                printf("Failed to create the host worker of the graph building phase! Exit now!\n");
+                exit(-1);
+            }
+            continue;
+        }
+        DPU_ASSERT(dpu_callback(ranks[nr_rank], loadLeavesIntoDPUs, &batch->loadContext, DPU_CALLBACK_ASYNC));  // DPUs of the rank left without leaves are launched with none. Padding read after the points of a DPU may be split by the tree builder meanwhile, but it is never used
+        DPU_ASSERT(dpu_launch(ranks[nr_rank], DPU_ASYNCHRONOUS));
+        DPU_ASSERT(dpu_callback(ranks[nr_rank], getResponseFromGraphs, &batch->responseContext, DPU_CALLBACK_ASYNC));  // Releases the rank once its results are drained
+    }
+    if (streamLeaves) {
+        pthread_join(treeBuilder, NULL);
+        pushResult(&writer, leafFd, pointIds, sizeof(POINTIDTYPE) * pointAmt, leafBase, false);  // The permutation is final once the tree is built
+#ifdef PERF_EVAL
+        TBPExecTime += buildTreeCtx.execTime, hostExecTime += buildTreeCtx.execTime;  // Overlapped with the graph building phase
+#endif
+    }
+    stopLeafQueue(&leafQueue);
+    if (nr_ranks > 0)
+        DPU_ASSERT(dpu_sync(dpu_set));
+    if (hostBatchAmt > 0)
+        pthread_join(hostWorker, NULL);
+    stopRankDispatcher(&dispatcher);
+    free(dpuLoads);
+    free(dpuPointAmts);
+    free(dpuLeafAmts);
+    free(dpuHeap);
+    free(leafDPUs);
+    free(batchLeafIds);
+    free(leafCosts);
+    printf("[Host]  %lu leaves are packed into %lu DPUs of %lu batches\n", leafIdSize - leafBegin, packedDPUAmt, batchAmt);
+    if (gbpEngine == GBP_ENGINE_HYBRID)
+        printf("[Host]  %.1lf%% of the cost of leaves is built on the host\n", allCost > 0 ? 100 * hostCost / allCost : 0);
+#ifndef PERF_EVAL
+    printf("[Host]  Imbalance of leaves over DPUs: predicted %.3lf\n", getImbalance(&predictedGBPImbalance));
+#endif
+#ifdef PERF_EVAL
+    gettimeofday(&timecheck, NULL);
 #ifdef ENERGY_EVAL
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        endEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        totalExecEnergy += (endEnergy[nr_socket] - startEnergy[nr_socket]) & MSR_ENERGY_MASK;
 #endif
-        end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
-        totalExecTime += end - start;
-        dataTransferDPU2hostTime += end - start;
+    end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+    totalExecTime += end - start;
+    dpuExecTime += end - start;  // Transfers are overlapped with DPU execution, so the time of the callbacks on each rank is only added to the time of transfers on average
+    for (uint32_t nr_rank = 0; nr_rank < nr_ranks; ++nr_rank)
+        dataTransferhost2DPUTime += pipeline.rankLoadTimes[nr_rank] / nr_ranks, dataTransferDPU2hostTime += pipeline.rankResponseTimes[nr_rank] / nr_ranks;
+    imbalance_t achievedGBPImbalance = { 0, 0 };
+    for (GADDRTYPE batch = 0; batch < batchAmt; ++batch) {
+        ADDRTYPE max_dpus = batches[batch]->loadContext.max_dpus;
+        double dpuLoads[max_dpus];
+        for (ADDRTYPE nr_dpu = 0; nr_dpu < max_dpus; ++nr_dpu)
+            dpuLoads[nr_dpu] = batches[batch]->responseContext.dpuCycles[nr_dpu];
+        addImbalance(&achievedGBPImbalance, dpuLoads, max_dpus);
+        free(batches[batch]->responseContext.dpuCycles);
+    }
+    printf("[Host]  Imbalance of leaves over DPUs: predicted %.3lf, achieved %.3lf\n", getImbalance(&predictedGBPImbalance), getImbalance(&achievedGBPImbalance));
 #ifdef ENERGY_EVAL
-        for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
-            startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
+    for (uint32_t nr_socket = 0; nr_socket < nr_sockets; ++nr_socket)
+        startEnergy[nr_socket] = getEnergy(evalCPUIds[nr_socket]);
 #endif
-        gettimeofday(&timecheck, NULL);
-        start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
+    gettimeofday(&timecheck, NULL);
+    start = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
 #endif
+    pthread_mutex_destroy(&pipeline.mutex);
+    free(pipeline.batchLeafBegins);
+    free(pipeline.slotUnits);
+    free(pipeline.slotRates);
+    free(pipeline.ranksLeft);
+    free(pipeline.blocks);
+#ifdef PERF_EVAL
+    free(pipeline.rankLoadTimes);
+    free(pipeline.rankResponseTimes);
+#endif
+    for (GADDRTYPE batch = 0; batch < batchAmt; ++batch)
+        free(batches[batch]);
+    free(batches);
+    stopResultWriter(&writer);  // Wait for the results of the last batches
+    if (checkpointPrefix != NULL)
+        closeJournal(&journal);
+    uint64_t knnBytes = compactKnnBits >= 0 ? finishKnnEncoder(&knnEncoder, pointIds) : sizeof(globalNeighbor_t) * pointAmt * neighborAmt;
+    if (bundleFileName == NULL) {
+        close(knnFd);
+        close(leafFd);
     }
-    DPU_ASSERT(dpu_sync(dpu_set));
+    if (outOfCore)
+        close(outOfCoreFiles.spillFd);
 #ifdef PRINT_PERF_EACH_PHASE
     gettimeofday(&timecheck, NULL);
     end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
@@ -1328,13 +2652,32 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
 
     // 5. Save results
     // printf("Result saving:\n");
-    saveDataToFile(treeFileName, tree, sizeof(treeNode_t), treeIdSize);
-    saveDataToFile(leafFileName, points, sizeof(ELEMTYPE), pointAmt * dimAmt);
-    saveDataToFile(knnFileName, neighbors, sizeof(pqueue_elem_t_mram), pointAmt * neighborAmt);
+    if (bundleFileName != NULL) {  // The quantization of points is kept in the header
+        finishBundle(&bundle, tree, knnBytes);
+        printf("[Host]  Results are saved in the bundle %s\n", bundleFileName);
+    } else {
+        saveDataToFile(treeFileName, tree, sizeof(globalTreeNode_t), treeIdSize);
+    }
+    if (outOfCore) {
+        for (uint32_t each_rank = 0; each_rank < nr_ranks; ++each_rank)
+            free(outOfCoreFiles.rankBuffers[each_rank]);
+        free(outOfCoreFiles.rankBuffers);
+        free(outOfCoreFiles.rankBufferBytes);
+    }
+    if (bundleFileName == NULL && (pointsFile.format == POINTS_FORMAT_FVECS || pointsFile.format == POINTS_FORMAT_FBIN)) {  // Distances are computed on quantized points: x = point / scale + offset
+        char quantFileName[strlen(leafFileName) + sizeof(".quant")];
+        sprintf(quantFileName, "%s.quant", leafFileName);
+        float quantParams[2] = { pointsFile.scale, pointsFile.offset };
+        saveDataToFile(quantFileName, quantParams, sizeof(float), 2);
+        printf("[Host]  Points are quantized with scale %f and offset %f, saved in %s\n", pointsFile.scale, pointsFile.offset, quantFileName);
+    }
 
-    free(neighbors);
     free(tree);
-    free(points);
+    if (pointsMappedBytes > 0)
+        unmapPoints(points, pointsMappedBytes);
+    else
+        free(points);
+    free(pointIds);
 #ifdef PRINT_PERF_EACH_PHASE
     gettimeofday(&timecheck, NULL);
     end = (long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec;
@@ -1345,36 +2688,51 @@ static void allocated_and_compute(struct dpu_set_t dpu_set, uint32_t nr_ranks, c
 
 int main(int argc, char **argv) {
     struct dpu_set_t dpu_set;
-    uint32_t nr_ranks;
+    uint32_t nr_ranks = 0;
 
-    uint32_t dimAmt = 128;
+    uint32_t dimAmt = 0;  // Read from the points file unless given
     uint32_t neighborAmt = 10;
     uint32_t leafCapacity = 1000;
     uint32_t nb_mram = DPU_ALLOCATE_ALL;
+    int32_t compactKnnBits = -1;  // Negative for the raw knn format
+    bool mmapPoints = false;
+    bool directIO = false;
+    bool resume = false;
+    bool outOfCore = false;
+    tbpEngine_t tbpEngine = TBP_ENGINE_DPU;
+    gbpEngine_t gbpEngine = GBP_ENGINE_DPU;
     char *pointsFileName = "points.bin";
+    char *pointsFormatName = NULL;
     char *treeFileName = "tree.bin";
     char *leafFileName = "leaf.bin";
     char *knnFileName = "knn.bin";
+    char *checkpointPrefix = NULL;
+    char *bundleFileName = NULL;
 #ifdef PERF_EVAL
     uint64_t frequency = 450 << 20;
-    parse_args(argc, argv, &dimAmt, &neighborAmt, &leafCapacity, &nb_mram, &frequency, &pointsFileName, &treeFileName, &leafFileName, &knnFileName);
+    parse_args(argc, argv, &dimAmt, &neighborAmt, &leafCapacity, &nb_mram, &compactKnnBits, &mmapPoints, &directIO, &outOfCore, &resume, &tbpEngine, &gbpEngine, &frequency, &pointsFileName, &pointsFormatName, &treeFileName, &leafFileName, &knnFileName, &checkpointPrefix, &bundleFileName);
 #else
-    parse_args(argc, argv, &dimAmt, &neighborAmt, &leafCapacity, &nb_mram, &pointsFileName, &treeFileName, &leafFileName, &knnFileName);
+    parse_args(argc, argv, &dimAmt, &neighborAmt, &leafCapacity, &nb_mram, &compactKnnBits, &mmapPoints, &directIO, &outOfCore, &resume, &tbpEngine, &gbpEngine, &pointsFileName, &pointsFormatName, &treeFileName, &leafFileName, &knnFileName, &checkpointPrefix, &bundleFileName);
 #endif
 
-    printf("Allocating DPUs\n");
-    DPU_ASSERT(dpu_alloc(nb_mram, "nrJobPerRank=64,dispatchOnAllRanks=true,cycleAccurate=true", &dpu_set));
-    printf("DPUs allocated\n");
-    DPU_ASSERT(dpu_get_nr_ranks(dpu_set, &nr_ranks));
-    printf("Using %u MRAMs already loaded\n", nb_mram);
+    memset(&dpu_set, 0, sizeof(dpu_set));
+    if (gbpEngine != GBP_ENGINE_HOST) {
+        printf("Allocating DPUs\n");
+        DPU_ASSERT(dpu_alloc(nb_mram, "nrJobPerRank=64,dispatchOnAllRanks=true,cycleAccurate=true", &dpu_set));
+        printf("DPUs allocated\n");
+        DPU_ASSERT(dpu_get_nr_ranks(dpu_set, &nr_ranks));
+        printf("Using %u MRAMs already loaded\n", nb_mram);
+    } else
+        printf("Building the graphs on the host, so no DPU is allocated\n");
 
 #ifdef PERF_EVAL
-    allocated_and_compute(dpu_set, nr_ranks, dimAmt, neighborAmt, leafCapacity, pointsFileName, treeFileName, leafFileName, knnFileName);
+    allocated_and_compute(dpu_set, nr_ranks, dimAmt, neighborAmt, leafCapacity, compactKnnBits, mmapPoints, directIO, outOfCore, resume, tbpEngine, gbpEngine, pointsFileName, pointsFormatName, treeFileName, leafFileName, knnFileName, checkpointPrefix, bundleFileName);
 #else
-    allocated_and_compute(dpu_set, nr_ranks, dimAmt, neighborAmt, leafCapacity, pointsFileName, treeFileName, leafFileName, knnFileName);
+    allocated_and_compute(dpu_set, nr_ranks, dimAmt, neighborAmt, leafCapacity, compactKnnBits, mmapPoints, directIO, outOfCore, resume, tbpEngine, gbpEngine, pointsFileName, pointsFormatName, treeFileName, leafFileName, knnFileName, checkpointPrefix, bundleFileName);
 #endif
 
-    DPU_ASSERT(dpu_free(dpu_set));
+    if (nr_ranks > 0)
+        DPU_ASSERT(dpu_free(dpu_set));
 
     return 0;
 }
@@ -0,0 +1,110 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Self-describing index bundle of GCiM: the tree, the permutation and the knn graph in one file with a versioned header.
+*/
+
+#include <stdio.h>  // printf
+#include <stdlib.h>  // malloc, exit
+#include <string.h>  // memcpy, memcmp
+#include <fcntl.h>  // open
+#include <unistd.h>  // close, dup, fsync
+#include <sys/mman.h>  // mmap
+#include <sys/stat.h>  // fstat
+#include "bundle.h"
+
+static uint64_t alignBundleOffset(const uint64_t offset) {
+    return (offset + BUNDLE_ALIGN - 1) / BUNDLE_ALIGN * BUNDLE_ALIGN;
+}
+
+void startBundle(bundleWriter_t *bundle, const char *const bundleFileName, const bool resume, const pointsFile_t *const pointsFile, const uint32_t neighborAmt, const uint32_t leafCapacity, const int32_t knnBits, const GADDRTYPE treeNodeAmt) {  // Lay out all sections. The knn section is the last one, since its size is only known at the end in the compact format
+    bundleHeader_t *header = &bundle->header;
+    memset(header, 0, sizeof(bundleHeader_t));
+    memcpy(header->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    header->version = BUNDLE_VERSION;
+    header->headerBytes = sizeof(bundleHeader_t);
+    header->dimAmt = pointsFile->dimAmt;
+    header->elemBytes = sizeof(ELEMTYPE);
+    header->elemSigned = (ELEMTYPE)-1 < (ELEMTYPE)0;
+    header->neighborAmt = neighborAmt;
+    header->leafCapacity = leafCapacity;
+    header->knnBits = knnBits;
+    header->pointIdBytes = sizeof(POINTIDTYPE);
+    header->treeNodeBytes = sizeof(globalTreeNode_t);
+    header->pointAmt = pointsFile->pointAmt;
+    header->treeNodeAmt = treeNodeAmt;
+    header->scale = pointsFile->scale, header->offset = pointsFile->offset;
+    bundleSectionEntry_t *sections = header->sections;
+    sections[BUNDLE_SECTION_PERM].offset = BUNDLE_ALIGN;
+    sections[BUNDLE_SECTION_PERM].bytes = sizeof(POINTIDTYPE) * header->pointAmt;
+    sections[BUNDLE_SECTION_TREE].offset = alignBundleOffset(sections[BUNDLE_SECTION_PERM].offset + sections[BUNDLE_SECTION_PERM].bytes);
+    sections[BUNDLE_SECTION_TREE].bytes = sizeof(globalTreeNode_t) * treeNodeAmt;
+    sections[BUNDLE_SECTION_KNN].offset = alignBundleOffset(sections[BUNDLE_SECTION_TREE].offset + sections[BUNDLE_SECTION_TREE].bytes);
+    bundle->fd = open(bundleFileName, resume ? O_RDWR | O_CREAT : O_RDWR | O_CREAT | O_TRUNC, 0644);  // The knn section of a resumed build is kept
+    if (bundle->fd < 0) {
+        printf("Failed to open the bundle: %s! Exit now!\n", bundleFileName);
+        exit(-1);
+    }
+    bundleHeader_t incomplete;
+    memset(&incomplete, 0, sizeof(bundleHeader_t));
+    writeDataAt(bundle->fd, &incomplete, sizeof(bundleHeader_t), 0);
+}
+
+void finishBundle(bundleWriter_t *bundle, const globalTreeNode_t *tree, const uint64_t knnBytes) {  // Call it once all results are written into the perm and knn sections
+    bundle->header.sections[BUNDLE_SECTION_KNN].bytes = knnBytes;
+    writeDataAt(bundle->fd, tree, bundle->header.sections[BUNDLE_SECTION_TREE].bytes, bundle->header.sections[BUNDLE_SECTION_TREE].offset);
+    fsync(bundle->fd);
+    writeDataAt(bundle->fd, &bundle->header, sizeof(bundleHeader_t), 0);
+    fsync(bundle->fd);
+    close(bundle->fd);
+}
+
+bundle_t *openBundle(const char *const bundleFileName) {  // Map the whole bundle read-only. Sections are used in place
+    int fd = open(bundleFileName, O_RDONLY);
+    struct stat bundleStat;
+    if (fd < 0 || fstat(fd, &bundleStat) != 0 || (size_t)bundleStat.st_size < BUNDLE_ALIGN) {
+        printf("Failed to open the bundle: %s! Exit now!\n", bundleFileName);
+        exit(-1);
+    }
+    bundle_t *bundle = malloc(sizeof(bundle_t));
+    bundle->fd = fd;
+    bundle->mappedBytes = bundleStat.st_size;
+    void *mapped = mmap(NULL, bundle->mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        printf("Failed to map the bundle: %s! Exit now!\n", bundleFileName);
+        exit(-1);
+    }
+    bundle->mapped = (const uint8_t *)mapped;
+    const bundleHeader_t *header = bundle->header = (const bundleHeader_t *)mapped;
+    if (memcmp(header->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0 || header->version != BUNDLE_VERSION || header->headerBytes != sizeof(bundleHeader_t)) {
+        printf("The file: %s is not a complete bundle of version %u! Exit now!\n", bundleFileName, BUNDLE_VERSION);
+        exit(-1);
+    }
+    if (header->elemBytes != sizeof(ELEMTYPE) || header->pointIdBytes != sizeof(POINTIDTYPE) || header->treeNodeBytes != sizeof(globalTreeNode_t)) {
+        printf("The bundle: %s was built with other types of points, ids or tree nodes! Exit now!\n", bundleFileName);
+        exit(-1);
+    }
+    for (uint32_t section = 0; section < BUNDLE_SECTION_AMOUNT; ++section)
+        if (header->sections[section].offset % BUNDLE_ALIGN != 0 || header->sections[section].offset + header->sections[section].bytes > bundle->mappedBytes) {
+            printf("The bundle: %s is truncated! Exit now!\n", bundleFileName);
+            exit(-1);
+        }
+    bundle->pointIds = (const POINTIDTYPE *)(bundle->mapped + header->sections[BUNDLE_SECTION_PERM].offset);
+    bundle->tree = (const globalTreeNode_t *)(bundle->mapped + header->sections[BUNDLE_SECTION_TREE].offset);
+    bundle->neighbors = header->knnBits < 0 ? (const globalNeighbor_t *)(bundle->mapped + header->sections[BUNDLE_SECTION_KNN].offset) : NULL;
+    return bundle;
+}
+
+knnGraph_t *openBundleKnnGraph(const bundle_t *bundle) {  // The decoder of the compact knn section, with a descriptor of its own
+    if (bundle->header->knnBits < 0) {
+        printf("The knn section of the bundle is in the raw format! Exit now!\n");
+        exit(-1);
+    }
+    return openKnnGraphAt(dup(bundle->fd), bundle->header->sections[BUNDLE_SECTION_KNN].offset, bundle->header->sections[BUNDLE_SECTION_KNN].bytes);
+}
+
+void closeBundle(bundle_t *bundle) {
+    munmap((void *)bundle->mapped, bundle->mappedBytes);
+    close(bundle->fd);
+    free(bundle);
+}
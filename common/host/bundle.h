@@ -0,0 +1,83 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Self-describing index bundle of GCiM: the tree, the permutation and the knn graph in one file with a versioned header.
+*/
+
+#ifndef GCIM_BUNDLE_H
+#define GCIM_BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "request.h"
+#include "dataIO.h"
+#include "knnCodec.h"
+
+/*
+Layout of a bundle, with every section starting at a multiple of BUNDLE_ALIGN so that it can be mapped and used in place:
+    bundleHeader_t, padded to BUNDLE_ALIGN
+    BUNDLE_SECTION_PERM  POINTIDTYPE[pointAmt], the original id of each row of the leaves, i.e. the leaf result
+    BUNDLE_SECTION_TREE  globalTreeNode_t[treeNodeAmt], the tree result
+    BUNDLE_SECTION_KNN   globalNeighbor_t[pointAmt][neighborAmt] by original id if knnBits < 0, otherwise the compact knn layout of knnCodec.h
+The header is written at last, so a bundle with a valid magic is complete.
+*/
+#define BUNDLE_MAGIC "GCIMIDX"
+#define BUNDLE_VERSION 2
+#define BUNDLE_ALIGN 4096
+
+typedef enum {
+    BUNDLE_SECTION_PERM,
+    BUNDLE_SECTION_TREE,
+    BUNDLE_SECTION_KNN,
+    BUNDLE_SECTION_AMOUNT
+} bundleSection_t;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t bytes;
+} bundleSectionEntry_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    uint32_t dimAmt;
+    uint32_t elemBytes;  // ELEMTYPE of the points the graph was built on
+    uint32_t elemSigned;
+    uint32_t neighborAmt;
+    uint32_t leafCapacity;
+    int32_t knnBits;  // Negative for the raw knn format, otherwise the bits of distances in the compact one
+    uint32_t pointIdBytes;  // Sizes of the records, checked by readers
+    uint32_t treeNodeBytes;
+    uint64_t pointAmt;
+    uint64_t treeNodeAmt;
+    float scale;  // Quantization of float inputs: point = (x - offset) * scale
+    float offset;
+    bundleSectionEntry_t sections[BUNDLE_SECTION_AMOUNT];
+} bundleHeader_t;
+
+typedef struct {
+    int fd;
+    bundleHeader_t header;
+} bundleWriter_t;
+
+typedef struct {
+    int fd;
+    const uint8_t *mapped;
+    size_t mappedBytes;
+    const bundleHeader_t *header;
+    const POINTIDTYPE *pointIds;
+    const globalTreeNode_t *tree;
+    const globalNeighbor_t *neighbors;  // NULL for the compact knn format. Use `openBundleKnnGraph` instead
+} bundle_t;
+
+// Writer
+void startBundle(bundleWriter_t *bundle, const char *const bundleFileName, const bool resume, const pointsFile_t *const pointsFile, const uint32_t neighborAmt, const uint32_t leafCapacity, const int32_t knnBits, const GADDRTYPE treeNodeAmt);
+void finishBundle(bundleWriter_t *bundle, const globalTreeNode_t *tree, const uint64_t knnBytes);
+// Reader
+bundle_t *openBundle(const char *const bundleFileName);
+knnGraph_t *openBundleKnnGraph(const bundle_t *bundle);
+void closeBundle(bundle_t *bundle);
+
+#endif
@@ -0,0 +1,143 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Checkpoints of the tree building phase and the journal of the graph building phase of GCiM, so that a failed build resumes instead of restarting.
+*/
+
+#define _GNU_SOURCE  // ftruncate, fsync
+#include <stdio.h>  // printf, rename
+#include <stdlib.h>  // malloc, exit
+#include <string.h>  // memcpy, memcmp
+#include <fcntl.h>  // open
+#include <unistd.h>  // close, ftruncate, fsync
+#include <sys/stat.h>  // fstat
+#include "checkpoint.h"
+
+static int openCheckpointFile(const char *const prefix, const char *const suffix, const int flags) {
+    char fileName[strlen(prefix) + strlen(suffix) + 1];
+    sprintf(fileName, "%s%s", prefix, suffix);
+    int fd = open(fileName, flags, 0644);
+    if (fd < 0) {
+        printf("Failed to open the checkpoint file: %s! Exit now!\n", fileName);
+        exit(-1);
+    }
+    return fd;
+}
+
+void saveCheckpoint(const char *const prefix, const pointsFile_t *const pointsFile, const uint32_t leafCapacity, const globalTreeNode_t *tree, const GADDRTYPE treeIdSize, const GADDRTYPE *leafIds, const GADDRTYPE leafIdSize, const POINTIDTYPE *pointIds) {  // Save the points file of the checkpoint before this. The tree file is renamed into place at last, so an existing one is always complete
+    checkpointHeader_t header;
+    memset(&header, 0, sizeof(checkpointHeader_t));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.dimAmt = pointsFile->dimAmt, header.leafCapacity = leafCapacity, header.pointsFormat = pointsFile->format;
+    header.pointAmt = pointsFile->pointAmt, header.treeIdSize = treeIdSize, header.leafIdSize = leafIdSize;
+    header.scale = pointsFile->scale, header.offset = pointsFile->offset;
+    int fd = openCheckpointFile(prefix, CHECKPOINT_TREE_SUFFIX ".tmp", O_WRONLY | O_CREAT | O_TRUNC);
+    uint64_t offset = 0;
+    writeDataAt(fd, &header, sizeof(checkpointHeader_t), offset);
+    writeDataAt(fd, tree, sizeof(globalTreeNode_t) * treeIdSize, offset += sizeof(checkpointHeader_t));
+    writeDataAt(fd, leafIds, sizeof(GADDRTYPE) * leafIdSize, offset += sizeof(globalTreeNode_t) * treeIdSize);
+    writeDataAt(fd, pointIds, sizeof(POINTIDTYPE) * header.pointAmt, offset += sizeof(GADDRTYPE) * leafIdSize);
+    fsync(fd);
+    close(fd);
+    char tmpFileName[strlen(prefix) + sizeof(CHECKPOINT_TREE_SUFFIX ".tmp")], fileName[strlen(prefix) + sizeof(CHECKPOINT_TREE_SUFFIX)];
+    sprintf(tmpFileName, "%s" CHECKPOINT_TREE_SUFFIX ".tmp", prefix);
+    sprintf(fileName, "%s" CHECKPOINT_TREE_SUFFIX, prefix);
+    if (rename(tmpFileName, fileName) != 0) {
+        printf("Failed to save the checkpoint file: %s! Exit now!\n", fileName);
+        exit(-1);
+    }
+}
+
+GADDRTYPE loadCheckpointHeader(const char *const prefix, checkpointHeader_t *header, pointsFile_t *pointsFile, const uint32_t dimAmt, const uint32_t leafCapacity) {  // Check that the checkpoint matches the options and return the amount of points. `pointsFile` describes the input as it was before the tree building phase
+    int fd = openCheckpointFile(prefix, CHECKPOINT_TREE_SUFFIX, O_RDONLY);
+    readDataAt(fd, header, sizeof(checkpointHeader_t), 0);
+    close(fd);
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || header->version != CHECKPOINT_VERSION) {
+        printf("The checkpoint %s%s is not a checkpoint of version %u! Exit now!\n", prefix, CHECKPOINT_TREE_SUFFIX, CHECKPOINT_VERSION);
+        exit(-1);
+    }
+    if (header->dimAmt != dimAmt || header->leafCapacity != leafCapacity) {
+        printf("The checkpoint %s%s was built with %u dimensions and leaves of %u points, but %u and %u are given! Exit now!\n", prefix, CHECKPOINT_TREE_SUFFIX, header->dimAmt, header->leafCapacity, dimAmt, leafCapacity);
+        exit(-1);
+    }
+    memset(pointsFile, 0, sizeof(pointsFile_t));
+    pointsFile->format = header->pointsFormat;
+    pointsFile->dimAmt = header->dimAmt;
+    pointsFile->pointAmt = header->pointAmt;
+    pointsFile->scale = header->scale, pointsFile->offset = header->offset;
+    return header->pointAmt;
+}
+
+uint32_t getCheckpointDimAmt(const char *const prefix) {
+    checkpointHeader_t header;
+    int fd = openCheckpointFile(prefix, CHECKPOINT_TREE_SUFFIX, O_RDONLY);
+    readDataAt(fd, &header, sizeof(checkpointHeader_t), 0);
+    close(fd);
+    return header.dimAmt;
+}
+
+void loadCheckpoint(const char *const prefix, const checkpointHeader_t *const header, globalTreeNode_t *tree, GADDRTYPE *leafIds, POINTIDTYPE *pointIds) {
+    int fd = openCheckpointFile(prefix, CHECKPOINT_TREE_SUFFIX, O_RDONLY);
+    uint64_t offset = sizeof(checkpointHeader_t);
+    readDataAt(fd, tree, sizeof(globalTreeNode_t) * header->treeIdSize, offset);
+    readDataAt(fd, leafIds, sizeof(GADDRTYPE) * header->leafIdSize, offset += sizeof(globalTreeNode_t) * header->treeIdSize);
+    readDataAt(fd, pointIds, sizeof(POINTIDTYPE) * header->pointAmt, offset += sizeof(GADDRTYPE) * header->leafIdSize);
+    close(fd);
+}
+
+GADDRTYPE openJournal(journal_t *journal, const char *const prefix, const bool resume, const int32_t compactKnnBits, const uint32_t neighborAmt, const GADDRTYPE pointAmt, knnEncoder_t *knnEncoder) {  // Return the amount of leaves whose results are complete, i.e. where the graph building phase goes on. Blocks of the compact knn result are restored into `knnEncoder`
+    journalHeader_t header;
+    memset(&header, 0, sizeof(journalHeader_t));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.compactKnnBits = compactKnnBits, header.neighborAmt = neighborAmt, header.pointAmt = pointAmt;
+    journal->fd = openCheckpointFile(prefix, CHECKPOINT_JOURNAL_SUFFIX, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC));
+    journal->tail = sizeof(journalHeader_t);
+    GADDRTYPE leafEnd = 0;
+    struct stat journalStat;
+    if (resume && fstat(journal->fd, &journalStat) == 0 && (uint64_t)journalStat.st_size >= sizeof(journalHeader_t)) {  // A journal without its header has no batch
+        journalHeader_t fileHeader;
+        readDataAt(journal->fd, &fileHeader, sizeof(journalHeader_t), 0);
+        if (memcmp(&fileHeader, &header, sizeof(journalHeader_t)) != 0) {
+            printf("The journal %s%s was written by a build with other options! Exit now!\n", prefix, CHECKPOINT_JOURNAL_SUFFIX);
+            exit(-1);
+        }
+        journalRecord_t record;
+        while (journal->tail + sizeof(journalRecord_t) <= (uint64_t)journalStat.st_size) {
+            readDataAt(journal->fd, &record, sizeof(journalRecord_t), journal->tail);
+            uint64_t recordBytes = sizeof(journalRecord_t) + sizeof(knnBlock_t) * record.blockAmt;
+            if (journal->tail + recordBytes > (uint64_t)journalStat.st_size)  // Torn by the failure
+                break;
+            if (record.blockAmt > 0) {
+                knnBlock_t *blocks = malloc(sizeof(knnBlock_t) * record.blockAmt);
+                readDataAt(journal->fd, blocks, sizeof(knnBlock_t) * record.blockAmt, journal->tail + sizeof(journalRecord_t));
+                restoreKnnBlocks(knnEncoder, blocks, record.blockAmt);
+                free(blocks);
+            }
+            leafEnd = record.leafEnd;
+            journal->tail += recordBytes;
+        }
+        if (ftruncate(journal->fd, journal->tail) != 0) {
+            printf("Failed to truncate the journal %s%s! Exit now!\n", prefix, CHECKPOINT_JOURNAL_SUFFIX);
+            exit(-1);
+        }
+    }
+    writeDataAt(journal->fd, &header, sizeof(journalHeader_t), 0);
+    return leafEnd;
+}
+
+void appendJournal(journal_t *journal, resultWriter_t *writer, const GADDRTYPE leafEnd, const knnBlock_t *blocks, const uint64_t blockAmt) {  // The writer writes jobs in order, so the record lands after all results of its batch pushed before it
+    size_t recordBytes = sizeof(journalRecord_t) + sizeof(knnBlock_t) * blockAmt;
+    uint8_t *record = malloc(recordBytes);
+    journalRecord_t recordHeader = { .leafEnd = leafEnd, .blockAmt = blockAmt };
+    memcpy(record, &recordHeader, sizeof(journalRecord_t));
+    if (blockAmt > 0)
+        memcpy(record + sizeof(journalRecord_t), blocks, sizeof(knnBlock_t) * blockAmt);
+    pushResult(writer, journal->fd, record, recordBytes, journal->tail, true);
+    journal->tail += recordBytes;
+}
+
+void closeJournal(journal_t *journal) {
+    close(journal->fd);
+}
@@ -0,0 +1,71 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Checkpoints of the tree building phase and the journal of the graph building phase of GCiM, so that a failed build resumes instead of restarting.
+*/
+
+#ifndef GCIM_CHECKPOINT_H
+#define GCIM_CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "request.h"
+#include "dataIO.h"
+#include "resultWriter.h"
+#include "knnCodec.h"
+
+/*
+Files of a checkpoint with prefix `p`:
+    p.tbp      checkpointHeader_t, then tree[treeIdSize], leafIds[leafIdSize] and pointIds[pointAmt]. Written once the tree building phase is done
+    p.points   the permuted points, i.e. the raw ELEMTYPE dump the leaves index
+    p.journal  journalHeader_t, then one record per completed batch of the graph building phase: journalRecord_t followed by the knnBlock_t of the batch (none for the raw knn format)
+*/
+#define CHECKPOINT_TREE_SUFFIX ".tbp"
+#define CHECKPOINT_POINTS_SUFFIX ".points"
+#define CHECKPOINT_JOURNAL_SUFFIX ".journal"
+#define CHECKPOINT_MAGIC "GCIMCKP"
+#define JOURNAL_MAGIC "GCIMJNL"
+#define CHECKPOINT_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t dimAmt;
+    uint32_t leafCapacity;
+    uint32_t pointsFormat;
+    uint64_t pointAmt;
+    uint64_t treeIdSize;
+    uint64_t leafIdSize;
+    float scale;  // Quantization of the input points, kept for the result
+    float offset;
+} checkpointHeader_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    int32_t compactKnnBits;  // The knn result must be continued in the same format
+    uint32_t neighborAmt;
+    uint32_t reserved;
+    uint64_t pointAmt;
+} journalHeader_t;
+
+typedef struct {
+    uint64_t leafEnd;  // Results of leafIds[0, leafEnd) are complete
+    uint64_t blockAmt;
+} journalRecord_t;
+
+typedef struct {
+    int fd;
+    uint64_t tail;
+} journal_t;
+
+void saveCheckpoint(const char *const prefix, const pointsFile_t *const pointsFile, const uint32_t leafCapacity, const globalTreeNode_t *tree, const GADDRTYPE treeIdSize, const GADDRTYPE *leafIds, const GADDRTYPE leafIdSize, const POINTIDTYPE *pointIds);
+GADDRTYPE loadCheckpointHeader(const char *const prefix, checkpointHeader_t *header, pointsFile_t *pointsFile, const uint32_t dimAmt, const uint32_t leafCapacity);
+uint32_t getCheckpointDimAmt(const char *const prefix);
+void loadCheckpoint(const char *const prefix, const checkpointHeader_t *const header, globalTreeNode_t *tree, GADDRTYPE *leafIds, POINTIDTYPE *pointIds);
+GADDRTYPE openJournal(journal_t *journal, const char *const prefix, const bool resume, const int32_t compactKnnBits, const uint32_t neighborAmt, const GADDRTYPE pointAmt, knnEncoder_t *knnEncoder);
+void appendJournal(journal_t *journal, resultWriter_t *writer, const GADDRTYPE leafEnd, const knnBlock_t *blocks, const uint64_t blockAmt);
+void closeJournal(journal_t *journal);
+
+#endif
@@ -0,0 +1,409 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Operations for loading input points and saving results of GCiM.
+*/
+
+#define _GNU_SOURCE  // MADV_HUGEPAGE, O_DIRECT
+#include <stdio.h>  // FILE
+#include <stdlib.h>  // exit
+#include <string.h>  // strcmp, strrchr
+#include <float.h>  // FLT_MAX
+#include <fcntl.h>  // open
+#include <unistd.h>  // close, pread, pwrite
+#include <sys/mman.h>  // mmap, madvise
+#include <sys/stat.h>  // fstat
+#include "dataIO.h"
+
+#define ELEMTYPE_MAX ((ELEMTYPE)~(ELEMTYPE)0)  // Assume that ELEMTYPE is unsigned, as the tree building phase does
+
+static const char *const pointsFormatNames[] = { "raw", "fvecs", "bvecs", "fbin", "u8bin" };
+
+pointsFormat_t getPointsFormat(const char *const pointsFileName, const char *const formatName) {  // Use the format given by `-f` if any, otherwise guess it from the extension of the points file
+    const char *name = formatName;
+    if (name == NULL) {
+        name = strrchr(pointsFileName, '.');
+        if (name == NULL || strchr(name, '/') != NULL)
+            return POINTS_FORMAT_RAW;
+        ++name;
+    }
+    for (uint32_t format = 0; format < sizeof(pointsFormatNames) / sizeof(pointsFormatNames[0]); ++format)
+        if (strcmp(name, pointsFormatNames[format]) == 0)
+            return (pointsFormat_t)format;
+    if (formatName != NULL) {
+        printf("Unknown format of the input point file: %s! Exit now!\n", formatName);
+        exit(-1);
+    }
+    return POINTS_FORMAT_RAW;  // Unknown extensions, e.g. `.bin`, are taken as raw dumps of ELEMTYPE
+}
+
+static const uint8_t *mapPointsFileReadOnly(const pointsFile_t *const pointsFile, size_t *mappedBytes) {
+    int fd = open(pointsFile->fileName, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open the input point file: %s! Exit now!\n", pointsFile->fileName);
+        exit(-1);
+    }
+    struct stat pointsFileStat;
+    fstat(fd, &pointsFileStat);
+    *mappedBytes = pointsFileStat.st_size;
+    void *mapped = mmap(NULL, *mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        printf("Failed to map the input point file: %s! Exit now!\n", pointsFile->fileName);
+        exit(-1);
+    }
+    madvise(mapped, *mappedBytes, MADV_WILLNEED);
+    return (const uint8_t *)mapped;
+}
+
+static bool isRowDimWrong(const pointsFile_t *const pointsFile, const uint8_t *row) {  // Each row of fvecs and bvecs repeats the dim of the first one. `row` points at the elements
+    uint32_t rowDimAmt;
+    if (pointsFile->rowHeaderBytes == 0)
+        return false;
+    memcpy(&rowDimAmt, row - pointsFile->rowHeaderBytes, sizeof(uint32_t));
+    return rowDimAmt != pointsFile->dimAmt;
+}
+
+static void checkWrongRows(const pointsFile_t *const pointsFile, const GADDRTYPE wrongRowAmt) {
+    if (wrongRowAmt > 0) {
+        printf("The input point file: %s has %lu rows whose dimension is not %u! Exit now!\n", pointsFile->fileName, (uint64_t)wrongRowAmt, pointsFile->dimAmt);
+        exit(-1);
+    }
+}
+
+static void getQuantizationRange(pointsFile_t *pointsFile) {  // One parallel read-only pass over the float inputs to fix the scale and offset of quantization before conversion, which starts on the first point. The dims of rows are checked on the way
+    size_t mappedBytes;
+    const uint8_t *mapped = mapPointsFileReadOnly(pointsFile, &mappedBytes);
+    const size_t rowBytes = pointsFile->rowHeaderBytes + pointsFile->elemBytes * pointsFile->dimAmt;
+    const int64_t pointAmt = pointsFile->pointAmt;
+    const uint32_t dimAmt = pointsFile->dimAmt;
+    float minVal = FLT_MAX, maxVal = -FLT_MAX;
+    GADDRTYPE wrongRowAmt = 0;
+#pragma omp parallel for schedule(static) reduction(min: minVal) reduction(max: maxVal) reduction(+: wrongRowAmt)
+    for (int64_t pointId = 0; pointId < pointAmt; ++pointId) {
+        const float *row = (const float *)(mapped + pointsFile->headerBytes + pointId * rowBytes + pointsFile->rowHeaderBytes);
+        if (isRowDimWrong(pointsFile, (const uint8_t *)row)) {
+            ++wrongRowAmt;
+            continue;
+        }
+        for (uint32_t dim = 0; dim < dimAmt; ++dim) {
+            if (row[dim] < minVal)
+                minVal = row[dim];
+            if (row[dim] > maxVal)
+                maxVal = row[dim];
+        }
+    }
+    munmap((void *)mapped, mappedBytes);
+    checkWrongRows(pointsFile, wrongRowAmt);
+    pointsFile->offset = minVal;
+    pointsFile->scale = maxVal > minVal ? ELEMTYPE_MAX / (maxVal - minVal) : 1;
+}
+
+uint32_t getPointsDimAmt(const char *const pointsFileName, const pointsFormat_t format) {  // The dimension recorded by the container, or 0 for raw dumps, which record none
+    if (format == POINTS_FORMAT_RAW)
+        return 0;
+    FILE *fp = fopen(pointsFileName, "rb");
+    if (fp == NULL) {
+        printf("Failed to open the input point file: %s! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    const bool perRow = format == POINTS_FORMAT_FVECS || format == POINTS_FORMAT_BVECS;  // The dim heads each row, or follows the amount of points in the file header
+    uint32_t header[2] = { 0, 0 };
+    size_t headerRead = fread(header, sizeof(uint32_t), perRow ? 1 : 2, fp);
+    fclose(fp);
+    if (headerRead == 0) {
+        printf("The input point file: %s is an empty file! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    if (headerRead < (perRow ? 1 : 2)) {
+        printf("The input point file: %s has a truncated header! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    return perRow ? header[0] : header[1];
+}
+
+GADDRTYPE getPointsAmount(const char *const pointsFileName, const uint32_t dimAmt, const pointsFormat_t format, pointsFile_t *pointsFile) {
+    FILE *fp = fopen(pointsFileName, "rb");
+    if (fp == NULL) {
+        printf("Failed to open the input point file: %s! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    fseek(fp, 0, SEEK_END);
+    long long int fileBytes = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    pointsFile->fileName = pointsFileName;
+    pointsFile->format = format;
+    pointsFile->dimAmt = dimAmt;
+    pointsFile->headerBytes = pointsFile->rowHeaderBytes = 0;
+    pointsFile->elemBytes = sizeof(ELEMTYPE);
+    pointsFile->scale = 1, pointsFile->offset = 0;
+    pointsFile->direct = false;
+    uint32_t header[2] = { dimAmt, 0 };
+    size_t headerRead = 0;
+    switch (format) {
+        case POINTS_FORMAT_FVECS:
+        case POINTS_FORMAT_BVECS:
+            headerRead = fread(header, sizeof(uint32_t), 1, fp);
+            pointsFile->rowHeaderBytes = sizeof(uint32_t);
+            pointsFile->elemBytes = format == POINTS_FORMAT_FVECS ? sizeof(float) : sizeof(uint8_t);
+            pointsFile->dimAmt = header[0];
+            break;
+        case POINTS_FORMAT_FBIN:
+        case POINTS_FORMAT_U8BIN:
+            headerRead = fread(header, sizeof(uint32_t), 2, fp);
+            pointsFile->headerBytes = sizeof(uint32_t) << 1;
+            pointsFile->elemBytes = format == POINTS_FORMAT_FBIN ? sizeof(float) : sizeof(uint8_t);
+            pointsFile->dimAmt = header[1];
+            break;
+        default:
+            headerRead = 1;
+            break;
+    }
+    fclose(fp);
+    if (headerRead == 0) {
+        printf("The input point file: %s is an empty file! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    if (headerRead < (format == POINTS_FORMAT_FBIN || format == POINTS_FORMAT_U8BIN ? 2 : 1)) {
+        printf("The input point file: %s has a truncated header! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    if (pointsFile->dimAmt == 0) {
+        printf("The input point file: %s has no dimension! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    if (pointsFile->dimAmt != dimAmt) {
+        printf("The input point file: %s has %u dimensions, but %u dimensions are given! Exit now!\n", pointsFileName, pointsFile->dimAmt, dimAmt);
+        exit(-1);
+    }
+    const size_t rowBytes = pointsFile->rowHeaderBytes + pointsFile->elemBytes * dimAmt;
+    pointsFile->pointAmt = (fileBytes - pointsFile->headerBytes) / rowBytes;
+    if ((format == POINTS_FORMAT_FVECS || format == POINTS_FORMAT_BVECS) && (fileBytes - pointsFile->headerBytes) % rowBytes != 0) {
+        printf("The input point file: %s ends in a partial row of %llu bytes! Exit now!\n", pointsFileName, (fileBytes - pointsFile->headerBytes) % rowBytes);
+        exit(-1);
+    }
+    if (format == POINTS_FORMAT_FBIN || format == POINTS_FORMAT_U8BIN) {
+        if (header[0] > pointsFile->pointAmt) {
+            printf("The input point file: %s holds %lu points, but its header records %u points! Exit now!\n", pointsFileName, (uint64_t)pointsFile->pointAmt, header[0]);
+            exit(-1);
+        }
+        pointsFile->pointAmt = header[0];  // Trust the header if the file has trailing bytes
+    }
+    if (format == POINTS_FORMAT_FVECS || format == POINTS_FORMAT_FBIN)
+        getQuantizationRange(pointsFile);
+    return pointsFile->pointAmt;
+}
+
+static void *readPointChunks(void *args) {  // Chunks are claimed in order, so the landed prefix grows steadily
+    pointsReader_t *reader = (pointsReader_t *)args;
+    uint8_t *buffer = NULL;  // O_DIRECT needs aligned buffers and lengths, which `data` may not have
+    if (reader->direct && posix_memalign((void **)&buffer, POINTS_READER_ALIGN, POINTS_READER_CHUNK) != 0) {
+        printf("Failed to allocate the buffer of the points reader! Exit now!\n");
+        exit(-1);
+    }
+    for (;;) {
+        pthread_mutex_lock(&reader->mutex);
+        uint64_t chunk = reader->nextChunk++;
+        pthread_mutex_unlock(&reader->mutex);
+        if (chunk >= reader->chunkAmt)
+            break;
+        uint64_t offset = chunk * POINTS_READER_CHUNK;
+        size_t size = reader->bytes - offset < POINTS_READER_CHUNK ? reader->bytes - offset : POINTS_READER_CHUNK;
+        if (reader->direct) {
+            size_t alignedSize = (size + POINTS_READER_ALIGN - 1) & ~(size_t)(POINTS_READER_ALIGN - 1);
+            for (size_t readBytes = 0; readBytes < size;) {  // The last chunk may end before `alignedSize`
+                ssize_t res = pread(reader->fd, buffer + readBytes, alignedSize - readBytes, offset + readBytes);
+                size_t landedBytes = res > 0 ? readBytes + res : readBytes;
+                size_t nextBytes = landedBytes < size ? landedBytes & ~(size_t)(POINTS_READER_ALIGN - 1) : landedBytes;  // O_DIRECT also needs aligned offsets, so a short read is retried from its last whole block
+                if (nextBytes == readBytes) {
+                    printf("Failed to read %lu bytes at offset %lu! Exit now!\n", size, offset);
+                    exit(-1);
+                }
+                readBytes = nextBytes;
+            }
+            memcpy(reader->data + offset, buffer, size);
+        } else {
+            readDataAt(reader->fd, reader->data + offset, size, offset);
+        }
+        pthread_mutex_lock(&reader->mutex);
+        reader->chunkLoaded[chunk] = true;
+        if (chunk == reader->loadedChunks) {
+            while (reader->loadedChunks < reader->chunkAmt && reader->chunkLoaded[reader->loadedChunks])
+                ++reader->loadedChunks;
+            pthread_cond_broadcast(&reader->chunkLanded);
+        }
+        pthread_mutex_unlock(&reader->mutex);
+    }
+    free(buffer);
+    return NULL;
+}
+
+void startPointsReader(pointsReader_t *reader, const pointsFile_t *const pointsFile, ELEMTYPE *points) {  // Start reading the raw points of `pointsFile` into `points` in the background
+    reader->direct = pointsFile->direct;
+    reader->fd = open(pointsFile->fileName, reader->direct ? O_RDONLY | O_DIRECT : O_RDONLY);
+    if (reader->fd < 0 && reader->direct) {  // Some file systems, e.g. tmpfs, refuse O_DIRECT
+        printf("[Host]  The input point file: %s cannot be read with O_DIRECT, so it is read through the page cache\n", pointsFile->fileName);
+        reader->direct = false;
+        reader->fd = open(pointsFile->fileName, O_RDONLY);
+    }
+    if (reader->fd < 0) {
+        printf("Failed to open the input point file: %s! Exit now!\n", pointsFile->fileName);
+        exit(-1);
+    }
+    reader->data = (uint8_t *)points;
+    reader->bytes = sizeof(ELEMTYPE) * pointsFile->dimAmt * pointsFile->pointAmt;  // Trailing bytes of a partial point are not read
+    if (reader->bytes == 0) {
+        printf("The input point file: %s is an empty file! Exit now!\n", pointsFile->fileName);
+        exit(-1);
+    }
+    reader->chunkAmt = (reader->bytes + POINTS_READER_CHUNK - 1) / POINTS_READER_CHUNK;
+    reader->nextChunk = reader->loadedChunks = 0;
+    reader->chunkLoaded = calloc(reader->chunkAmt, sizeof(bool));
+    pthread_mutex_init(&reader->mutex, NULL);
+    pthread_cond_init(&reader->chunkLanded, NULL);
+    for (uint32_t thread = 0; thread < POINTS_READER_THREADS; ++thread)
+        pthread_create(&reader->threads[thread], NULL, readPointChunks, reader);
+}
+
+void waitPointsReader(pointsReader_t *reader, const uint64_t bytes) {  // Block until the bytes [0, bytes) of the points have landed. Thread-safe
+    uint64_t chunkEnd = (bytes + POINTS_READER_CHUNK - 1) / POINTS_READER_CHUNK;
+    if (chunkEnd > reader->chunkAmt)
+        chunkEnd = reader->chunkAmt;
+    pthread_mutex_lock(&reader->mutex);
+    while (reader->loadedChunks < chunkEnd)
+        pthread_cond_wait(&reader->chunkLanded, &reader->mutex);
+    pthread_mutex_unlock(&reader->mutex);
+}
+
+void stopPointsReader(pointsReader_t *reader) {  // Wait for all points
+    for (uint32_t thread = 0; thread < POINTS_READER_THREADS; ++thread)
+        pthread_join(reader->threads[thread], NULL);
+    close(reader->fd);
+    free(reader->chunkLoaded);
+    pthread_mutex_destroy(&reader->mutex);
+    pthread_cond_destroy(&reader->chunkLanded);
+}
+
+static void convertPoints(const pointsFile_t *const pointsFile, const uint8_t *mapped, const GADDRTYPE firstPoint, const GADDRTYPE pointSize, ELEMTYPE *points) {  // Convert the rows [firstPoint, firstPoint + pointSize) of a mapped container into `points` with all threads
+    const size_t rowBytes = pointsFile->rowHeaderBytes + pointsFile->elemBytes * pointsFile->dimAmt;
+    const int64_t pointAmt = pointSize;
+    const uint32_t dimAmt = pointsFile->dimAmt;
+    const int isFloat = pointsFile->format == POINTS_FORMAT_FVECS || pointsFile->format == POINTS_FORMAT_FBIN;
+    const float scale = pointsFile->scale, offset = pointsFile->offset;
+    GADDRTYPE wrongRowAmt = 0;
+#pragma omp parallel for schedule(static) reduction(+: wrongRowAmt)
+    for (int64_t pointId = 0; pointId < pointAmt; ++pointId) {
+        const uint8_t *row = mapped + pointsFile->headerBytes + (firstPoint + pointId) * rowBytes + pointsFile->rowHeaderBytes;
+        ELEMTYPE *point = points + pointId * dimAmt;
+        if (!isFloat && isRowDimWrong(pointsFile, row)) {  // Rows of float inputs are checked with their range
+            ++wrongRowAmt;
+            continue;
+        }
+        if (isFloat) {
+            const float *rowf = (const float *)row;
+            for (uint32_t dim = 0; dim < dimAmt; ++dim) {
+                float quantized = (rowf[dim] - offset) * scale + 0.5f;
+                point[dim] = quantized <= 0 ? 0 : quantized >= ELEMTYPE_MAX ? ELEMTYPE_MAX : (ELEMTYPE)quantized;
+            }
+        } else {
+            for (uint32_t dim = 0; dim < dimAmt; ++dim)
+                point[dim] = row[dim];
+        }
+    }
+    checkWrongRows(pointsFile, wrongRowAmt);
+}
+
+void loadPointsFromFile(const pointsFile_t *const pointsFile, ELEMTYPE *points) {  // Containers other than the raw one are read through a read-only mapping and converted by all threads at once
+    if (pointsFile->format == POINTS_FORMAT_RAW) {
+        pointsReader_t reader;
+        startPointsReader(&reader, pointsFile, points);
+        stopPointsReader(&reader);
+        return;
+    }
+    size_t mappedBytes;
+    const uint8_t *mapped = mapPointsFileReadOnly(pointsFile, &mappedBytes);
+    convertPoints(pointsFile, mapped, 0, pointsFile->pointAmt, points);
+    munmap((void *)mapped, mappedBytes);
+}
+
+void convertPointsToFile(const pointsFile_t *const pointsFile, const int fd, const GADDRTYPE batchSize) {  // Out-of-core variant of `loadPointsFromFile`: rows are converted batch by batch and written into `fd`, so only `batchSize` points are resident at a time
+    size_t mappedBytes;
+    const uint8_t *mapped = mapPointsFileReadOnly(pointsFile, &mappedBytes);
+    const size_t pointBytes = sizeof(ELEMTYPE) * pointsFile->dimAmt;
+    const size_t rowBytes = pointsFile->rowHeaderBytes + pointsFile->elemBytes * pointsFile->dimAmt;
+    const uint64_t pageMask = ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    ELEMTYPE *points = malloc(batchSize * pointBytes);
+    for (GADDRTYPE firstPoint = 0; firstPoint < pointsFile->pointAmt; firstPoint += batchSize) {
+        GADDRTYPE pointSize = pointsFile->pointAmt - firstPoint < batchSize ? pointsFile->pointAmt - firstPoint : batchSize;
+        convertPoints(pointsFile, mapped, firstPoint, pointSize, points);
+        uint64_t convertedBegin = (pointsFile->headerBytes + firstPoint * rowBytes) & pageMask, convertedEnd = (pointsFile->headerBytes + (firstPoint + pointSize) * rowBytes) & pageMask;
+        if (convertedEnd > convertedBegin)
+            madvise((void *)(mapped + convertedBegin), convertedEnd - convertedBegin, MADV_DONTNEED);  // Converted rows would not be read again, so do not let them occupy the page cache of this mapping
+        writeDataAt(fd, points, pointSize * pointBytes, firstPoint * pointBytes);
+    }
+    free(points);
+    munmap((void *)mapped, mappedBytes);
+}
+
+ELEMTYPE *mapPointsFromFile(const char *const pointsFileName, size_t *mappedBytes) {  // Zero-copy alternative of `loadPointsFromFile` for raw inputs. The mapping is private, so the tree building phase only copies the pages it permutes and the input file is never modified
+    int fd = open(pointsFileName, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open the input point file: %s! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    struct stat pointsFileStat;
+    if (fstat(fd, &pointsFileStat) != 0 || pointsFileStat.st_size == 0) {
+        close(fd);
+        printf("The input point file: %s is an empty file! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    *mappedBytes = pointsFileStat.st_size;
+    void *points = mmap(NULL, *mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    close(fd);  // The mapping keeps its own reference to the file
+    if (points == MAP_FAILED) {
+        printf("Failed to map the input point file: %s! Exit now!\n", pointsFileName);
+        exit(-1);
+    }
+    // Hints only: failures are harmless. Reading ahead lets the disk work while the DPUs are being prepared
+#ifdef MADV_HUGEPAGE
+    madvise(points, *mappedBytes, MADV_HUGEPAGE);  // Fewer TLB misses on the pages copied on write by the permutation of the tree building phase
+#endif
+    madvise(points, *mappedBytes, MADV_WILLNEED);
+    return (ELEMTYPE *)points;
+}
+
+void unmapPoints(ELEMTYPE *points, const size_t mappedBytes) {
+    munmap(points, mappedBytes);
+}
+
+void readDataAt(const int fd, void *data, const size_t size, const uint64_t offset) {  // pread may return fewer bytes than requested for large sizes, so loop until all of them are read
+    for (size_t readBytes = 0; readBytes < size;) {
+        ssize_t res = pread(fd, (uint8_t *)data + readBytes, size - readBytes, offset + readBytes);
+        if (res <= 0) {
+            printf("Failed to read %lu bytes at offset %lu! Exit now!\n", size, offset);
+            exit(-1);
+        }
+        readBytes += res;
+    }
+}
+
+void writeDataAt(const int fd, const void *data, const size_t size, const uint64_t offset) {
+    for (size_t writtenBytes = 0; writtenBytes < size;) {
+        ssize_t res = pwrite(fd, (const uint8_t *)data + writtenBytes, size - writtenBytes, offset + writtenBytes);
+        if (res <= 0) {
+            printf("Failed to write %lu bytes at offset %lu! Exit now!\n", size, offset);
+            exit(-1);
+        }
+        writtenBytes += res;
+    }
+}
+
+void saveDataToFile(const char *const dataFileName, const void *data, const size_t size, const size_t nmemb) {
+    FILE *fp = fopen(dataFileName, "wb");
+    if (fp == NULL) {
+        printf("Failed to open the output point file: %s! Exit now!\n", dataFileName);
+        exit(-1);
+    }
+    fwrite(data, size, nmemb, fp);
+    fclose(fp);
+}
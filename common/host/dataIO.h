@@ -0,0 +1,70 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Operations for loading input points and saving results of GCiM.
+*/
+
+#ifndef GCIM_DATA_IO_H
+#define GCIM_DATA_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "request.h"
+
+#define POINTS_READER_THREADS 8  // Enough preads in flight to keep an NVMe busy
+#define POINTS_READER_CHUNK (4UL << 20)  // Bytes of each pread. A multiple of the alignment required by O_DIRECT
+#define POINTS_READER_ALIGN 4096
+
+// Supported containers of input points. Except the raw one (a headerless dump of `ELEMTYPE`), all of them are converted into `ELEMTYPE` while being read
+typedef enum {
+    POINTS_FORMAT_RAW,
+    POINTS_FORMAT_FVECS,  // Each row: int32 dim, float[dim]
+    POINTS_FORMAT_BVECS,  // Each row: int32 dim, uint8[dim]
+    POINTS_FORMAT_FBIN,   // Header: uint32 pointAmt, uint32 dim; then float[pointAmt][dim]
+    POINTS_FORMAT_U8BIN   // Header: uint32 pointAmt, uint32 dim; then uint8[pointAmt][dim]
+} pointsFormat_t;
+
+typedef struct {
+    const char *fileName;
+    pointsFormat_t format;
+    uint32_t dimAmt;
+    GADDRTYPE pointAmt;
+    size_t headerBytes;     // Bytes before the first row
+    size_t rowHeaderBytes;  // Bytes before the elements of each row
+    size_t elemBytes;       // Bytes of each input element
+    float scale;            // Quantization of float inputs: point = (x - offset) * scale. Integer inputs are widened as they are, i.e. scale = 1 and offset = 0
+    float offset;
+    bool direct;            // Read raw points with O_DIRECT, bypassing the page cache
+} pointsFile_t;
+
+typedef struct {  // Reads a raw points file into memory with several threads. The prefix of the file that has landed grows while it runs, so consumers can start on it early
+    int fd;
+    bool direct;
+    uint8_t *data;
+    uint64_t bytes;
+    uint64_t chunkAmt;
+    uint64_t nextChunk;    // The next chunk to claim
+    uint64_t loadedChunks; // Chunks [0, loadedChunks) have landed
+    bool *chunkLoaded;
+    pthread_t threads[POINTS_READER_THREADS];
+    pthread_mutex_t mutex;
+    pthread_cond_t chunkLanded;
+} pointsReader_t;
+
+pointsFormat_t getPointsFormat(const char *const pointsFileName, const char *const formatName);
+uint32_t getPointsDimAmt(const char *const pointsFileName, const pointsFormat_t format);
+GADDRTYPE getPointsAmount(const char *const pointsFileName, const uint32_t dimAmt, const pointsFormat_t format, pointsFile_t *pointsFile);
+void loadPointsFromFile(const pointsFile_t *const pointsFile, ELEMTYPE *points);
+void startPointsReader(pointsReader_t *reader, const pointsFile_t *const pointsFile, ELEMTYPE *points);
+void waitPointsReader(pointsReader_t *reader, const uint64_t bytes);
+void stopPointsReader(pointsReader_t *reader);
+void convertPointsToFile(const pointsFile_t *const pointsFile, const int fd, const GADDRTYPE batchSize);
+ELEMTYPE *mapPointsFromFile(const char *const pointsFileName, size_t *mappedBytes);
+void unmapPoints(ELEMTYPE *points, const size_t mappedBytes);
+void readDataAt(const int fd, void *data, const size_t size, const uint64_t offset);
+void writeDataAt(const int fd, const void *data, const size_t size, const uint64_t offset);
+void saveDataToFile(const char *const dataFileName, const void *data, const size_t size, const size_t nmemb);
+
+#endif
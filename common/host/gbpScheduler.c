@@ -0,0 +1,148 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Scheduling of the leaves of GCiM over the slots of the graph building phase, i.e. the ranks and the host, and the pipeline that drains their results.
+*/
+
+#include <stdlib.h>  // qsort, malloc, free
+#include <string.h>  // memcpy
+#include <stddef.h>  // offsetof
+#include <stdbool.h>  // bool
+#include <sys/time.h>  // gettimeofday
+#include "gbpScheduler.h"
+
+static int compareLeafCosts(const void *a, const void *b) {  // Decreasing costs. Ties keep the tree order, so the same leaves are always scheduled the same way
+    const leafCost_t *x = (const leafCost_t *)a, *y = (const leafCost_t *)b;
+    if (x->cost != y->cost)
+        return x->cost < y->cost ? 1 : -1;
+    return (x->treeId > y->treeId) - (x->treeId < y->treeId);
+}
+void sortLeafIdsByCost(leafCost_t *leafCosts, const GADDRTYPE leafIdSize, GADDRTYPE *leafIds) {
+    qsort(leafCosts, leafIdSize, sizeof(leafCost_t), compareLeafCosts);
+    for (GADDRTYPE leafId = 0; leafId < leafIdSize; ++leafId)
+        leafIds[leafId] = leafCosts[leafId].treeId;
+}
+double getGraphCost(const GADDRTYPE pointSize, const uint32_t dimAmt) {  // Distances of all pairs of points of a leaf in GBP
+    return (double)pointSize * pointSize * dimAmt;
+}
+
+void siftDownDPULoads(ADDRTYPE *heap, const ADDRTYPE heapSize, const double *dpuLoads, ADDRTYPE pos) {  // Min-heap of DPUs by their loads. Only the root changes, so it is only sifted down
+    for (ADDRTYPE child = 2 * pos + 1; child < heapSize; pos = child, child = 2 * pos + 1) {
+        if (child + 1 < heapSize && dpuLoads[heap[child + 1]] < dpuLoads[heap[child]])
+            ++child;
+        if (dpuLoads[heap[pos]] <= dpuLoads[heap[child]])
+            break;
+        ADDRTYPE dpu = heap[pos];
+        heap[pos] = heap[child], heap[child] = dpu;
+    }
+}
+
+void addImbalance(imbalance_t *imbalance, const double *dpuLoads, const ADDRTYPE dpuAmt) {
+    double maxLoad = 0, loadSum = 0;
+    for (ADDRTYPE nr_dpu = 0; nr_dpu < dpuAmt; ++nr_dpu) {
+        maxLoad = dpuLoads[nr_dpu] > maxLoad ? dpuLoads[nr_dpu] : maxLoad;
+        loadSum += dpuLoads[nr_dpu];
+    }
+    if (dpuAmt > 0)
+        imbalance->maxSum += maxLoad, imbalance->meanSum += loadSum / dpuAmt;
+}
+double getImbalance(const imbalance_t *imbalance) {
+    return imbalance->meanSum > 0 ? imbalance->maxSum / imbalance->meanSum : 1;
+}
+
+void completeGBPBatch(gbpPipeline_t *pipeline, const GADDRTYPE batch) {  // Called by each rank of a batch once its results are pushed. Records are journaled in the order of batches, so a resumed build skips only complete leaves
+    pthread_mutex_lock(&pipeline->mutex);
+    --pipeline->ranksLeft[batch];
+    for (; pipeline->journaledBatchAmt < pipeline->batchAmt && pipeline->ranksLeft[pipeline->journaledBatchAmt] == 0; ++pipeline->journaledBatchAmt) {
+        if (pipeline->journal == NULL)
+            continue;
+        GADDRTYPE leafBegin = pipeline->batchLeafBegins[pipeline->journaledBatchAmt], leafEnd = pipeline->batchLeafBegins[pipeline->journaledBatchAmt + 1];
+        appendJournal(pipeline->journal, pipeline->writer, leafEnd, pipeline->blocks != NULL ? pipeline->blocks + leafBegin - pipeline->batchLeafBegins[0] : NULL, pipeline->blocks != NULL ? leafEnd - leafBegin : 0);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+void measureGBPBatch(gbpPipeline_t *pipeline, const uint32_t slot, const double cost, const long dispatchTime) {  // Called by the last callback of a batch, before its slot is released. Rates are smoothed over batches, so a slot slowed down for a while, e.g. the host during the tree building phase, is not starved for the rest of the build
+    struct timeval timecheck;
+    gettimeofday(&timecheck, NULL);
+    double rate = cost / ((long)timecheck.tv_sec * 1e6 + (long)timecheck.tv_usec - dispatchTime + 1);
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->slotRates[slot] = pipeline->slotRates[slot] > 0 ? GBP_RATE_WEIGHT * rate + (1 - GBP_RATE_WEIGHT) * pipeline->slotRates[slot] : rate;
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+double getSlotShare(gbpPipeline_t *pipeline, const uint32_t slot) {  // The share of a slot in the work left, by the measured rates of all slots. A slot not measured yet counts as its units at the mean rate per unit of the measured ones, or by its units alone before any batch returns
+    double measuredRate = 0, measuredUnits = 0, weight = 0, weightSum = 0;
+    pthread_mutex_lock(&pipeline->mutex);
+    for (uint32_t each_slot = 0; each_slot < pipeline->slotAmt; ++each_slot)
+        if (pipeline->slotRates[each_slot] > 0)
+            measuredRate += pipeline->slotRates[each_slot], measuredUnits += pipeline->slotUnits[each_slot];
+    double unitRate = measuredUnits > 0 ? measuredRate / measuredUnits : 1;
+    for (uint32_t each_slot = 0; each_slot < pipeline->slotAmt; ++each_slot) {
+        double slotWeight = pipeline->slotRates[each_slot] > 0 ? pipeline->slotRates[each_slot] : pipeline->slotUnits[each_slot] * unitRate;
+        weightSum += slotWeight;
+        if (each_slot == slot)
+            weight = slotWeight;
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+    return weight / weightSum;
+}
+
+void setGlobalNeighbors(globalNeighbor_t *neighbors, const GADDRTYPE leafSize, const uint32_t neighborAmt, const uint32_t listSize, const POINTIDTYPE *leafPointIds) {  // DPUs return leaf-local ids in the layout of `pqueue_elem_t_mram`, so widen them in place into original ids. Only the first `listSize` entries of each row are written by DPUs, so the others are set to NEIGHBOR_NULL
+    _Static_assert(sizeof(globalNeighbor_t) == sizeof(pqueue_elem_t_mram), "Neighbors from DPUs are widened in place");
+    for (GADDRTYPE pointId = 0; pointId < leafSize; ++pointId) {
+        globalNeighbor_t *list = neighbors + pointId * neighborAmt;
+        for (uint32_t neighborId = 0; neighborId < listSize; ++neighborId) {
+            ADDRTYPE localId;
+            memcpy(&localId, (uint8_t *)&list[neighborId] + offsetof(pqueue_elem_t_mram, val), sizeof(ADDRTYPE));
+            list[neighborId].val = leafPointIds[localId];
+        }
+        for (uint32_t neighborId = listSize; neighborId < neighborAmt; ++neighborId)
+            list[neighborId].pri = (pqueue_pri_t)-1, list[neighborId].val = NEIGHBOR_NULL;
+    }
+}
+
+void pushGraphsOfLeaves(gbpPipeline_t *pipeline, const GADDRTYPE leafBegin, const GADDRTYPE leafEnd, globalNeighbor_t *neighbors) {  // Widen, encode and write the lists of the leaves leafIds[leafBegin, leafEnd), packed one after another as by a DPU. The lists are freed or handed to the writer
+    resultWriter_t *writer = pipeline->writer;
+    knnEncoder_t *knnEncoder = pipeline->knnEncoder;
+    int knnFd = pipeline->knnFd;
+    uint64_t knnBase = pipeline->knnBase;
+    POINTIDTYPE *pointIds = pipeline->pointIds;
+    globalTreeNode_t *tree = pipeline->tree;
+    GADDRTYPE *leafIds = pipeline->leafIds;
+    uint32_t neighborAmt = pipeline->neighborAmt;
+    GADDRTYPE firstPoint = tree[leafIds[leafBegin]].mean, pointAmt = 0;
+    bool contiguous = true;  // Lists of leaves following each other in the points are pushed at once
+    for (GADDRTYPE leafId = leafBegin; leafId < leafEnd; ++leafId) {
+        contiguous = contiguous && tree[leafIds[leafId]].mean == firstPoint + pointAmt;
+        pointAmt += tree[leafIds[leafId]].dim;
+    }
+    pointAmt = 0;
+    for (GADDRTYPE leafId = leafBegin; leafId < leafEnd; ++leafId) {
+        GADDRTYPE leafSize = tree[leafIds[leafId]].dim, leafPointBegin = tree[leafIds[leafId]].mean;
+        size_t neighborSize = (size_t)leafSize * neighborAmt;
+        uint32_t listSize = leafSize - 1 < neighborAmt ? leafSize - 1 : neighborAmt;  // Lists of leaves of no more than neighborAmt points are not full
+        globalNeighbor_t *leafNeighbors = neighbors + pointAmt * neighborAmt;
+        pointAmt += leafSize;
+        setGlobalNeighbors(leafNeighbors, leafSize, neighborAmt, listSize, pointIds + leafPointBegin);
+        if (knnEncoder == NULL) {
+            if (!contiguous) {
+                globalNeighbor_t *leafResult = malloc(sizeof(globalNeighbor_t) * neighborSize);  // Freed by the writer
+                memcpy(leafResult, leafNeighbors, sizeof(globalNeighbor_t) * neighborSize);
+                pushScatteredResult(writer, knnFd, leafResult, sizeof(globalNeighbor_t) * neighborAmt, leafSize, pointIds + leafPointBegin, knnBase, true);
+            }
+        } else {  // Each leaf is a block. Slots encode their blocks in parallel
+            uint8_t *block = malloc(getKnnBlockMaxBytes(leafSize, neighborAmt, knnEncoder->header.distBits));
+            size_t blockBytes = encodeKnnBlock(leafNeighbors, leafSize, neighborAmt, listSize, knnEncoder->header.distBits, block);
+            uint64_t blockOffset = reserveKnnBlock(knnEncoder, leafPointBegin, leafSize, blockBytes);
+            pushResult(writer, knnFd, block, blockBytes, blockOffset, true);
+            if (pipeline->blocks != NULL) {  // Kept for the journal record of the batch, since blocks of batches running at once interleave in the encoder
+                knnBlock_t *knnBlock = &pipeline->blocks[leafId - pipeline->batchLeafBegins[0]];
+                knnBlock->firstPoint = leafPointBegin, knnBlock->pointSize = leafSize, knnBlock->offset = blockOffset - knnEncoder->base, knnBlock->bytes = blockBytes;
+            }
+        }
+    }
+    if (knnEncoder == NULL && contiguous)
+        pushScatteredResult(writer, knnFd, neighbors, sizeof(globalNeighbor_t) * neighborAmt, pointAmt, pointIds + firstPoint, knnBase, true);  // Freed by the writer. Each row goes to the place of the original id of its point
+    else
+        free(neighbors);
+}
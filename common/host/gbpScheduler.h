@@ -0,0 +1,68 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Scheduling of the leaves of GCiM over the slots of the graph building phase, i.e. the ranks and the host, and the pipeline that drains their results.
+*/
+
+#ifndef GCIM_GBP_SCHEDULER_H
+#define GCIM_GBP_SCHEDULER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "request.h"
+#include "resultWriter.h"
+#include "knnCodec.h"
+#include "checkpoint.h"
+#include "rankDispatcher.h"
+
+#define GBP_RATE_WEIGHT 0.5  // Weight of the last batch in the measured rate of a slot
+
+typedef struct {  // Leaves are scheduled by their estimated costs, the largest first
+    double cost;
+    GADDRTYPE treeId;
+} leafCost_t;
+
+typedef struct {  // Imbalance of a schedule over DPUs: the sum of the longest DPU of each batch over the sum of the mean DPU of each batch. 1 is balanced
+    double maxSum;
+    double meanSum;
+} imbalance_t;
+
+typedef struct {  // Batches of the graph building phase run on slots at once, so they complete out of order
+    pthread_mutex_t mutex;
+    GADDRTYPE batchAmt;  // Batches dispatched so far
+    GADDRTYPE *batchLeafBegins;  // Batch `batch` builds the leaves leafIds[batchLeafBegins[batch], batchLeafBegins[batch + 1])
+    uint32_t *ranksLeft;  // Ranks of each batch which have not pushed their results yet
+    GADDRTYPE journaledBatchAmt;
+    journal_t *journal;  // NULL without checkpoints
+    resultWriter_t *writer;
+    knnEncoder_t *knnEncoder;  // NULL for the raw knn format
+    int knnFd;
+    uint64_t knnBase;  // Offset of the knn result in the file
+    POINTIDTYPE *pointIds;
+    globalTreeNode_t *tree;
+    GADDRTYPE *leafIds;
+    uint32_t neighborAmt;
+    rankDispatcher_t *dispatcher;  // Slots of the ranks, then of the host
+    uint32_t hostRank;  // The slot of the dispatcher taken by the host, after the ranks. `slotAmt` if the host builds no leaves
+    uint32_t slotAmt;
+    double *slotUnits;  // DPUs of each slot, or groups of leaves of a batch for the host. Slots without measured rates are weighted by them
+    double *slotRates;  // Unit: cost per us. Measured on the batches of each slot, 0 before the first one returns
+    knnBlock_t *blocks;  // The block of each leaf in the compact knn format, indexed from batchLeafBegins[0]. NULL unless journaled
+#ifdef PERF_EVAL
+    uint64_t *rankLoadTimes;  // Unit: us. Time of the callbacks of each rank, which overlaps with the other ranks
+    uint64_t *rankResponseTimes;
+#endif
+} gbpPipeline_t;
+
+void sortLeafIdsByCost(leafCost_t *leafCosts, const GADDRTYPE leafIdSize, GADDRTYPE *leafIds);
+double getGraphCost(const GADDRTYPE pointSize, const uint32_t dimAmt);
+void siftDownDPULoads(ADDRTYPE *heap, const ADDRTYPE heapSize, const double *dpuLoads, ADDRTYPE pos);
+void addImbalance(imbalance_t *imbalance, const double *dpuLoads, const ADDRTYPE dpuAmt);
+double getImbalance(const imbalance_t *imbalance);
+void completeGBPBatch(gbpPipeline_t *pipeline, const GADDRTYPE batch);
+void measureGBPBatch(gbpPipeline_t *pipeline, const uint32_t slot, const double cost, const long dispatchTime);
+double getSlotShare(gbpPipeline_t *pipeline, const uint32_t slot);
+void setGlobalNeighbors(globalNeighbor_t *neighbors, const GADDRTYPE leafSize, const uint32_t neighborAmt, const uint32_t listSize, const POINTIDTYPE *leafPointIds);
+void pushGraphsOfLeaves(gbpPipeline_t *pipeline, const GADDRTYPE leafBegin, const GADDRTYPE leafEnd, globalNeighbor_t *neighbors);
+
+#endif
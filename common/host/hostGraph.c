@@ -0,0 +1,249 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: The graph building phase of GCiM on the host CPU, with the same leaves in and the same neighbor lists out as `graphBuilding` on DPUs.
+*/
+
+#include <stdlib.h>  // malloc, free
+#include <string.h>  // memcpy
+#include "hostGraph.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HOST_GRAPH_X86
+#endif
+
+#define HOST_GRAPH_NARROW_DIMS 32  // Dimensions of the packed points are padded with zeros to multiples of these, which change no dot product
+#define HOST_GRAPH_WIDE_DIMS 8
+
+typedef enum {
+    HOST_GRAPH_KERNEL_SCALAR,
+    HOST_GRAPH_KERNEL_WIDE,  // AVX2 on 32-bit lanes
+    HOST_GRAPH_KERNEL_NARROW,  // AVX2 on 16-bit lanes
+    HOST_GRAPH_KERNEL_VNNI  // AVX-512 VNNI on 16-bit lanes
+} hostGraphKernel_t;
+
+typedef struct {  // Points of all leaves, packed for the kernel
+    hostGraphKernel_t kernel;
+    uint32_t dimAmt;
+    uint32_t dimPad;  // Packed elements of each point
+    const ELEMTYPE *points;  // The scalar kernel reads the points in place
+    int16_t *narrowPoints;
+    int32_t *widePoints;
+    uint64_t *norms;
+} hostGraphPoints_t;
+
+static void dotScalar(const hostGraphPoints_t *packed, const ADDRTYPE pointId, const ADDRTYPE *others, uint64_t dots[4]) {  // Sums wrap modulo 2^64 as the distances of DPUs do, so unsigned 32-bit points are fine too
+    const ELEMTYPE *point = packed->points + (size_t)packed->dimAmt * pointId;
+    for (uint32_t other = 0; other < 4; ++other) {
+        const ELEMTYPE *otherPoint = packed->points + (size_t)packed->dimAmt * others[other];
+        uint64_t dot = 0;
+        for (uint32_t dim = 0; dim < packed->dimAmt; ++dim)
+            dot += (uint64_t)(int64_t)point[dim] * (uint64_t)(int64_t)otherPoint[dim];
+        dots[other] = dot;
+    }
+}
+
+#ifdef HOST_GRAPH_X86
+__attribute__((target("avx2"))) static uint64_t sumEpi64AVX2(const __m256i sums) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, sums);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2"))) static uint64_t sumEpi32AVX2(const __m256i sums) {  // Lanes are widened first, since their sum may not fit in 32 bits
+    return sumEpi64AVX2(_mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(sums)), _mm256_cvtepi32_epi64(_mm256_extracti128_si256(sums, 1))));
+}
+
+__attribute__((target("avx2"))) static void dotWideAVX2(const hostGraphPoints_t *packed, const ADDRTYPE pointId, const ADDRTYPE *others, uint64_t dots[4]) {  // Products of 16-bit values fit in 32 bits, and are added in 64 bits
+    const int32_t *point = packed->widePoints + (size_t)packed->dimPad * pointId;
+    const int32_t *otherPoints[4];
+    __m256i sums[4];
+    for (uint32_t other = 0; other < 4; ++other)
+        otherPoints[other] = packed->widePoints + (size_t)packed->dimPad * others[other], sums[other] = _mm256_setzero_si256();
+    for (uint32_t dim = 0; dim < packed->dimPad; dim += HOST_GRAPH_WIDE_DIMS) {
+        __m256i values = _mm256_loadu_si256((const __m256i *)(point + dim));
+        for (uint32_t other = 0; other < 4; ++other) {
+            __m256i products = _mm256_mullo_epi32(values, _mm256_loadu_si256((const __m256i *)(otherPoints[other] + dim)));
+            __m128i low = _mm256_castsi256_si128(products), high = _mm256_extracti128_si256(products, 1);
+            if ((ELEMTYPE)-1 < 1)
+                sums[other] = _mm256_add_epi64(sums[other], _mm256_add_epi64(_mm256_cvtepi32_epi64(low), _mm256_cvtepi32_epi64(high)));
+            else
+                sums[other] = _mm256_add_epi64(sums[other], _mm256_add_epi64(_mm256_cvtepu32_epi64(low), _mm256_cvtepu32_epi64(high)));
+        }
+    }
+    for (uint32_t other = 0; other < 4; ++other)
+        dots[other] = sumEpi64AVX2(sums[other]);
+}
+
+__attribute__((target("avx2"))) static void dotNarrowAVX2(const hostGraphPoints_t *packed, const ADDRTYPE pointId, const ADDRTYPE *others, uint64_t dots[4]) {
+    const int16_t *point = packed->narrowPoints + (size_t)packed->dimPad * pointId;
+    const int16_t *otherPoints[4];
+    __m256i sums[4];
+    for (uint32_t other = 0; other < 4; ++other)
+        otherPoints[other] = packed->narrowPoints + (size_t)packed->dimPad * others[other], sums[other] = _mm256_setzero_si256();
+    for (uint32_t dim = 0; dim < packed->dimPad; dim += 16) {
+        __m256i values = _mm256_loadu_si256((const __m256i *)(point + dim));
+        for (uint32_t other = 0; other < 4; ++other)
+            sums[other] = _mm256_add_epi32(sums[other], _mm256_madd_epi16(values, _mm256_loadu_si256((const __m256i *)(otherPoints[other] + dim))));
+    }
+    for (uint32_t other = 0; other < 4; ++other)
+        dots[other] = sumEpi32AVX2(sums[other]);
+}
+
+__attribute__((target("avx512f,avx512vnni"))) static void dotVNNI(const hostGraphPoints_t *packed, const ADDRTYPE pointId, const ADDRTYPE *others, uint64_t dots[4]) {
+    const int16_t *point = packed->narrowPoints + (size_t)packed->dimPad * pointId;
+    const int16_t *otherPoints[4];
+    __m512i sums[4];
+    for (uint32_t other = 0; other < 4; ++other)
+        otherPoints[other] = packed->narrowPoints + (size_t)packed->dimPad * others[other], sums[other] = _mm512_setzero_si512();
+    for (uint32_t dim = 0; dim < packed->dimPad; dim += HOST_GRAPH_NARROW_DIMS) {
+        __m512i values = _mm512_loadu_si512((const void *)(point + dim));
+        for (uint32_t other = 0; other < 4; ++other)
+            sums[other] = _mm512_dpwssd_epi32(sums[other], values, _mm512_loadu_si512((const void *)(otherPoints[other] + dim)));
+    }
+    for (uint32_t other = 0; other < 4; ++other)
+        dots[other] = _mm512_reduce_add_epi64(_mm512_add_epi64(_mm512_cvtepi32_epi64(_mm512_castsi512_si256(sums[other])), _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(sums[other], 1))));
+}
+#endif
+
+static void dotPoints(const hostGraphPoints_t *packed, const ADDRTYPE pointId, const ADDRTYPE *others, uint64_t dots[4]) {  // Dot products of a point with 4 others, so each load of the point is used 4 times
+    switch (packed->kernel) {
+#ifdef HOST_GRAPH_X86
+        case HOST_GRAPH_KERNEL_VNNI:
+            dotVNNI(packed, pointId, others, dots);
+            break;
+        case HOST_GRAPH_KERNEL_NARROW:
+            dotNarrowAVX2(packed, pointId, others, dots);
+            break;
+        case HOST_GRAPH_KERNEL_WIDE:
+            dotWideAVX2(packed, pointId, others, dots);
+            break;
+#endif
+        default:
+            dotScalar(packed, pointId, others, dots);
+    }
+}
+
+static void packPoints(hostGraphPoints_t *packed, const ELEMTYPE *const points, const ADDRTYPE pointAmt, const uint32_t dimAmt) {  // Choose the kernel, then pack the points for it and compute their norms
+    packed->kernel = HOST_GRAPH_KERNEL_SCALAR, packed->dimAmt = packed->dimPad = dimAmt, packed->points = points;
+    packed->narrowPoints = NULL, packed->widePoints = NULL;
+#ifdef HOST_GRAPH_X86
+    if (sizeof(ELEMTYPE) <= 2 && __builtin_cpu_supports("avx2")) {
+        int64_t maxValue = 0;  // The largest absolute value
+#pragma omp parallel for reduction(max : maxValue)
+        for (size_t elemId = 0; elemId < (size_t)pointAmt * dimAmt; ++elemId) {
+            int64_t value = (int64_t)points[elemId];
+            maxValue = value > maxValue ? value : -value > maxValue ? -value : maxValue;
+        }
+        uint32_t narrowDimPad = (dimAmt + HOST_GRAPH_NARROW_DIMS - 1) / HOST_GRAPH_NARROW_DIMS * HOST_GRAPH_NARROW_DIMS;
+        if (maxValue <= INT16_MAX && 2 * maxValue * maxValue * (narrowDimPad / 16) <= INT32_MAX) {  // Each 32-bit lane of AVX2 adds up a pair of products of every 16 dimensions
+            packed->kernel = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vnni") ? HOST_GRAPH_KERNEL_VNNI : HOST_GRAPH_KERNEL_NARROW;
+            packed->dimPad = narrowDimPad;
+            packed->narrowPoints = calloc((size_t)pointAmt * packed->dimPad, sizeof(int16_t));
+        } else {
+            packed->kernel = HOST_GRAPH_KERNEL_WIDE;
+            packed->dimPad = (dimAmt + HOST_GRAPH_WIDE_DIMS - 1) / HOST_GRAPH_WIDE_DIMS * HOST_GRAPH_WIDE_DIMS;
+            packed->widePoints = calloc((size_t)pointAmt * packed->dimPad, sizeof(int32_t));
+        }
+    }
+#endif
+    packed->norms = malloc(sizeof(uint64_t) * pointAmt);
+#pragma omp parallel for
+    for (ADDRTYPE pointId = 0; pointId < pointAmt; ++pointId) {
+        const ELEMTYPE *point = points + (size_t)dimAmt * pointId;
+        uint64_t norm = 0;
+        for (uint32_t dim = 0; dim < dimAmt; ++dim) {
+            norm += (uint64_t)(int64_t)point[dim] * (uint64_t)(int64_t)point[dim];
+            if (packed->narrowPoints != NULL)
+                packed->narrowPoints[(size_t)packed->dimPad * pointId + dim] = point[dim];
+            else if (packed->widePoints != NULL)
+                packed->widePoints[(size_t)packed->dimPad * pointId + dim] = point[dim];
+        }
+        packed->norms[pointId] = norm;
+    }
+}
+
+static void siftDownNeighbors(pqueue_elem_t_mram *heap, const uint32_t heapSize, uint32_t pos) {  // Max-heap of neighbors by their distances, as the priority queue of DPUs
+    for (uint32_t child = 2 * pos + 1; child < heapSize; pos = child, child = 2 * pos + 1) {
+        if (child + 1 < heapSize && heap[child + 1].pri > heap[child].pri)
+            ++child;
+        if (heap[pos].pri >= heap[child].pri)
+            break;
+        pqueue_elem_t_mram neighbor = heap[pos];
+        heap[pos] = heap[child], heap[child] = neighbor;
+    }
+}
+
+static void pushNeighbor(pqueue_elem_t_mram *heap, uint32_t *heapSize, const uint32_t neighborAmt, const pqueue_pri_t dist, const ADDRTYPE neighborId) {  // Keep the neighborAmt nearest points. As on DPUs, the farthest one is only replaced by a strictly nearer point
+    if (*heapSize < neighborAmt) {
+        uint32_t pos = (*heapSize)++;
+        for (; pos > 0 && heap[(pos - 1) / 2].pri < dist; pos = (pos - 1) / 2)
+            heap[pos] = heap[(pos - 1) / 2];
+        heap[pos].pri = dist, heap[pos].val = neighborId;
+    } else if (neighborAmt > 0 && heap[0].pri > dist) {
+        heap[0].pri = dist, heap[0].val = neighborId;
+        siftDownNeighbors(heap, *heapSize, 0);
+    }
+}
+
+static void saveNeighbors(pqueue_elem_t_mram *heap, uint32_t heapSize, pqueue_elem_t_mram *neighbors) {  // Pop all neighbors, the farthest first, as `save_pq_into_mram` does
+    for (pqueue_elem_t_mram *neighbor = neighbors; heapSize > 0; ++neighbor) {
+        *neighbor = heap[0];
+        heap[0] = heap[--heapSize];
+        siftDownNeighbors(heap, heapSize, 0);
+    }
+}
+
+void graphBuildingHost(const ELEMTYPE *const points, const gbpLeaf_t *const leaves, const uint32_t leafAmt, const uint32_t dimAmt, const uint32_t neighborAmt, pqueue_elem_t_mram *neighbors) {  // Points are packed leaf after leaf as in the MRAM of a DPU, and the list of each point goes to neighbors[pointId * neighborAmt]. Blocks of points of all leaves are dealt to all threads
+    if (leafAmt < 1)
+        return;
+    ADDRTYPE pointAmt = leaves[leafAmt - 1].pointBegin + leaves[leafAmt - 1].pointAmt;
+    hostGraphPoints_t packed;
+    packPoints(&packed, points, pointAmt, dimAmt);
+    uint64_t *leafBlockBegins = malloc(sizeof(uint64_t) * (leafAmt + 1));  // Blocks of leaf `leaf` are [leafBlockBegins[leaf], leafBlockBegins[leaf + 1])
+    leafBlockBegins[0] = 0;
+    for (uint32_t leaf = 0; leaf < leafAmt; ++leaf)
+        leafBlockBegins[leaf + 1] = leafBlockBegins[leaf] + (leaves[leaf].pointAmt + HOST_GRAPH_BLOCK_POINTS - 1) / HOST_GRAPH_BLOCK_POINTS;
+#pragma omp parallel
+    {
+        pqueue_elem_t_mram *heaps = malloc(sizeof(pqueue_elem_t_mram) * HOST_GRAPH_BLOCK_POINTS * (neighborAmt > 0 ? neighborAmt : 1));
+        uint32_t heapSizes[HOST_GRAPH_BLOCK_POINTS];
+        uint32_t leaf = 0;
+#pragma omp for schedule(dynamic, 1)
+        for (uint64_t block = 0; block < leafBlockBegins[leafAmt]; ++block) {  // Blocks come in order to each thread, so the leaf of a block is found from the last one
+            while (block >= leafBlockBegins[leaf + 1])
+                ++leaf;
+            while (block < leafBlockBegins[leaf])
+                --leaf;
+            const gbpLeaf_t *curLeaf = &leaves[leaf];
+            ADDRTYPE blockBegin = curLeaf->pointBegin + (block - leafBlockBegins[leaf]) * HOST_GRAPH_BLOCK_POINTS, leafEnd = curLeaf->pointBegin + curLeaf->pointAmt;
+            ADDRTYPE blockEnd = leafEnd - blockBegin > HOST_GRAPH_BLOCK_POINTS ? blockBegin + HOST_GRAPH_BLOCK_POINTS : leafEnd;
+            for (ADDRTYPE pointId = blockBegin; pointId < blockEnd; ++pointId)
+                heapSizes[pointId - blockBegin] = 0;
+            for (ADDRTYPE otherBegin = curLeaf->pointBegin; otherBegin < leafEnd; otherBegin += HOST_GRAPH_BLOCK_POINTS) {  // Neighbors are given by their ids in the leaf, and visited in order as on DPUs
+                ADDRTYPE otherEnd = leafEnd - otherBegin > HOST_GRAPH_BLOCK_POINTS ? otherBegin + HOST_GRAPH_BLOCK_POINTS : leafEnd;
+                for (ADDRTYPE pointId = blockBegin; pointId < blockEnd; ++pointId) {
+                    pqueue_elem_t_mram *heap = heaps + (size_t)(pointId - blockBegin) * neighborAmt;
+                    for (ADDRTYPE otherId = otherBegin; otherId < otherEnd; otherId += 4) {
+                        ADDRTYPE others[4];
+                        uint64_t dots[4];
+                        for (uint32_t other = 0; other < 4; ++other)
+                            others[other] = otherId + other < otherEnd ? otherId + other : otherId;  // The tail repeats a point, whose result is dropped
+                        dotPoints(&packed, pointId, others, dots);
+                        for (uint32_t other = 0; other < 4 && otherId + other < otherEnd; ++other)
+                            if (otherId + other != pointId)
+                                pushNeighbor(heap, &heapSizes[pointId - blockBegin], neighborAmt, packed.norms[pointId] + packed.norms[otherId + other] - 2 * dots[other], otherId + other - curLeaf->pointBegin);
+                    }
+                }
+            }
+            for (ADDRTYPE pointId = blockBegin; pointId < blockEnd; ++pointId)
+                saveNeighbors(heaps + (size_t)(pointId - blockBegin) * neighborAmt, heapSizes[pointId - blockBegin], neighbors + (size_t)pointId * neighborAmt);
+        }
+        free(heaps);
+    }
+    free(leafBlockBegins);
+    free(packed.narrowPoints);
+    free(packed.widePoints);
+    free(packed.norms);
+}
@@ -0,0 +1,22 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: The graph building phase of GCiM on the host CPU, with the same leaves in and the same neighbor lists out as `graphBuilding` on DPUs.
+*/
+
+#ifndef GCIM_HOST_GRAPH_H
+#define GCIM_HOST_GRAPH_H
+
+#include <stdint.h>
+#include "request.h"
+
+#define HOST_GRAPH_BLOCK_POINTS 64  // Points of a leaf are compared block by block with the blocks of the leaf, so the blocks stay in the cache
+#define HOST_GRAPH_BATCH_GROUPS 8  // Groups of leaves in a batch of the host, each one packed as for a DPU
+
+/*
+Distances are ||x||^2 + ||y||^2 - 2 x.y, with the dot products of each block computed by integer SIMD: AVX-512 VNNI or AVX2 on 16-bit lanes if the values of the points are small enough for 32-bit sums, AVX2 on 32-bit lanes with 64-bit sums otherwise.
+The kernel is chosen at runtime by the CPU and the points. All of them give the distances of `distCalVec` exactly, as the scalar code does for other CPUs and ELEMTYPEs.
+*/
+void graphBuildingHost(const ELEMTYPE *const points, const gbpLeaf_t *const leaves, const uint32_t leafAmt, const uint32_t dimAmt, const uint32_t neighborAmt, pqueue_elem_t_mram *neighbors);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Compact on-disk format of the knn graph of GCiM: an encoder for the building phases and a decoder for downstream loaders.
+*/
+
+#define _GNU_SOURCE  // ftruncate
+#include <stdio.h>  // printf
+#include <stdlib.h>  // malloc, qsort, exit
+#include <string.h>  // memcpy, memcmp
+#include <fcntl.h>  // open
+#include <unistd.h>  // close, ftruncate
+#include <sys/stat.h>  // fstat
+#include "knnCodec.h"
+#include "dataIO.h"
+
+static uint8_t *putVarint(uint8_t *out, uint64_t value) {  // LEB128
+    while (value >= 0x80) {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static uint64_t getVarint(const uint8_t **in) {
+    uint64_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        uint8_t byte = *(*in)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+            return value;
+    }
+}
+
+static int cmpNeighborVal(const void *a, const void *b) {
+    GADDRTYPE va = ((const globalNeighbor_t *)a)->val, vb = ((const globalNeighbor_t *)b)->val;
+    return (va > vb) - (va < vb);
+}
+
+void startKnnEncoder(knnEncoder_t *encoder, const int fd, const uint64_t base, const GADDRTYPE pointAmt, const uint32_t neighborAmt, const uint32_t distBits) {
+    if (distBits != 0 && distBits != 8 && distBits != 16) {
+        printf("Distances of the compact knn format can only be quantized into 0, 8 or 16 bits, but %u bits are given! Exit now!\n", distBits);
+        exit(-1);
+    }
+    memset(&encoder->header, 0, sizeof(knnHeader_t));
+    memcpy(encoder->header.magic, KNN_MAGIC, sizeof(KNN_MAGIC));
+    encoder->header.version = KNN_VERSION;
+    encoder->header.neighborAmt = neighborAmt;
+    encoder->header.distBits = distBits;
+    encoder->header.pointAmt = pointAmt;
+    encoder->fd = fd;
+    encoder->base = base;
+    pthread_mutex_init(&encoder->mutex, NULL);
+    encoder->tail = sizeof(knnHeader_t);
+    encoder->blockAmt = 0;
+    encoder->blockCapacity = 1024;
+    encoder->blocks = malloc(encoder->blockCapacity * sizeof(knnBlock_t));
+    writeDataAt(fd, &encoder->header, sizeof(knnHeader_t), base);
+}
+
+size_t getKnnBlockMaxBytes(const GADDRTYPE pointSize, const uint32_t neighborAmt, const uint32_t distBits) {
+    return pointSize * (KNN_VARINT_MAX_BYTES * (2 + (size_t)neighborAmt) + (size_t)neighborAmt * (distBits >> 3));
+}
+
+size_t encodeKnnBlock(const globalNeighbor_t *neighbors, const GADDRTYPE pointSize, const uint32_t neighborAmt, const uint32_t listSize, const uint32_t distBits, uint8_t *block) {  // `neighbors` holds `neighborAmt` entries per point, of which the first `listSize` are valid. Return the bytes of the encoded block
+    uint8_t *out = block;
+    const uint64_t quantMax = (1UL << distBits) - 1;
+    globalNeighbor_t list[listSize > 0 ? listSize : 1];
+    for (GADDRTYPE pointId = 0; pointId < pointSize; ++pointId) {
+        memcpy(list, neighbors + pointId * neighborAmt, sizeof(globalNeighbor_t) * listSize);
+        qsort(list, listSize, sizeof(globalNeighbor_t), cmpNeighborVal);
+        out = putVarint(out, listSize);
+        GADDRTYPE prevId = 0;
+        pqueue_pri_t maxDist = 0;
+        for (uint32_t neighborId = 0; neighborId < listSize; ++neighborId) {
+            out = putVarint(out, list[neighborId].val - prevId);
+            prevId = list[neighborId].val;
+            if (list[neighborId].pri > maxDist)
+                maxDist = list[neighborId].pri;
+        }
+        if (distBits == 0 || listSize == 0)
+            continue;
+        out = putVarint(out, maxDist);
+        for (uint32_t neighborId = 0; neighborId < listSize; ++neighborId) {
+            uint64_t quantized = maxDist == 0 ? 0 : (uint64_t)((double)list[neighborId].pri / maxDist * quantMax + 0.5);
+            for (uint32_t byte = 0; byte < distBits; byte += 8)  // Little-endian
+                *out++ = (uint8_t)(quantized >> byte);
+        }
+    }
+    return out - block;
+}
+
+uint64_t reserveKnnBlock(knnEncoder_t *encoder, const GADDRTYPE firstPoint, const GADDRTYPE pointSize, const uint64_t bytes) {  // Thread-safe. Return the offset where the block should be written
+    pthread_mutex_lock(&encoder->mutex);
+    if (encoder->blockAmt == encoder->blockCapacity) {
+        encoder->blockCapacity <<= 1;
+        encoder->blocks = realloc(encoder->blocks, encoder->blockCapacity * sizeof(knnBlock_t));
+    }
+    knnBlock_t *knnBlock = &encoder->blocks[encoder->blockAmt++];
+    knnBlock->firstPoint = firstPoint, knnBlock->pointSize = pointSize, knnBlock->offset = encoder->tail, knnBlock->bytes = bytes;
+    encoder->tail += bytes;
+    uint64_t offset = encoder->base + knnBlock->offset;
+    pthread_mutex_unlock(&encoder->mutex);
+    return offset;
+}
+
+void restoreKnnBlocks(knnEncoder_t *encoder, const knnBlock_t *blocks, const uint64_t blockAmt) {  // Register blocks written by an interrupted build, so that new blocks go after them
+    for (uint64_t blockId = 0; blockId < blockAmt; ++blockId) {
+        if (encoder->blockAmt == encoder->blockCapacity) {
+            encoder->blockCapacity <<= 1;
+            encoder->blocks = realloc(encoder->blocks, encoder->blockCapacity * sizeof(knnBlock_t));
+        }
+        encoder->blocks[encoder->blockAmt++] = blocks[blockId];
+        if (blocks[blockId].offset + blocks[blockId].bytes > encoder->tail)
+            encoder->tail = blocks[blockId].offset + blocks[blockId].bytes;
+    }
+}
+
+static int cmpKnnBlock(const void *a, const void *b) {
+    GADDRTYPE fa = ((const knnBlock_t *)a)->firstPoint, fb = ((const knnBlock_t *)b)->firstPoint;
+    return (fa > fb) - (fa < fb);
+}
+
+uint64_t finishKnnEncoder(knnEncoder_t *encoder, const POINTIDTYPE *pointIds) {  // Append the index of blocks and the row index, the inverse of the permutation `pointIds`. Call it after all blocks are reserved. Return the bytes of the layout
+    qsort(encoder->blocks, encoder->blockAmt, sizeof(knnBlock_t), cmpKnnBlock);
+    const int64_t pointAmt = encoder->header.pointAmt;
+    knnTrailer_t trailer = { .indexOffset = encoder->tail, .blockAmt = encoder->blockAmt, .rowIndexOffset = encoder->tail + sizeof(knnBlock_t) * encoder->blockAmt };
+    const uint64_t bytes = trailer.rowIndexOffset + sizeof(POINTIDTYPE) * pointAmt + sizeof(knnTrailer_t);
+    writeDataAt(encoder->fd, encoder->blocks, sizeof(knnBlock_t) * encoder->blockAmt, encoder->base + trailer.indexOffset);
+    POINTIDTYPE *rows = malloc(sizeof(POINTIDTYPE) * (pointAmt > 0 ? pointAmt : 1));
+#pragma omp parallel for schedule(static)
+    for (int64_t row = 0; row < pointAmt; ++row)
+        rows[pointIds[row]] = row;
+    writeDataAt(encoder->fd, rows, sizeof(POINTIDTYPE) * pointAmt, encoder->base + trailer.rowIndexOffset);
+    free(rows);
+    writeDataAt(encoder->fd, &trailer, sizeof(knnTrailer_t), encoder->base + bytes - sizeof(knnTrailer_t));
+    if (ftruncate(encoder->fd, encoder->base + bytes) != 0) {  // The trailer must end the file, even if a resumed build left blocks of a torn batch after it
+        printf("Failed to truncate the compact knn file! Exit now!\n");
+        exit(-1);
+    }
+    free(encoder->blocks);
+    pthread_mutex_destroy(&encoder->mutex);
+    return bytes;
+}
+
+knnGraph_t *openKnnGraph(const char *const knnFileName) {
+    int fd = open(knnFileName, O_RDONLY);
+    struct stat knnFileStat;
+    if (fd < 0 || fstat(fd, &knnFileStat) != 0) {
+        printf("Failed to open the compact knn file: %s! Exit now!\n", knnFileName);
+        exit(-1);
+    }
+    return openKnnGraphAt(fd, 0, knnFileStat.st_size);
+}
+
+knnGraph_t *openKnnGraphAt(const int fd, const uint64_t base, const uint64_t bytes) {  // Open the layout in [base, base + bytes) of `fd`, which is closed by `closeKnnGraph`
+    knnGraph_t *graph = malloc(sizeof(knnGraph_t));
+    graph->fd = fd;
+    graph->base = base;
+    if (bytes >= sizeof(knnHeader_t) + sizeof(knnTrailer_t))
+        readDataAt(fd, &graph->header, sizeof(knnHeader_t), base);
+    if (bytes < sizeof(knnHeader_t) + sizeof(knnTrailer_t) || memcmp(graph->header.magic, KNN_MAGIC, sizeof(KNN_MAGIC)) != 0 || graph->header.version != KNN_VERSION) {
+        printf("The knn graph is not in the compact knn format of version %u! Exit now!\n", KNN_VERSION);
+        exit(-1);
+    }
+    knnTrailer_t trailer;
+    readDataAt(fd, &trailer, sizeof(knnTrailer_t), base + bytes - sizeof(knnTrailer_t));
+    graph->blockAmt = trailer.blockAmt;
+    graph->rowIndexOffset = trailer.rowIndexOffset;
+    graph->blocks = malloc(sizeof(knnBlock_t) * (trailer.blockAmt > 0 ? trailer.blockAmt : 1));
+    readDataAt(fd, graph->blocks, sizeof(knnBlock_t) * trailer.blockAmt, base + trailer.indexOffset);
+    return graph;
+}
+
+uint32_t decodeKnnList(const uint8_t **list, const uint32_t distBits, globalNeighbor_t *neighbors) {  // Decode one list and advance `list` past it. Neighbors come sorted by id, with distances approximated from their quantization (0 without distances)
+    uint32_t listSize = getVarint(list);
+    GADDRTYPE id = 0;
+    for (uint32_t neighborId = 0; neighborId < listSize; ++neighborId) {
+        id += getVarint(list);
+        neighbors[neighborId].val = id;
+        neighbors[neighborId].pri = 0;
+    }
+    if (distBits == 0 || listSize == 0)
+        return listSize;
+    const uint64_t quantMax = (1UL << distBits) - 1;
+    pqueue_pri_t maxDist = getVarint(list);
+    for (uint32_t neighborId = 0; neighborId < listSize; ++neighborId) {
+        uint64_t quantized = 0;
+        for (uint32_t byte = 0; byte < distBits; byte += 8)
+            quantized |= (uint64_t)*(*list)++ << byte;
+        neighbors[neighborId].pri = (pqueue_pri_t)((double)quantized / quantMax * maxDist + 0.5);
+    }
+    return listSize;
+}
+
+void decodeKnnGraph(const knnGraph_t *graph, globalNeighbor_t *neighbors, uint32_t *listSizes) {  // Decode the whole graph into `neighborAmt` entries per point, in the order of original ids, with blocks decoded in parallel
+    const uint32_t neighborAmt = graph->header.neighborAmt;
+    const int64_t blockAmt = graph->blockAmt, pointAmt = graph->header.pointAmt;
+    POINTIDTYPE *rows = malloc(sizeof(POINTIDTYPE) * (pointAmt > 0 ? pointAmt : 1)), *pointIds = malloc(sizeof(POINTIDTYPE) * (pointAmt > 0 ? pointAmt : 1));
+    readDataAt(graph->fd, rows, sizeof(POINTIDTYPE) * pointAmt, graph->base + graph->rowIndexOffset);
+#pragma omp parallel for schedule(static)
+    for (int64_t pointId = 0; pointId < pointAmt; ++pointId)
+        pointIds[rows[pointId]] = pointId;
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t blockId = 0; blockId < blockAmt; ++blockId) {
+        const knnBlock_t *knnBlock = &graph->blocks[blockId];
+        uint8_t *block = malloc(knnBlock->bytes);
+        readDataAt(graph->fd, block, knnBlock->bytes, graph->base + knnBlock->offset);
+        const uint8_t *list = block;
+        for (GADDRTYPE row = knnBlock->firstPoint, rowEnd = knnBlock->firstPoint + knnBlock->pointSize; row < rowEnd; ++row)
+            listSizes[pointIds[row]] = decodeKnnList(&list, graph->header.distBits, neighbors + (GADDRTYPE)pointIds[row] * neighborAmt);
+        free(block);
+    }
+    free(rows);
+    free(pointIds);
+}
+
+uint32_t getKnnNeighbors(const knnGraph_t *graph, const GADDRTYPE pointId, globalNeighbor_t *neighbors) {  // Random access to the list of the point of original id `pointId`: only its row and its block are read. `neighbors` needs room for `neighborAmt` entries
+    if (graph->blockAmt == 0 || pointId >= graph->header.pointAmt)
+        return 0;
+    POINTIDTYPE row;
+    readDataAt(graph->fd, &row, sizeof(POINTIDTYPE), graph->base + graph->rowIndexOffset + sizeof(POINTIDTYPE) * pointId);
+    uint64_t lBlock = 0, rBlock = graph->blockAmt;
+    while (rBlock - lBlock > 1) {
+        uint64_t mBlock = (lBlock + rBlock) >> 1;
+        if (graph->blocks[mBlock].firstPoint <= row)
+            lBlock = mBlock;
+        else
+            rBlock = mBlock;
+    }
+    const knnBlock_t *knnBlock = &graph->blocks[lBlock];
+    if (row < knnBlock->firstPoint || row >= knnBlock->firstPoint + knnBlock->pointSize)
+        return 0;
+    uint8_t *block = malloc(knnBlock->bytes);
+    readDataAt(graph->fd, block, knnBlock->bytes, graph->base + knnBlock->offset);
+    const uint8_t *list = block;
+    uint32_t listSize = 0;
+    for (GADDRTYPE blockRow = knnBlock->firstPoint; blockRow <= row; ++blockRow)
+        listSize = decodeKnnList(&list, graph->header.distBits, neighbors);
+    free(block);
+    return listSize;
+}
+
+void closeKnnGraph(knnGraph_t *graph) {
+    close(graph->fd);
+    free(graph->blocks);
+    free(graph);
+}
@@ -0,0 +1,87 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Compact on-disk format of the knn graph of GCiM: an encoder for the building phases and a decoder for downstream loaders.
+*/
+
+#ifndef GCIM_KNN_CODEC_H
+#define GCIM_KNN_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "request.h"
+
+/*
+Layout of a compact knn file:
+    knnHeader_t
+    blocks, in the order they are written. A block holds the lists of the rows [firstPoint, firstPoint + pointSize) of the leaf result, i.e. of a leaf
+    knnBlock_t[blockAmt], sorted by firstPoint
+    POINTIDTYPE[pointAmt], the row of each point in the leaf result, by original id
+    knnTrailer_t
+The layout may also start at an offset of a larger file, i.e. the knn section of a bundle. Offsets of blocks are relative to its start.
+Blocks are keyed by rows of the leaf result, but the decoder is keyed by original ids through the row index, so readers need no permutation.
+Each list is: varint count; varint ids, sorted and delta coded; then, if distBits > 0, varint max distance and count distances quantized into distBits against it.
+*/
+#define KNN_MAGIC "GCIMKNN"
+#define KNN_VERSION 2
+#define KNN_VARINT_MAX_BYTES 10
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t neighborAmt;
+    uint32_t distBits;  // 0, 8 or 16. Distances are dropped with 0
+    uint32_t reserved;
+    uint64_t pointAmt;
+} knnHeader_t;
+
+typedef struct {
+    GADDRTYPE firstPoint;
+    GADDRTYPE pointSize;
+    uint64_t offset;
+    uint64_t bytes;
+} knnBlock_t;
+
+typedef struct {
+    uint64_t indexOffset;
+    uint64_t blockAmt;
+    uint64_t rowIndexOffset;
+} knnTrailer_t;
+
+typedef struct {
+    int fd;
+    uint64_t base;  // Offset of the layout in the file
+    knnHeader_t header;
+    pthread_mutex_t mutex;  // Blocks are reserved by the callbacks of all ranks at once
+    uint64_t tail;
+    knnBlock_t *blocks;
+    uint64_t blockAmt;
+    uint64_t blockCapacity;
+} knnEncoder_t;
+
+typedef struct {
+    int fd;
+    uint64_t base;
+    knnHeader_t header;
+    knnBlock_t *blocks;
+    uint64_t blockAmt;
+    uint64_t rowIndexOffset;
+} knnGraph_t;
+
+// Encoder
+void startKnnEncoder(knnEncoder_t *encoder, const int fd, const uint64_t base, const GADDRTYPE pointAmt, const uint32_t neighborAmt, const uint32_t distBits);
+size_t getKnnBlockMaxBytes(const GADDRTYPE pointSize, const uint32_t neighborAmt, const uint32_t distBits);
+size_t encodeKnnBlock(const globalNeighbor_t *neighbors, const GADDRTYPE pointSize, const uint32_t neighborAmt, const uint32_t listSize, const uint32_t distBits, uint8_t *block);
+uint64_t reserveKnnBlock(knnEncoder_t *encoder, const GADDRTYPE firstPoint, const GADDRTYPE pointSize, const uint64_t bytes);
+void restoreKnnBlocks(knnEncoder_t *encoder, const knnBlock_t *blocks, const uint64_t blockAmt);
+uint64_t finishKnnEncoder(knnEncoder_t *encoder, const POINTIDTYPE *pointIds);
+// Decoder
+knnGraph_t *openKnnGraph(const char *const knnFileName);
+knnGraph_t *openKnnGraphAt(const int fd, const uint64_t base, const uint64_t bytes);
+uint32_t decodeKnnList(const uint8_t **list, const uint32_t distBits, globalNeighbor_t *neighbors);
+void decodeKnnGraph(const knnGraph_t *graph, globalNeighbor_t *neighbors, uint32_t *listSizes);
+uint32_t getKnnNeighbors(const knnGraph_t *graph, const GADDRTYPE pointId, globalNeighbor_t *neighbors);
+void closeKnnGraph(knnGraph_t *graph);
+
+#endif
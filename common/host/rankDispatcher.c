@@ -0,0 +1,43 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: A dispatcher of work to the ranks of GCiM, which refills each rank as soon as its results are drained instead of waiting for all ranks.
+*/
+
+#include <stdlib.h>  // malloc, free
+#include "rankDispatcher.h"
+
+void startRankDispatcher(rankDispatcher_t *dispatcher, const uint32_t nr_ranks) {  // All ranks start idle
+    pthread_mutex_init(&dispatcher->mutex, NULL);
+    pthread_cond_init(&dispatcher->rankDrained, NULL);
+    dispatcher->idleRanks = malloc(sizeof(uint32_t) * nr_ranks);
+    for (uint32_t nr_rank = 0; nr_rank < nr_ranks; ++nr_rank)
+        dispatcher->idleRanks[nr_rank] = nr_ranks - 1 - nr_rank;  // The first work goes to the ranks in order
+    dispatcher->idleRankAmt = dispatcher->rankAmt = nr_ranks;
+}
+
+uint32_t waitIdleRank(rankDispatcher_t *dispatcher) {  // Take a rank without work queued, blocking until one is drained
+    pthread_mutex_lock(&dispatcher->mutex);
+    while (dispatcher->idleRankAmt == 0)
+        pthread_cond_wait(&dispatcher->rankDrained, &dispatcher->mutex);
+    uint32_t rank_id = dispatcher->idleRanks[--dispatcher->idleRankAmt];
+    pthread_mutex_unlock(&dispatcher->mutex);
+    return rank_id;
+}
+
+void releaseRank(rankDispatcher_t *dispatcher, const uint32_t rank_id) {  // Thread-safe. Called by the last callback of the work of a rank, once its results are drained
+    pthread_mutex_lock(&dispatcher->mutex);
+    dispatcher->idleRanks[dispatcher->idleRankAmt++] = rank_id;
+    pthread_cond_signal(&dispatcher->rankDrained);
+    pthread_mutex_unlock(&dispatcher->mutex);
+}
+
+void stopRankDispatcher(rankDispatcher_t *dispatcher) {  // Wait for all ranks to be drained
+    pthread_mutex_lock(&dispatcher->mutex);
+    while (dispatcher->idleRankAmt < dispatcher->rankAmt)
+        pthread_cond_wait(&dispatcher->rankDrained, &dispatcher->mutex);
+    pthread_mutex_unlock(&dispatcher->mutex);
+    free(dispatcher->idleRanks);
+    pthread_cond_destroy(&dispatcher->rankDrained);
+    pthread_mutex_destroy(&dispatcher->mutex);
+}
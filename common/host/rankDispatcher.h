@@ -0,0 +1,26 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: A dispatcher of work to the ranks of GCiM, which refills each rank as soon as its results are drained instead of waiting for all ranks.
+*/
+
+#ifndef GCIM_RANK_DISPATCHER_H
+#define GCIM_RANK_DISPATCHER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t rankDrained;
+    uint32_t *idleRanks;  // Stack of the ranks without work queued
+    uint32_t idleRankAmt;
+    uint32_t rankAmt;
+} rankDispatcher_t;
+
+void startRankDispatcher(rankDispatcher_t *dispatcher, const uint32_t nr_ranks);
+uint32_t waitIdleRank(rankDispatcher_t *dispatcher);
+void releaseRank(rankDispatcher_t *dispatcher, const uint32_t rank_id);
+void stopRankDispatcher(rankDispatcher_t *dispatcher);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: A background writer of GCiM results, which overlaps the writing of each batch with the DPU work of the next one.
+*/
+
+#include <stdio.h>  // printf
+#include <stdlib.h>  // malloc, free, exit
+#include "resultWriter.h"
+#include "dataIO.h"
+
+static void writeScatteredRows(const resultWriterJob_t *job) {  // Rows of consecutive ids are written at once
+    const uint8_t *data = (const uint8_t *)job->data;
+    const GADDRTYPE rowAmt = job->size / job->rowBytes;
+    for (GADDRTYPE rowBegin = 0, rowEnd; rowBegin < rowAmt; rowBegin = rowEnd) {
+        for (rowEnd = rowBegin + 1; rowEnd < rowAmt && job->rowIds[rowEnd] == job->rowIds[rowEnd - 1] + 1; ++rowEnd)
+            ;
+        writeDataAt(job->fd, data + rowBegin * job->rowBytes, (rowEnd - rowBegin) * job->rowBytes, job->offset + job->rowIds[rowBegin] * job->rowBytes);
+    }
+}
+
+static void *writeResults(void *args) {  // Jobs are written in the order they are pushed, each one at its own offset
+    resultWriter_t *writer = (resultWriter_t *)args;
+    pthread_mutex_lock(&writer->mutex);
+    while (true) {
+        while (writer->head == NULL && !writer->stopping)
+            pthread_cond_wait(&writer->jobPushed, &writer->mutex);
+        if (writer->head == NULL)
+            break;
+        resultWriterJob_t *job = writer->head;
+        writer->head = job->next;
+        if (writer->head == NULL)
+            writer->tail = NULL;
+        pthread_mutex_unlock(&writer->mutex);
+        if (job->rowIds != NULL)
+            writeScatteredRows(job);
+        else
+            writeDataAt(job->fd, job->data, job->size, job->offset);
+        if (job->owned)
+            free((void *)job->data);
+        pthread_mutex_lock(&writer->mutex);
+        if (job->owned)
+            writer->pendingBytes -= job->size;
+        free(job);
+        pthread_cond_broadcast(&writer->jobWritten);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+void startResultWriter(resultWriter_t *writer, const size_t budget) {
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->jobPushed, NULL);
+    pthread_cond_init(&writer->jobWritten, NULL);
+    writer->head = writer->tail = NULL;
+    writer->pendingBytes = 0;
+    writer->budget = budget;
+    writer->stopping = false;
+    if (pthread_create(&writer->thread, NULL, writeResults, writer) != 0) {
+        printf("Failed to create the result writer! Exit now!\n");
+        exit(-1);
+    }
+}
+
+static void pushJob(resultWriter_t *writer, resultWriterJob_t *job) {
+    const size_t size = job->size;
+    pthread_mutex_lock(&writer->mutex);
+    if (job->owned) {
+        while (writer->pendingBytes > 0 && writer->pendingBytes + size > writer->budget)  // Wait for the disk rather than buffering the whole result
+            pthread_cond_wait(&writer->jobWritten, &writer->mutex);
+        writer->pendingBytes += size;
+    }
+    if (writer->tail == NULL)
+        writer->head = job;
+    else
+        writer->tail->next = job;
+    writer->tail = job;
+    pthread_cond_signal(&writer->jobPushed);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+void pushResult(resultWriter_t *writer, const int fd, const void *data, const size_t size, const uint64_t offset, const bool owned) {  // Thread-safe. Owned buffers are freed by the writer, others must stay valid until `stopResultWriter` returns
+    resultWriterJob_t *job = malloc(sizeof(resultWriterJob_t));
+    job->fd = fd, job->data = data, job->size = size, job->offset = offset, job->rowIds = NULL, job->rowBytes = 0, job->owned = owned, job->next = NULL;
+    pushJob(writer, job);
+}
+
+void pushScatteredResult(resultWriter_t *writer, const int fd, const void *data, const size_t rowBytes, const GADDRTYPE rowAmt, const POINTIDTYPE *rowIds, const uint64_t offset, const bool owned) {  // As `pushResult`, but each row goes to the place of its id. `rowIds` must stay valid until the job is written
+    resultWriterJob_t *job = malloc(sizeof(resultWriterJob_t));
+    job->fd = fd, job->data = data, job->size = rowBytes * rowAmt, job->offset = offset, job->rowIds = rowIds, job->rowBytes = rowBytes, job->owned = owned, job->next = NULL;
+    pushJob(writer, job);
+}
+
+void stopResultWriter(resultWriter_t *writer) {  // Write all pushed jobs, then join the writer
+    pthread_mutex_lock(&writer->mutex);
+    writer->stopping = true;
+    pthread_cond_signal(&writer->jobPushed);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+    pthread_cond_destroy(&writer->jobWritten);
+    pthread_cond_destroy(&writer->jobPushed);
+    pthread_mutex_destroy(&writer->mutex);
+}
@@ -0,0 +1,46 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: A background writer of GCiM results, which overlaps the writing of each batch with the DPU work of the next one.
+*/
+
+#ifndef GCIM_RESULT_WRITER_H
+#define GCIM_RESULT_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "request.h"
+
+#define RESULT_WRITER_BUDGET (1UL << 30)  // Bytes of owned buffers waiting to be written. Producers block beyond this
+
+typedef struct resultWriterJob {
+    int fd;
+    const void *data;
+    size_t size;
+    uint64_t offset;
+    const POINTIDTYPE *rowIds;  // If not NULL, `data` holds rows of `rowBytes`, and row r is written at `offset + rowIds[r] * rowBytes`
+    size_t rowBytes;
+    bool owned;  // Free `data` once written
+    struct resultWriterJob *next;
+} resultWriterJob_t;
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t jobPushed;
+    pthread_cond_t jobWritten;
+    resultWriterJob_t *head;
+    resultWriterJob_t *tail;
+    size_t pendingBytes;
+    size_t budget;
+    bool stopping;
+} resultWriter_t;
+
+void startResultWriter(resultWriter_t *writer, const size_t budget);
+void pushResult(resultWriter_t *writer, const int fd, const void *data, const size_t size, const uint64_t offset, const bool owned);
+void pushScatteredResult(resultWriter_t *writer, const int fd, const void *data, const size_t rowBytes, const GADDRTYPE rowAmt, const POINTIDTYPE *rowIds, const uint64_t offset, const bool owned);
+void stopResultWriter(resultWriter_t *writer);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+Author: KMC20
+Date: 2023/12/16
+Function: Operations for the tree building phase on host of GCiM.
+*/
+
+#ifndef GCIM_TREE_H
+#define GCIM_TREE_H
+
+#include <stdint.h>
+#include "request.h"
+#include "treeKernels.h"
+#include <stdlib.h>
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+
+/***************************************************************************************************************************************************************************************************************/
+/******************************************************************************** This part is copied from `stdbool.h` of upmem ********************************************************************************/
+/***************************************************************************************************************************************************************************************************************/
+/**
+ * @def true
+ * @brief The <code>true</code> constant, represented by <code>1</code>
+ */
+#define true 1
+/**
+ * @def false
+ * @brief The <code>false</code> constant, represented by <code>0</code>
+ */
+#define false 0
+/***************************************************************************************************************************************************************************************************************/
+
+#define TREE_TASK_MIN_POINTS (1 << 16)  // Subtrees of fewer points are built by one task
+#define TREE_SPLIT_PARALLEL_MIN_POINTS (1 << 20)  // Nodes of more points are split out of place by all threads, since there are too few of them for tasks
+#define TREE_SPLIT_CHUNK_POINTS (1 << 14)  // Points of a node split by all threads are handled in chunks of this size
+#define TREE_SPLIT_BLOCK_POINTS 256  // Points classified at once from each end of a node split in place
+
+typedef struct {  // Leaves are pushed by the tree building thread as soon as they are final, and taken by the graph building phase while the rest of the tree is built
+    pthread_mutex_t mutex;
+    pthread_cond_t leafPushed;
+    GADDRTYPE leafIdSize;  // Leaves leafIds[0, leafIdSize) and their points are final
+    int done;
+} leafQueue_t;
+
+void startLeafQueue(leafQueue_t *leafQueue);
+void pushLeaves(leafQueue_t *leafQueue, const GADDRTYPE leafIdSize, const int done);
+void pushLeaf(leafQueue_t *leafQueue, GADDRTYPE *leafIds, const GADDRTYPE leafId);
+int waitLeaves(leafQueue_t *leafQueue, GADDRTYPE *leafIdSize);
+void stopLeafQueue(leafQueue_t *leafQueue);
+SUM_VALUE_TYPE accumulatorIndependent(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt);
+GADDRTYPE meanSpliterIndependent(ELEMTYPE *points, POINTIDTYPE *pointIds, const uint32_t pointSize, const GADDRTYPE left, const GADDRTYPE right, const MEAN_VALUE_TYPE mean, const uint32_t dim, const uint32_t dimAmt);
+GADDRTYPE splitNodeOnHost(ELEMTYPE *points, POINTIDTYPE *pointIds, ELEMTYPE *scratchPoints, POINTIDTYPE *scratchIds, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt, MEAN_VALUE_TYPE *mean);
+void treeConstrDPU(globalTreeNode_t *tree, GADDRTYPE *treeSizeRes, ELEMTYPE *points, POINTIDTYPE *pointIds, const GADDRTYPE treeBaseAddr, const GADDRTYPE pointAmt, const unsigned short dimAmt, const unsigned short leafCapacity, GADDRTYPE *leafIds, GADDRTYPE *leafIdSizeRes, leafQueue_t *leafQueue);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Column kernels of the tree building phase on host of GCiM: sums and classifications of one dimension of dimAmt-strided points, with AVX2 and AVX-512 versions chosen at runtime.
+*/
+
+#ifndef GCIM_TREE_KERNELS_H
+#define GCIM_TREE_KERNELS_H
+
+#include <stdint.h>
+#include "request.h"
+
+/*
+Values are compared as the scalar code does: each ELEMTYPE is promoted, then compared with the unsigned MEAN_VALUE_TYPE and added into the unsigned SUM_VALUE_TYPE.
+The SIMD kernels cover 1, 2 and 4-byte ELEMTYPEs, signed or not. Other widths, or CPUs without AVX2, run the scalar kernels.
+*/
+#define TREE_KERNEL_LESS 0
+#define TREE_KERNEL_EQUAL 1
+#define TREE_KERNEL_GREATER 2
+
+SUM_VALUE_TYPE sumColumn(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt);
+void classifyColumn(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt, const MEAN_VALUE_TYPE mean, uint32_t *ids[3], GADDRTYPE counts[3]);
+
+#endif
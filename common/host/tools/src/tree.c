@@ -0,0 +1,333 @@
+/*
+Author: KMC20
+Date: 2023/12/16
+Function: Operations for the tree building phase on host of GCiM.
+*/
+
+#include "tree.h"
+
+void startLeafQueue(leafQueue_t *leafQueue) {
+    pthread_mutex_init(&leafQueue->mutex, NULL);
+    pthread_cond_init(&leafQueue->leafPushed, NULL);
+    leafQueue->leafIdSize = 0;
+    leafQueue->done = false;
+}
+
+void pushLeaves(leafQueue_t *leafQueue, const GADDRTYPE leafIdSize, const int done) {  // Thread-safe. Leaves before `leafIdSize` are written, and `done` is set once no more leaves will come
+    pthread_mutex_lock(&leafQueue->mutex);
+    leafQueue->leafIdSize = leafIdSize;
+    leafQueue->done = done;
+    pthread_cond_broadcast(&leafQueue->leafPushed);
+    pthread_mutex_unlock(&leafQueue->mutex);
+}
+
+void pushLeaf(leafQueue_t *leafQueue, GADDRTYPE *leafIds, const GADDRTYPE leafId) {  // Thread-safe. Append a final leaf to leafIds
+    pthread_mutex_lock(&leafQueue->mutex);
+    leafIds[leafQueue->leafIdSize++] = leafId;
+    pthread_cond_broadcast(&leafQueue->leafPushed);
+    pthread_mutex_unlock(&leafQueue->mutex);
+}
+
+int waitLeaves(leafQueue_t *leafQueue, GADDRTYPE *leafIdSize) {  // Block until leaves after `*leafIdSize` are pushed, then update it. Return false once all leaves are pushed
+    pthread_mutex_lock(&leafQueue->mutex);
+    while (leafQueue->leafIdSize <= *leafIdSize && !leafQueue->done)
+        pthread_cond_wait(&leafQueue->leafPushed, &leafQueue->mutex);
+    *leafIdSize = leafQueue->leafIdSize;
+    int more = !leafQueue->done;
+    pthread_mutex_unlock(&leafQueue->mutex);
+    return more;
+}
+
+void stopLeafQueue(leafQueue_t *leafQueue) {
+    pthread_mutex_destroy(&leafQueue->mutex);
+    pthread_cond_destroy(&leafQueue->leafPushed);
+}
+
+SUM_VALUE_TYPE accumulatorIndependent(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {
+    return sumColumn(points, left, right, dim, dimAmt);
+}
+
+static void swapPoints(ELEMTYPE *points, POINTIDTYPE *pointIds, const uint32_t pointSize, const uint32_t dimAmt, const GADDRTYPE lPointId, const GADDRTYPE rPointId) {
+    ELEMTYPE tmp[dimAmt];
+    ELEMTYPE *lPointPt = points + dimAmt * lPointId, *rPointPt = points + dimAmt * rPointId;
+    memcpy(tmp, lPointPt, pointSize);
+    memcpy(lPointPt, rPointPt, pointSize);
+    memcpy(rPointPt, tmp, pointSize);
+    POINTIDTYPE tmpId = pointIds[lPointId];
+    pointIds[lPointId] = pointIds[rPointId], pointIds[rPointId] = tmpId;
+}
+
+static uint32_t getMisplacedIds(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt, const MEAN_VALUE_TYPE mean, const uint32_t typeBegin, const uint32_t typeEnd, uint32_t *misplacedIds) {  // Ids relative to left of the points of types [typeBegin, typeEnd)
+    uint32_t typeIds[3][TREE_SPLIT_BLOCK_POINTS];
+    uint32_t *ids[3] = { typeIds[0], typeIds[1], typeIds[2] };
+    GADDRTYPE counts[3];
+    classifyColumn(points, left, right, dim, dimAmt, mean, ids, counts);
+    uint32_t misplacedAmt = 0;
+    for (uint32_t type = typeBegin; type < typeEnd; ++type) {
+        memcpy(misplacedIds + misplacedAmt, typeIds[type], sizeof(uint32_t) * counts[type]);
+        misplacedAmt += counts[type];
+    }
+    return misplacedAmt;
+}
+
+static GADDRTYPE partitionColumn(ELEMTYPE *points, POINTIDTYPE *pointIds, const uint32_t pointSize, GADDRTYPE left, GADDRTYPE right, const MEAN_VALUE_TYPE mean, const uint32_t lastLeftType, const uint32_t dim, const uint32_t dimAmt) {  // In place: points of types up to lastLeftType go before the returned pivot. Misplaced points of a block at each end are listed at once, then swapped in pairs; blocks are taken until the ends meet
+    uint32_t lIds[TREE_SPLIT_BLOCK_POINTS], rIds[TREE_SPLIT_BLOCK_POINTS];
+    uint32_t lIdAmt = 0, rIdAmt = 0, lIdNext = 0, rIdNext = 0;
+    while (right - left >= 2 * TREE_SPLIT_BLOCK_POINTS) {
+        if (lIdNext == lIdAmt)
+            lIdAmt = getMisplacedIds(points, left, left + TREE_SPLIT_BLOCK_POINTS, dim, dimAmt, mean, lastLeftType + 1, 3, lIds), lIdNext = 0;
+        if (rIdNext == rIdAmt)
+            rIdAmt = getMisplacedIds(points, right - TREE_SPLIT_BLOCK_POINTS, right, dim, dimAmt, mean, 0, lastLeftType + 1, rIds), rIdNext = 0;
+        for (; lIdNext < lIdAmt && rIdNext < rIdAmt; ++lIdNext, ++rIdNext)
+            swapPoints(points, pointIds, pointSize, dimAmt, left + lIds[lIdNext], right - TREE_SPLIT_BLOCK_POINTS + rIds[rIdNext]);
+        if (lIdNext == lIdAmt)
+            left += TREE_SPLIT_BLOCK_POINTS;
+        if (rIdNext == rIdAmt)
+            right -= TREE_SPLIT_BLOCK_POINTS;
+    }
+    while (true) {  // Fewer than two blocks are left, possibly with misplaced points not swapped yet
+        while (left < right && (lastLeftType == TREE_KERNEL_LESS ? points[dimAmt * left + dim] < mean : points[dimAmt * left + dim] <= mean))
+            ++left;
+        while (left < right && (lastLeftType == TREE_KERNEL_LESS ? points[dimAmt * (right - 1) + dim] >= mean : points[dimAmt * (right - 1) + dim] > mean))
+            --right;
+        if (left >= right)
+            break;
+        swapPoints(points, pointIds, pointSize, dimAmt, left++, --right);
+    }
+    return left;
+}
+
+GADDRTYPE meanSpliterIndependent(ELEMTYPE *points, POINTIDTYPE *pointIds, const uint32_t pointSize, const GADDRTYPE left, const GADDRTYPE right, const MEAN_VALUE_TYPE mean, const uint32_t dim, const uint32_t dimAmt) {  // Return the pivot: points before it are smaller than or equal to the mean value, and the others are larger
+    GADDRTYPE pivot = partitionColumn(points, pointIds, pointSize, left, right, mean, TREE_KERNEL_EQUAL, dim, dimAmt);
+    if (pivot - left > right - pivot) {  // Solve the extreme imbalance problem: if the points equal to the mean outnumber the larger ones, half of them are moved into the right part
+        GADDRTYPE counts[3];
+        classifyColumn(points, left, pivot, dim, dimAmt, mean, NULL, counts);
+        if (counts[TREE_KERNEL_EQUAL] > right - pivot)
+            pivot = partitionColumn(points, pointIds, pointSize, left, pivot, mean, TREE_KERNEL_LESS, dim, dimAmt) + counts[TREE_KERNEL_EQUAL] - (counts[TREE_KERNEL_EQUAL] >> 1);
+    }
+    return pivot;
+}
+
+static SUM_VALUE_TYPE accumulatorParallel(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {  // Chunks are summed by the idle threads of the team
+    GADDRTYPE chunkAmt = (right - left + TREE_SPLIT_CHUNK_POINTS - 1) / TREE_SPLIT_CHUNK_POINTS;
+    SUM_VALUE_TYPE *sums = malloc(sizeof(SUM_VALUE_TYPE) * chunkAmt);
+#pragma omp taskloop grainsize(1)
+    for (GADDRTYPE chunk = 0; chunk < chunkAmt; ++chunk) {
+        GADDRTYPE chunkLeft = left + chunk * TREE_SPLIT_CHUNK_POINTS, chunkRight = right - chunkLeft > TREE_SPLIT_CHUNK_POINTS ? chunkLeft + TREE_SPLIT_CHUNK_POINTS : right;
+        sums[chunk] = accumulatorIndependent(points, chunkLeft, chunkRight, dim, dimAmt);
+    }
+    SUM_VALUE_TYPE sum = 0;
+    for (GADDRTYPE chunk = 0; chunk < chunkAmt; ++chunk)
+        sum += sums[chunk];
+    free(sums);
+    return sum;
+}
+
+static GADDRTYPE meanSpliterParallel(ELEMTYPE *points, POINTIDTYPE *pointIds, ELEMTYPE *scratchPoints, POINTIDTYPE *scratchIds, const uint32_t pointSize, const GADDRTYPE left, const GADDRTYPE right, const MEAN_VALUE_TYPE mean, const uint32_t dim, const uint32_t dimAmt) {  // Out of place: chunks are classified, placed by prefix sums of their counts, scattered into the scratch buffers and copied back. Return the same pivot as `meanSpliterIndependent`
+    GADDRTYPE chunkAmt = (right - left + TREE_SPLIT_CHUNK_POINTS - 1) / TREE_SPLIT_CHUNK_POINTS;
+    GADDRTYPE (*offsets)[3] = malloc(sizeof(GADDRTYPE[3]) * chunkAmt);  // Points below, equal to and above the mean in each chunk, then where they go
+#pragma omp taskloop grainsize(1)
+    for (GADDRTYPE chunk = 0; chunk < chunkAmt; ++chunk) {
+        GADDRTYPE chunkLeft = left + chunk * TREE_SPLIT_CHUNK_POINTS, chunkRight = right - chunkLeft > TREE_SPLIT_CHUNK_POINTS ? chunkLeft + TREE_SPLIT_CHUNK_POINTS : right;
+        classifyColumn(points, chunkLeft, chunkRight, dim, dimAmt, mean, NULL, offsets[chunk]);
+    }
+    GADDRTYPE totals[3] = { 0, 0, 0 };
+    for (uint32_t part = 0, partBegin = 0; part < 3; ++part) {  // Parts follow each other, and chunks follow each other in each part
+        GADDRTYPE offset = left + partBegin;
+        for (GADDRTYPE chunk = 0; chunk < chunkAmt; ++chunk) {
+            GADDRTYPE count = offsets[chunk][part];
+            offsets[chunk][part] = offset;
+            offset += count;
+        }
+        totals[part] = offset - left - partBegin;
+        partBegin += totals[part];
+    }
+#pragma omp taskloop grainsize(1)
+    for (GADDRTYPE chunk = 0; chunk < chunkAmt; ++chunk) {
+        GADDRTYPE chunkLeft = left + chunk * TREE_SPLIT_CHUNK_POINTS, chunkRight = right - chunkLeft > TREE_SPLIT_CHUNK_POINTS ? chunkLeft + TREE_SPLIT_CHUNK_POINTS : right;
+        uint32_t *chunkIds = malloc(sizeof(uint32_t) * 3 * TREE_SPLIT_CHUNK_POINTS);
+        uint32_t *ids[3] = { chunkIds, chunkIds + TREE_SPLIT_CHUNK_POINTS, chunkIds + 2 * TREE_SPLIT_CHUNK_POINTS };
+        GADDRTYPE counts[3];
+        classifyColumn(points, chunkLeft, chunkRight, dim, dimAmt, mean, ids, counts);
+        for (uint32_t type = 0; type < 3; ++type)
+            for (GADDRTYPE idId = 0, to = offsets[chunk][type]; idId < counts[type]; ++idId, ++to) {
+                GADDRTYPE pointId = chunkLeft + ids[type][idId];
+                memcpy(scratchPoints + dimAmt * to, points + dimAmt * pointId, pointSize);
+                scratchIds[to] = pointIds[pointId];
+            }
+        free(chunkIds);
+    }
+#pragma omp taskloop grainsize(1)
+    for (GADDRTYPE chunk = 0; chunk < chunkAmt; ++chunk) {
+        GADDRTYPE chunkLeft = left + chunk * TREE_SPLIT_CHUNK_POINTS, chunkRight = right - chunkLeft > TREE_SPLIT_CHUNK_POINTS ? chunkLeft + TREE_SPLIT_CHUNK_POINTS : right;
+        memcpy(points + dimAmt * chunkLeft, scratchPoints + dimAmt * chunkLeft, (size_t)pointSize * (chunkRight - chunkLeft));
+        memcpy(pointIds + chunkLeft, scratchIds + chunkLeft, sizeof(POINTIDTYPE) * (chunkRight - chunkLeft));
+    }
+    free(offsets);
+    GADDRTYPE movedEqAmt = totals[1] > totals[2] ? totals[1] >> 1 : 0;  // Solve the extreme imbalance problem as the serial spliter: half of the points equal to the mean go to the right part
+    return left + totals[0] + totals[1] - movedEqAmt;
+}
+
+GADDRTYPE splitNodeOnHost(ELEMTYPE *points, POINTIDTYPE *pointIds, ELEMTYPE *scratchPoints, POINTIDTYPE *scratchIds, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt, MEAN_VALUE_TYPE *mean) {  // Split one node by all threads, out of place unless the scratch buffers are NULL, and return the pivot. For top trees split level by level outside `treeConstrDPU`
+    GADDRTYPE pivot = left;
+#pragma omp parallel
+#pragma omp single
+    {
+        *mean = accumulatorParallel(points, left, right, dim, dimAmt) / (right - left);
+        pivot = scratchPoints != NULL ? meanSpliterParallel(points, pointIds, scratchPoints, scratchIds, sizeof(ELEMTYPE) * dimAmt, left, right, *mean, dim, dimAmt) : meanSpliterIndependent(points, pointIds, sizeof(ELEMTYPE) * dimAmt, left, right, *mean, dim, dimAmt);
+    }
+    return pivot;
+}
+
+typedef struct {  // Shared by all tasks of a tree
+    globalTreeNode_t *localTree;
+    ELEMTYPE *points;
+    POINTIDTYPE *pointIds;
+    uint32_t pointSize;
+    unsigned short dimAmt;
+    unsigned short leafCapacity;
+    ELEMTYPE *scratchPoints;  // Target of the out-of-place splits, indexed as the points. NULL if there is no memory for it, so all nodes are split in place
+    POINTIDTYPE *scratchIds;
+    GADDRTYPE treeSize;  // Nodes are taken atomically, so ids stay stable for the leaves already pushed
+    GADDRTYPE *leafIds;
+    GADDRTYPE leafSize;  // Unused with a leaf queue, which counts the leaves itself
+    leafQueue_t *leafQueue;
+} treeBuilder_t;
+
+static uint64_t randGen(uint64_t *state) {  // splitmix64. Each subtree draws from its own state, so tasks need no lock and the tree does not depend on their schedule
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static GADDRTYPE newTreeNode(treeBuilder_t *builder) {
+    return __atomic_fetch_add(&builder->treeSize, 1, __ATOMIC_RELAXED);
+}
+
+static void setLeaf(treeBuilder_t *builder, const GADDRTYPE nodeId, const GADDRTYPE left, const GADDRTYPE right) {  // Leaves are pushed once their points are final
+    globalTreeNode_t *leaf = builder->localTree + nodeId;
+    leaf->mean = left;
+    leaf->dim = right - left;
+    leaf->left = leaf->right = GADDRTYPE_NULL;
+    if (builder->leafQueue != NULL)
+        pushLeaf(builder->leafQueue, builder->leafIds, nodeId);
+    else
+        builder->leafIds[__atomic_fetch_add(&builder->leafSize, 1, __ATOMIC_RELAXED)] = nodeId;
+}
+
+static GADDRTYPE splitTreeNode(treeBuilder_t *builder, const GADDRTYPE nodeId, const GADDRTYPE left, const GADDRTYPE right, uint64_t *state) {  // Split the points of an inner node by the mean of a random dimension, and return the pivot
+    globalTreeNode_t *node = builder->localTree + nodeId;
+    unsigned short dim = randGen(state) % builder->dimAmt;
+    if (right - left >= TREE_SPLIT_PARALLEL_MIN_POINTS && builder->scratchPoints != NULL) {  // Nodes this large are too few to keep all threads busy with tasks
+        MEAN_VALUE_TYPE mean = accumulatorParallel(builder->points, left, right, dim, builder->dimAmt) / (right - left);
+        node->mean = mean;
+        node->dim = dim;
+        return meanSpliterParallel(builder->points, builder->pointIds, builder->scratchPoints, builder->scratchIds, builder->pointSize, left, right, mean, dim, builder->dimAmt);
+    }
+    SUM_VALUE_TYPE sum = accumulatorIndependent(builder->points, left, right, dim, builder->dimAmt);
+    MEAN_VALUE_TYPE mean = sum / (right - left);
+    GADDRTYPE pivot = meanSpliterIndependent(builder->points, builder->pointIds, builder->pointSize, left, right, mean, dim, builder->dimAmt);
+    node->mean = mean;
+    node->dim = dim;
+    return pivot;
+}
+
+static void buildSubtreeSerial(treeBuilder_t *builder, const GADDRTYPE rootId, const GADDRTYPE rootLeft, const GADDRTYPE rootRight, uint64_t state) {  // Static linked-list
+    GADDRTYPE leafCapacity = builder->leafCapacity;
+    uint32_t STACK_MAX_SIZE = ((sizeof(GADDRTYPE) << 3) - __builtin_clzll(rootRight - rootLeft)) << 1;  // ceil(log2(pointAmt)) * 2
+    GADDRTYPE tstack[STACK_MAX_SIZE << 1];
+    GADDRTYPE lstack[STACK_MAX_SIZE << 1];
+    GADDRTYPE rstack[STACK_MAX_SIZE << 1];
+    uint32_t stackSize = 0;
+    tstack[stackSize] = rootId;
+    lstack[stackSize] = rootLeft;
+    rstack[stackSize++] = rootRight;
+    while (stackSize > 0) {  // Inorder tranverse
+        GADDRTYPE ttop = tstack[--stackSize];
+        GADDRTYPE ltop = lstack[stackSize], rtop = rstack[stackSize];
+        if (rtop - ltop <= leafCapacity) {  // Leaf node
+            setLeaf(builder, ttop, ltop, rtop);
+            continue;
+        }
+        GADDRTYPE pivot = splitTreeNode(builder, ttop, ltop, rtop, &state);
+        globalTreeNode_t *node = builder->localTree + ttop;
+        if (rtop - pivot > leafCapacity) {
+            node->right = newTreeNode(builder);
+            tstack[stackSize] = node->right;
+            lstack[stackSize] = pivot;
+            rstack[stackSize++] = rtop;
+        } else {
+            if (pivot < rtop) {
+                node->right = newTreeNode(builder);
+                setLeaf(builder, node->right, pivot, rtop);
+            } else {
+                node->right = GADDRTYPE_NULL;
+            }
+        }
+        if (pivot - ltop > leafCapacity) {
+            node->left = newTreeNode(builder);
+            tstack[stackSize] = node->left;
+            lstack[stackSize] = ltop;
+            rstack[stackSize++] = pivot;
+        } else {
+            if (pivot > ltop) {
+                node->left = newTreeNode(builder);
+                setLeaf(builder, node->left, ltop, pivot);
+            } else {
+                node->left = GADDRTYPE_NULL;
+            }
+        }
+    }
+}
+
+static void buildSubtree(treeBuilder_t *builder, const GADDRTYPE nodeId, const GADDRTYPE left, const GADDRTYPE right, uint64_t state) {  // Subtrees are independent below a split, so each large one is a task of its own and idle threads steal them
+    if (right - left <= TREE_TASK_MIN_POINTS || right - left <= builder->leafCapacity) {
+        buildSubtreeSerial(builder, nodeId, left, right, state);
+        return;
+    }
+    GADDRTYPE pivot = splitTreeNode(builder, nodeId, left, right, &state);
+    globalTreeNode_t *node = builder->localTree + nodeId;
+    GADDRTYPE childLefts[2] = { pivot, left }, childRights[2] = { right, pivot };  // The right child first, as in the serial builder
+    GADDRTYPE *childIds[2] = { &node->right, &node->left };
+    for (uint32_t child = 0; child < 2; ++child) {
+        GADDRTYPE childLeft = childLefts[child], childRight = childRights[child];
+        if (childRight - childLeft > builder->leafCapacity) {
+            GADDRTYPE childId = *childIds[child] = newTreeNode(builder);
+            uint64_t childState = randGen(&state);
+#pragma omp task firstprivate(builder, childId, childLeft, childRight, childState)
+            buildSubtree(builder, childId, childLeft, childRight, childState);
+        } else if (childRight > childLeft) {
+            *childIds[child] = newTreeNode(builder);
+            setLeaf(builder, *childIds[child], childLeft, childRight);
+        } else {
+            *childIds[child] = GADDRTYPE_NULL;
+        }
+    }
+}
+
+void treeConstrDPU(globalTreeNode_t *tree, GADDRTYPE *treeSizeRes, ELEMTYPE *points, POINTIDTYPE *pointIds, const GADDRTYPE treeBaseAddr, const GADDRTYPE pointAmt, const unsigned short dimAmt, const unsigned short leafCapacity, GADDRTYPE *leafIds, GADDRTYPE *leafIdSizeRes, leafQueue_t *leafQueue) {  // Built by the threads of OpenMP. Leaves are pushed into `leafQueue` one by one unless it is NULL
+    if (pointAmt < 1) {
+        if (leafQueue != NULL)
+            pushLeaves(leafQueue, 0, true);
+        return;
+    }
+    treeBuilder_t builder = { .localTree = tree - treeBaseAddr, .points = points, .pointIds = pointIds, .pointSize = sizeof(ELEMTYPE) * dimAmt, .dimAmt = dimAmt, .leafCapacity = leafCapacity, .scratchPoints = NULL, .scratchIds = NULL, .treeSize = treeBaseAddr + 1, .leafIds = leafIds, .leafSize = 0, .leafQueue = leafQueue };
+    if (pointAmt >= TREE_SPLIT_PARALLEL_MIN_POINTS) {  // Out-of-place splits take a second copy of the points
+        builder.scratchPoints = malloc(sizeof(ELEMTYPE) * pointAmt * dimAmt), builder.scratchIds = malloc(sizeof(POINTIDTYPE) * pointAmt);
+        if (builder.scratchPoints == NULL || builder.scratchIds == NULL) {
+            free(builder.scratchPoints), free(builder.scratchIds);
+            builder.scratchPoints = NULL, builder.scratchIds = NULL;
+        }
+    }
+    uint64_t state = time(0);
+#pragma omp parallel
+#pragma omp single
+    buildSubtree(&builder, treeBaseAddr, 0, pointAmt, state);
+    free(builder.scratchPoints);
+    free(builder.scratchIds);
+    GADDRTYPE leafSize = leafQueue != NULL ? leafQueue->leafIdSize : builder.leafSize;  // All tasks are done after the parallel region
+    *treeSizeRes = builder.treeSize, *leafIdSizeRes = leafSize;
+    if (leafQueue != NULL)
+        pushLeaves(leafQueue, leafSize, true);
+}
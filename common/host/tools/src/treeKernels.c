@@ -0,0 +1,144 @@
+/*
+Author: KMC20
+Date: 2026/10
+Function: Column kernels of the tree building phase on host of GCiM: sums and classifications of one dimension of dimAmt-strided points, with AVX2 and AVX-512 versions chosen at runtime.
+*/
+
+#include "treeKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TREE_KERNELS_X86
+#endif
+
+#define ELEM_SIGNED ((ELEMTYPE)-1 < 1)
+#define ELEM_SHIFT (32 - 8 * sizeof(ELEMTYPE))  // Each lane gathers 32 bits from the first byte of an ELEMTYPE, and keeps the low ones
+#define GATHER_TAIL_ROWS 4  // Rows left to the scalar kernels, so that no gathered word passes the last point, even with 1-byte points of 1 dimension
+
+static SUM_VALUE_TYPE sumColumnScalar(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {
+    SUM_VALUE_TYPE sum = 0;
+    for (const ELEMTYPE *pointPt = points + dimAmt * left + dim, *pointPtEnd = points + dimAmt * right; pointPt < pointPtEnd; pointPt += dimAmt)
+        sum += *pointPt;
+    return sum;
+}
+
+static void classifyColumnScalar(const ELEMTYPE *const points, const GADDRTYPE begin, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt, const MEAN_VALUE_TYPE mean, uint32_t *ids[3], GADDRTYPE counts[3]) {  // Ids are relative to `begin`, the left of the whole range
+    for (GADDRTYPE pointId = left; pointId < right; ++pointId) {
+        ELEMTYPE value = points[dimAmt * pointId + dim];
+        uint32_t type = value < mean ? TREE_KERNEL_LESS : value == mean ? TREE_KERNEL_EQUAL : TREE_KERNEL_GREATER;
+        if (ids != NULL)
+            ids[type][counts[type]] = pointId - begin;
+        ++counts[type];
+    }
+}
+
+#ifdef TREE_KERNELS_X86
+__attribute__((target("avx2"))) static __m256i gatherColumnAVX2(const ELEMTYPE *const pointPt, const __m256i offsets) {  // 8 values of one dimension, widened into 32 bits as the scalar code promotes them
+    __m256i values = _mm256_sll_epi32(_mm256_i32gather_epi32((const int *)pointPt, offsets, 1), _mm_cvtsi32_si128(ELEM_SHIFT));
+    return ELEM_SIGNED ? _mm256_sra_epi32(values, _mm_cvtsi32_si128(ELEM_SHIFT)) : _mm256_srl_epi32(values, _mm_cvtsi32_si128(ELEM_SHIFT));
+}
+
+__attribute__((target("avx2"))) static SUM_VALUE_TYPE sumColumnAVX2(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {
+    const int stride = dimAmt * sizeof(ELEMTYPE);
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    __m256i sums = _mm256_setzero_si256();
+    GADDRTYPE pointId = left;
+    for (; pointId + 8 + GATHER_TAIL_ROWS <= right; pointId += 8) {
+        __m256i values = gatherColumnAVX2(points + dimAmt * pointId + dim, offsets);
+        __m128i low = _mm256_castsi256_si128(values), high = _mm256_extracti128_si256(values, 1);
+        sums = _mm256_add_epi64(sums, ELEM_SIGNED ? _mm256_cvtepi32_epi64(low) : _mm256_cvtepu32_epi64(low));
+        sums = _mm256_add_epi64(sums, ELEM_SIGNED ? _mm256_cvtepi32_epi64(high) : _mm256_cvtepu32_epi64(high));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, sums);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumColumnScalar(points, pointId, right, dim, dimAmt);
+}
+
+__attribute__((target("avx2,popcnt"))) static void classifyColumnAVX2(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt, const MEAN_VALUE_TYPE mean, uint32_t *ids[3], GADDRTYPE counts[3]) {  // AVX2 has no compress, so ids are taken from the set bits of the masks
+    const int stride = dimAmt * sizeof(ELEMTYPE);
+    const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    const __m256i signBits = _mm256_set1_epi32(INT32_MIN), means = _mm256_set1_epi32(mean), flippedMeans = _mm256_xor_si256(means, signBits);  // Unsigned comparisons by signed ones on flipped sign bits
+    GADDRTYPE pointId = left;
+    for (; pointId + 8 + GATHER_TAIL_ROWS <= right; pointId += 8) {
+        __m256i values = gatherColumnAVX2(points + dimAmt * pointId + dim, offsets);
+        uint32_t masks[3];
+        masks[TREE_KERNEL_LESS] = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(flippedMeans, _mm256_xor_si256(values, signBits))));
+        masks[TREE_KERNEL_EQUAL] = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(values, means)));
+        masks[TREE_KERNEL_GREATER] = 0xFF & ~(masks[TREE_KERNEL_LESS] | masks[TREE_KERNEL_EQUAL]);
+        for (uint32_t type = 0; type < 3; ++type) {
+            if (ids != NULL)
+                for (uint32_t mask = masks[type], *typeIds = ids[type] + counts[type], base = pointId - left; mask != 0; mask &= mask - 1)
+                    *typeIds++ = base + __builtin_ctz(mask);
+            counts[type] += __builtin_popcount(masks[type]);
+        }
+    }
+    classifyColumnScalar(points, left, pointId, right, dim, dimAmt, mean, ids, counts);
+}
+
+__attribute__((target("avx512f"))) static __m512i gatherColumnAVX512(const ELEMTYPE *const pointPt, const __m512i offsets) {  // 16 values of one dimension, widened into 32 bits as the scalar code promotes them
+    __m512i values = _mm512_sll_epi32(_mm512_i32gather_epi32(offsets, (const void *)pointPt, 1), _mm_cvtsi32_si128(ELEM_SHIFT));
+    return ELEM_SIGNED ? _mm512_sra_epi32(values, _mm_cvtsi32_si128(ELEM_SHIFT)) : _mm512_srl_epi32(values, _mm_cvtsi32_si128(ELEM_SHIFT));
+}
+
+__attribute__((target("avx512f"))) static SUM_VALUE_TYPE sumColumnAVX512(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {
+    const __m512i offsets = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(dimAmt * sizeof(ELEMTYPE)));
+    __m512i sums = _mm512_setzero_si512();
+    GADDRTYPE pointId = left;
+    for (; pointId + 16 + GATHER_TAIL_ROWS <= right; pointId += 16) {
+        __m512i values = gatherColumnAVX512(points + dimAmt * pointId + dim, offsets);
+        __m256i low = _mm512_castsi512_si256(values), high = _mm512_extracti64x4_epi64(values, 1);
+        sums = _mm512_add_epi64(sums, ELEM_SIGNED ? _mm512_cvtepi32_epi64(low) : _mm512_cvtepu32_epi64(low));
+        sums = _mm512_add_epi64(sums, ELEM_SIGNED ? _mm512_cvtepi32_epi64(high) : _mm512_cvtepu32_epi64(high));
+    }
+    return _mm512_reduce_add_epi64(sums) + sumColumnScalar(points, pointId, right, dim, dimAmt);
+}
+
+__attribute__((target("avx512f,popcnt"))) static void classifyColumnAVX512(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt, const MEAN_VALUE_TYPE mean, uint32_t *ids[3], GADDRTYPE counts[3]) {
+    const __m512i offsets = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(dimAmt * sizeof(ELEMTYPE)));
+    const __m512i means = _mm512_set1_epi32(mean), lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    GADDRTYPE pointId = left;
+    for (; pointId + 16 + GATHER_TAIL_ROWS <= right; pointId += 16) {
+        __m512i values = gatherColumnAVX512(points + dimAmt * pointId + dim, offsets);
+        __mmask16 masks[3];
+        masks[TREE_KERNEL_LESS] = _mm512_cmplt_epu32_mask(values, means);
+        masks[TREE_KERNEL_EQUAL] = _mm512_cmpeq_epu32_mask(values, means);
+        masks[TREE_KERNEL_GREATER] = ~(masks[TREE_KERNEL_LESS] | masks[TREE_KERNEL_EQUAL]);
+        __m512i pointIds = _mm512_add_epi32(lanes, _mm512_set1_epi32(pointId - left));
+        for (uint32_t type = 0; type < 3; ++type) {
+            if (ids != NULL)
+                _mm512_mask_compressstoreu_epi32(ids[type] + counts[type], masks[type], pointIds);
+            counts[type] += __builtin_popcount(masks[type]);
+        }
+    }
+    classifyColumnScalar(points, left, pointId, right, dim, dimAmt, mean, ids, counts);
+}
+#endif
+
+SUM_VALUE_TYPE sumColumn(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt) {
+#ifdef TREE_KERNELS_X86
+    if (sizeof(ELEMTYPE) <= 4) {
+        if (__builtin_cpu_supports("avx512f"))
+            return sumColumnAVX512(points, left, right, dim, dimAmt);
+        if (__builtin_cpu_supports("avx2"))
+            return sumColumnAVX2(points, left, right, dim, dimAmt);
+    }
+#endif
+    return sumColumnScalar(points, left, right, dim, dimAmt);
+}
+
+void classifyColumn(const ELEMTYPE *const points, const GADDRTYPE left, const GADDRTYPE right, const uint32_t dim, const uint32_t dimAmt, const MEAN_VALUE_TYPE mean, uint32_t *ids[3], GADDRTYPE counts[3]) {  // Split points [left, right) into points less than, equal to and greater than the mean. Each type of ids is compacted into ids[type] relative to left, unless ids is NULL. Counts are zeroed first
+    counts[TREE_KERNEL_LESS] = counts[TREE_KERNEL_EQUAL] = counts[TREE_KERNEL_GREATER] = 0;
+#ifdef TREE_KERNELS_X86
+    if (sizeof(ELEMTYPE) <= 4) {
+        if (__builtin_cpu_supports("avx512f")) {
+            classifyColumnAVX512(points, left, right, dim, dimAmt, mean, ids, counts);
+            return;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            classifyColumnAVX2(points, left, right, dim, dimAmt, mean, ids, counts);
+            return;
+        }
+    }
+#endif
+    classifyColumnScalar(points, left, left, right, dim, dimAmt, mean, ids, counts);
+}